@@ -0,0 +1,463 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "benchmark.h"
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "pconsumer.h"
+#include "pscheduler.h"
+#include "psender.h"
+#include "qpairingheap.h"
+#include "timingwheel.h"
+#include "../line-gui/netgraph.h"
+
+/// allocation counting
+
+// Counts the calls to malloc and realloc (this includes the Qt containers and operator new).
+// Relies on the glibc internal entry points.
+static quint64 allocationCount = 0;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+	allocationCount++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	allocationCount++;
+	return __libc_realloc(ptr, size);
+}
+
+/// hardware counters
+
+// Counts the last level cache misses of the calling thread, in user space
+class CacheMissCounter {
+public:
+	CacheMissCounter() {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	~CacheMissCounter() {
+		if (fd >= 0)
+			close(fd);
+	}
+
+	void start() {
+		if (fd < 0)
+			return;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	// Returns -1 if the counter is not available
+	qint64 stop() {
+		if (fd < 0)
+			return -1;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		quint64 count;
+		if (read(fd, &count, sizeof(count)) != sizeof(count))
+			return -1;
+		return count;
+	}
+
+private:
+	int fd;
+};
+
+// Measures time, allocations and cache misses between start() and stop()
+class StageMeter {
+public:
+	void start() {
+		allocations = allocationCount;
+		misses.start();
+		ts = get_current_time();
+	}
+
+	void stop(BenchResult &result) {
+		result.elapsed = get_current_time() - ts;
+		result.cacheMisses = misses.stop();
+		result.allocations = allocationCount - allocations;
+	}
+
+private:
+	quint64 ts;
+	quint64 allocations;
+	CacheMissCounter misses;
+};
+
+/// synthetic topologies
+
+#define BENCH_BANDWIDTH    125000.0 // KB/s
+#define BENCH_DELAY        1        // ms
+#define BENCH_QUEUE_LENGTH 1000     // frames
+#define BENCH_FRAME_SIZE   1000     // bytes
+
+static void addLink(NetGraph *g, int a, int b)
+{
+	g->addEdgeSym(a, b, BENCH_BANDWIDTH, BENCH_DELAY, 0.0, BENCH_QUEUE_LENGTH);
+}
+
+// Computes hop-count shortest path routes towards every path destination, then the paths and the forwarding tables
+static void finishGraph(NetGraph *g, QList<QPair<int, int> > pathEnds)
+{
+	QVector<QList<int> > neighbours(g->nodes.count());
+	foreach (NetGraphEdge e, g->edges) {
+		neighbours[e.source] << e.dest;
+	}
+
+	QSet<int> destinations;
+	for (int i = 0; i < pathEnds.count(); i++) {
+		destinations.insert(pathEnds[i].second);
+	}
+	// node -> (destination -> next hop)
+	QVector<QMultiHash<int, int> > routes(g->nodes.count());
+	foreach (int d, destinations) {
+		// BFS from the destination; the parent of a node is its next hop
+		QVector<int> nextHop(g->nodes.count(), -1);
+		QList<int> queue;
+		queue << d;
+		nextHop[d] = d;
+		while (!queue.isEmpty()) {
+			int n = queue.takeFirst();
+			foreach (int m, neighbours[n]) {
+				if (nextHop[m] < 0) {
+					nextHop[m] = n;
+					queue << m;
+				}
+			}
+		}
+		for (int n = 0; n < g->nodes.count(); n++) {
+			if (n != d && nextHop[n] >= 0) {
+				routes[n].insert(d, nextHop[n]);
+			}
+		}
+	}
+	for (int n = 0; n < g->nodes.count(); n++) {
+		g->nodes[n].routes.setRoutes(routes[n]);
+	}
+
+	// the edge cache is needed to trace the paths
+	g->prepareEmulation();
+	for (int i = 0; i < pathEnds.count(); i++) {
+		g->paths << NetGraphPath(*g, pathEnds[i].first, pathEnds[i].second);
+	}
+	g->prepareEmulation();
+}
+
+NetGraph *makeChainGraph(int routers)
+{
+	NetGraph *g = new NetGraph();
+	int first = g->addNode(NETGRAPH_NODE_HOST);
+	int prev = first;
+	for (int i = 0; i < routers; i++) {
+		int r = g->addNode(NETGRAPH_NODE_ROUTER);
+		addLink(g, prev, r);
+		prev = r;
+	}
+	int last = g->addNode(NETGRAPH_NODE_HOST);
+	addLink(g, prev, last);
+
+	QList<QPair<int, int> > pathEnds;
+	pathEnds << QPair<int, int>(first, last) << QPair<int, int>(last, first);
+	finishGraph(g, pathEnds);
+	return g;
+}
+
+NetGraph *makeStarGraph(int hosts)
+{
+	NetGraph *g = new NetGraph();
+	int center = g->addNode(NETGRAPH_NODE_ROUTER);
+	QList<int> hostNodes;
+	for (int i = 0; i < hosts; i++) {
+		int h = g->addNode(NETGRAPH_NODE_HOST);
+		addLink(g, h, center);
+		hostNodes << h;
+	}
+
+	QList<QPair<int, int> > pathEnds;
+	foreach (int a, hostNodes) {
+		foreach (int b, hostNodes) {
+			if (a != b) {
+				pathEnds << QPair<int, int>(a, b);
+			}
+		}
+	}
+	finishGraph(g, pathEnds);
+	return g;
+}
+
+NetGraph *makeMeshGraph(int routers, int linksPerRouter, int hosts, int pathCount)
+{
+	NetGraph *g = new NetGraph();
+	// every link end is listed once, so picking a random entry is proportional to the degree
+	QList<int> linkEnds;
+	for (int i = 0; i < routers; i++) {
+		int r = g->addNode(NETGRAPH_NODE_ROUTER);
+		QSet<int> targets;
+		int wanted = qMin(linksPerRouter, r);
+		while (targets.count() < wanted) {
+			targets.insert(linkEnds.isEmpty() ? rand() % r : linkEnds[rand() % linkEnds.count()]);
+		}
+		foreach (int t, targets) {
+			addLink(g, r, t);
+			linkEnds << r << t;
+		}
+	}
+
+	QList<int> hostNodes;
+	for (int i = 0; i < hosts; i++) {
+		int h = g->addNode(NETGRAPH_NODE_HOST);
+		addLink(g, h, rand() % routers);
+		hostNodes << h;
+	}
+
+	pathCount = qMin(pathCount, hosts * (hosts - 1));
+	QSet<QPair<int, int> > pathSet;
+	while (pathSet.count() < pathCount) {
+		int a = hostNodes[rand() % hosts];
+		int b = hostNodes[rand() % hosts];
+		if (a != b) {
+			pathSet.insert(QPair<int, int>(a, b));
+		}
+	}
+	finishGraph(g, pathSet.toList());
+	return g;
+}
+
+/// stages
+
+// Fills in a packet for the given path
+static void initPacket(Packet *p, const NetGraphPath &path, quint64 ts)
+{
+	p->reset();
+	p->length = BENCH_FRAME_SIZE;
+	p->src_id = path.source;
+	p->dst_id = path.dest;
+	p->dst_index = netGraph->destIndexByNode.at(path.dest);
+	p->path_index = netGraph->pathIndex(path.source, p->dst_index);
+	p->ts_driver_rx = ts;
+	p->ts_userspace_rx = ts;
+	p->ts_start_proc = ts;
+}
+
+BenchResult benchEdgeEnqueue(NetGraph *graph, QString graphName, quint64 packetCount)
+{
+	netGraph = graph;
+	graph->prepareEmulation();
+
+	BenchResult result;
+	result.stage = "edge enqueue";
+	result.graph = graphName;
+	result.operations = packetCount;
+	result.events = packetCount;
+	result.skipped = 0;
+
+	Packet *p = new Packet();
+	p->length = BENCH_FRAME_SIZE;
+	int edgeCount = graph->edges.count();
+	// one frame per link transmission time on average, so that the queues neither fill up nor stay empty
+	quint64 interArrival = (BENCH_FRAME_SIZE * SEC_TO_NSEC) / (quint64)(1000.0 * BENCH_BANDWIDTH) / edgeCount;
+	quint64 ts = 0;
+	quint64 ts_exit;
+
+	StageMeter meter;
+	meter.start();
+	for (quint64 i = 0; i < packetCount; i++) {
+		p->theoretical_delay = 0;
+		graph->edges[i % edgeCount].enqueue(p, ts, ts_exit);
+		ts += interArrival;
+	}
+	meter.stop(result);
+
+	delete p;
+	return result;
+}
+
+// Node for the event queue stage
+struct BenchEvent {
+	BenchEvent *wheelNext;
+	quint64 wheelTime;
+};
+
+// Hold model: each extracted event is rescheduled after a random delay of up to 2 ms
+template<typename EventQueue>
+static void runHoldModel(EventQueue &queue, QVector<BenchEvent> &events, quint64 eventCount, BenchResult &result)
+{
+	for (int i = 0; i < events.count(); i++) {
+		queue.insert(&events[i], rand() % (2 * MSEC_TO_NSEC));
+	}
+	StageMeter meter;
+	meter.start();
+	for (quint64 i = 0; i < eventCount; i++) {
+		QPair<BenchEvent*, quint64> event = queue.findMin();
+		queue.deleteMin();
+		queue.insert(event.first, event.second + rand() % (2 * MSEC_TO_NSEC));
+	}
+	meter.stop(result);
+	while (!queue.isEmpty()) {
+		queue.deleteMin();
+	}
+}
+
+BenchResult benchEventQueue(int eventQueueType, quint64 eventsInFlight, quint64 eventCount)
+{
+	BenchResult result;
+	result.stage = eventQueueType == EVENT_QUEUE_HEAP ? "event queue (heap)" : "event queue (wheel)";
+	result.graph = QString("%1 in flight").arg(eventsInFlight);
+	result.operations = eventCount;
+	result.events = eventCount;
+	result.skipped = 0;
+
+	QVector<BenchEvent> events(eventsInFlight);
+	srand(1);
+	if (eventQueueType == EVENT_QUEUE_HEAP) {
+		QPairingHeap<BenchEvent*> heap;
+		runHoldModel(heap, events, eventCount, result);
+	} else {
+		TimingWheel<BenchEvent> *wheel = new TimingWheel<BenchEvent>();
+		runHoldModel(*wheel, events, eventCount, result);
+		delete wheel;
+	}
+	return result;
+}
+
+#define BENCH_PACKETS_IN_FLIGHT 16384
+
+// Discrete event simulation of the scheduler in virtual time: new packets arrive every interArrival ns,
+// round robin over the paths, and are routed hop by hop until they are forwarded or dropped.
+template<typename EventQueue>
+static void runRouting(EventQueue &eventQueue, quint64 packetCount, quint64 interArrival, BenchResult &result)
+{
+	SchedulerShard shard;
+	memset(&shard, 0, sizeof(shard));
+	shard.paths = &netGraph->paths;
+
+	QVector<Packet*> freePackets;
+	Packet *packets = new Packet[BENCH_PACKETS_IN_FLIGHT];
+	for (int i = 0; i < BENCH_PACKETS_IN_FLIGHT; i++) {
+		freePackets << &packets[i];
+	}
+
+	// arrivals counts the generated packets; injected only those that were routed
+	quint64 arrivals = 0;
+	quint64 injected = 0;
+	quint64 events = 0;
+	quint64 ts_arrival = 0;
+	int pathCount = netGraph->paths.count();
+
+	StageMeter meter;
+	meter.start();
+	while (arrivals < packetCount || !eventQueue.isEmpty()) {
+		quint64 ts;
+		Packet *p;
+		if (arrivals < packetCount && (eventQueue.isEmpty() || ts_arrival <= eventQueue.findMin().second)) {
+			ts = ts_arrival;
+			ts_arrival += interArrival;
+			arrivals++;
+			if (freePackets.isEmpty())
+				continue;
+			injected++;
+			p = freePackets.last();
+			freePackets.pop_back();
+			initPacket(p, netGraph->paths[arrivals % pathCount], ts);
+		} else {
+			QPair<Packet*, quint64> event = eventQueue.findMin();
+			eventQueue.deleteMin();
+			ts = event.second;
+			p = event.first;
+		}
+		events++;
+
+		quint64 ts_next = ts;
+		int state = routePacket(shard, p, ts, ts_next);
+		if (state == PKT_QUEUED) {
+			eventQueue.insert(p, ts_next);
+		} else if (state == PKT_DROPPED) {
+			freePackets << p;
+		} else {
+			Packet *sent;
+			while ((sent = packetsOut[0].dequeue()) != NULL) {
+				freePackets << sent;
+			}
+		}
+	}
+	meter.stop(result);
+
+	result.operations = injected;
+	result.events = events;
+	result.skipped = arrivals - injected;
+	delete [] packets;
+}
+
+BenchResult benchRouting(NetGraph *graph, QString graphName, int eventQueueType, quint64 packetCount, quint64 interArrival)
+{
+	netGraph = graph;
+	graph->prepareEmulation();
+
+	BenchResult result;
+	result.stage = eventQueueType == EVENT_QUEUE_HEAP ? "route + heap" : "route + wheel";
+	result.graph = graphName;
+
+	if (eventQueueType == EVENT_QUEUE_HEAP) {
+		QPairingHeap<Packet*> heap;
+		runRouting(heap, packetCount, interArrival, result);
+	} else {
+		TimingWheel<Packet> *wheel = new TimingWheel<Packet>();
+		runRouting(*wheel, packetCount, interArrival, result);
+		delete wheel;
+	}
+	return result;
+}
+
+/// output
+
+void printBenchHeader()
+{
+	printf("%-20s %-22s %12s %12s %12s %12s %12s\n", "stage", "graph", "ns/op", "Mevents/s", "allocs/op", "misses/op", "skipped");
+}
+
+void printBenchResult(const BenchResult &result)
+{
+	double ops = qMax(result.operations, (quint64)1);
+	QString misses = result.cacheMisses < 0 ? QString("n/a") : QString::number(result.cacheMisses / ops, 'f', 2);
+	printf("%-20s %-22s %12.1f %12.2f %12.2f %12s %12llu\n",
+		   result.stage.toLatin1().constData(),
+		   result.graph.toLatin1().constData(),
+		   result.elapsed / ops,
+		   result.events * 1.0e3 / qMax(result.elapsed, (quint64)1),
+		   result.allocations / ops,
+		   misses.toLatin1().constData(),
+		   result.skipped);
+	fflush(stdout);
+}
@@ -0,0 +1,55 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QtCore>
+
+class NetGraph;
+
+// Synthetic topologies. All links are 1 Gbps, 1 ms, lossless.
+// A chain of routers with one host at each end
+NetGraph *makeChainGraph(int routers);
+// A router with hosts attached, with paths between every pair of hosts
+NetGraph *makeStarGraph(int hosts);
+// A preferential attachment router mesh (like BRITE's Barabasi-Albert model) with hosts
+// attached to random routers, and paths between random pairs of hosts
+NetGraph *makeMeshGraph(int routers, int linksPerRouter, int hosts, int pathCount);
+
+// Result of one benchmark stage
+struct BenchResult {
+	QString stage;
+	QString graph;
+	quint64 operations;   // packets, or events for the event queue
+	quint64 events;       // events processed by the scheduler
+	quint64 elapsed;       // ns
+	quint64 allocations;   // malloc/realloc calls
+	qint64 cacheMisses;    // -1 if the hardware counters are not available
+	quint64 skipped;       // arrivals dropped before routing because every packet was in flight
+};
+
+// Stages; each one runs the given number of operations on the graph, which becomes the current netGraph
+BenchResult benchEdgeEnqueue(NetGraph *graph, QString graphName, quint64 packetCount);
+BenchResult benchEventQueue(int eventQueueType, quint64 eventsInFlight, quint64 eventCount);
+BenchResult benchRouting(NetGraph *graph, QString graphName, int eventQueueType, quint64 packetCount, quint64 interArrival);
+
+void printBenchHeader();
+void printBenchResult(const BenchResult &result);
+
+#endif // BENCHMARK_H
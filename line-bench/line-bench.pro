@@ -0,0 +1,102 @@
+#-------------------------------------------------
+#
+# Microbenchmarks for the emulator hot path
+#
+#-------------------------------------------------
+
+QT       += core xml
+
+QT       -= gui
+
+TARGET   = line-bench
+CONFIG   += console release
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+DEFINES += LINE_EMULATOR
+
+INCLUDEPATH += ../line-router/
+INCLUDEPATH += ../util/
+#INCLUDEPATH += ../PF_RING-4.6.5/userland/c++ ../PF_RING-4.6.5/kernel ../PF_RING-4.6.5/kernel/plugins ../PF_RING-4.6.5/userland/libpcap-1.1.1-ring ../PF_RING-4.6.5/userland/lib
+#QMAKE_LIBS += ../PF_RING-4.6.5/userland/c++/libpfring_cpp.a ../PF_RING-4.6.5/userland/lib/libpfring.a ../PF_RING-4.6.5/userland/libpcap-1.1.1-ring/libpcap.a
+QMAKE_LIBS += /usr/local/lib/libpfring.a /usr/local/lib/libpcap.a -lunwind -lpcap -lrt
+
+
+  QMAKE_CFLAGS += -std=gnu99 -fno-strict-overflow -fno-strict-aliasing -Wno-unused-local-typedefs -gdwarf-2
+  QMAKE_CXXFLAGS += -std=c++11 -fno-strict-overflow -fno-strict-aliasing -Wno-unused-local-typedefs -gdwarf-2
+  QMAKE_LFLAGS += -flto -fno-strict-overflow -fno-strict-aliasing
+
+  QMAKE_CFLAGS += -fstack-protector-all --param ssp-buffer-size=4
+  QMAKE_CXXFLAGS += -fstack-protector-all --param ssp-buffer-size=4
+  QMAKE_LFLAGS += -fstack-protector-all --param ssp-buffer-size=4
+
+  QMAKE_CFLAGS += -fPIE -pie -rdynamic
+  QMAKE_CXXFLAGS += -fPIE -pie -rdynamic
+  QMAKE_LFLAGS += -fPIE -pie -rdynamic
+
+  QMAKE_CFLAGS += -Wl,-z,relro,-z,now
+  QMAKE_CXXFLAGS += -Wl,-z,relro,-z,now
+  QMAKE_LFLAGS += -Wl,-z,relro,-z,now
+
+  QMAKE_CFLAGS_DEBUG += -g -fno-omit-frame-pointer -rdynamic
+  QMAKE_CXXFLAGS_DEBUG += -g -fno-omit-frame-pointer -rdynamic
+  QMAKE_LFLAGS_DEBUG += -g -fno-omit-frame-pointer -rdynamic
+
+  QMAKE_CFLAGS_DEBUG += -fsanitize=address -fno-omit-frame-pointer
+  QMAKE_CXXFLAGS_DEBUG += -fsanitize=address -fno-omit-frame-pointer
+  QMAKE_LFLAGS_DEBUG += -fsanitize=address -fno-omit-frame-pointer -fuse-ld=gold
+
+SOURCES += main.cpp \
+    benchmark.cpp \
+    ../line-router/pfcount.cpp \
+    ../line-router/qpairingheap.cpp \
+    ../line-router/timingwheel.cpp \
+    ../line-router/pconsumer.cpp \
+    ../line-router/pscheduler.cpp \
+    ../line-router/psender.cpp \
+    ../util/bitarray.cpp \
+    ../line-router/packetpool.cpp \
+    ../line-router/pcapbackend.cpp \
+    ../line-router/timelinewriter.cpp \
+    ../line-router/latencyhistogram.cpp \
+    ../line-router/idlestrategy.cpp \
+    ../line-gui/netgraphpath.cpp \
+    ../line-gui/netgraphnode.cpp \
+    ../line-gui/netgraphedge.cpp \
+    ../line-gui/netgraphconnection.cpp \
+    ../line-gui/netgraphas.cpp \
+    ../line-gui/netgraph.cpp \
+    ../util/util.cpp \
+    ../util/resultsfile.cpp \
+    ../util/livestats.cpp \
+    ../line-gui/route.cpp \
+    ../tomo/tomodata.cpp
+
+HEADERS += benchmark.h \
+    ../line-router/qpairingheap.h \
+    ../line-router/timingwheel.h \
+    ../line-router/pscheduler.h \
+    ../line-router/pconsumer.h \
+    ../line-router/spscring.h \
+    ../line-router/packetpool.h \
+    ../line-router/pcapbackend.h \
+    ../line-router/timelinewriter.h \
+    ../line-router/latencyhistogram.h \
+    ../line-router/idlestrategy.h \
+    ../line-router/prng.h \
+    ../line-router/psender.h \
+    ../util/bitarray.h \
+    ../line-gui/netgraphpath.h \
+    ../line-gui/netgraphnode.h \
+    ../line-gui/netgraphedge.h \
+    ../line-gui/netgraphconnection.h \
+    ../line-gui/netgraphas.h \
+    ../line-gui/netgraph.h \
+    ../util/util.h \
+    ../util/resultsfile.h \
+    ../util/livestats.h \
+    ../util/eventlog.h \
+    ../util/debug.h \
+    ../line-gui/route.h \
+    ../tomo/tomodata.h
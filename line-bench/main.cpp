@@ -0,0 +1,69 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtCore>
+
+#include "benchmark.h"
+#include "pscheduler.h"
+#include "timingwheel.h"
+#include "bitarray.h"
+#include "../line-gui/netgraph.h"
+
+int main(int argc, char *argv[])
+{
+	quint64 packetCount = 1000 * 1000;
+	if (argc > 1 && QString(argv[1]) == "--self-test") {
+		srand(1);
+		qDebug() << "Timing wheel self-test";
+		TimingWheel_test();
+		qDebug() << "Bit array self-test";
+		BitArray::test();
+		return 0;
+	}
+	if (argc > 1) {
+		packetCount = QString(argv[1]).toULongLong();
+	}
+	if (packetCount == 0) {
+		fprintf(stderr, "Usage: %s [number of packets per stage | --self-test]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	QList<QPair<QString, NetGraph*> > graphs;
+	graphs << QPair<QString, NetGraph*>("chain 16", makeChainGraph(16));
+	graphs << QPair<QString, NetGraph*>("star 32", makeStarGraph(32));
+	graphs << QPair<QString, NetGraph*>("mesh 1000/200/2000", makeMeshGraph(1000, 2, 200, 2000));
+
+	printBenchHeader();
+	for (int i = 0; i < graphs.count(); i++) {
+		QString name = graphs[i].first;
+		NetGraph *graph = graphs[i].second;
+		printBenchResult(benchEdgeEnqueue(graph, name, packetCount));
+		// 1 Gbps of 1000 byte frames in total
+		printBenchResult(benchRouting(graph, name, EVENT_QUEUE_HEAP, packetCount, 8000));
+		printBenchResult(benchRouting(graph, name, EVENT_QUEUE_WHEEL, packetCount, 8000));
+	}
+
+	QList<quint64> eventsInFlight = QList<quint64>() << 1000 << 100000;
+	foreach (quint64 n, eventsInFlight) {
+		printBenchResult(benchEventQueue(EVENT_QUEUE_HEAP, n, packetCount));
+		printBenchResult(benchEventQueue(EVENT_QUEUE_WHEEL, n, packetCount));
+	}
+
+	return 0;
+}
@@ -18,15 +18,23 @@
 
 #include "bgp.h"
 
+#include <QtCore>
+
 #define DEBUG_IGP 0
 #define DEBUG_BGP 0
 
+// Distance of the nodes that cannot be reached
+#define IGP_UNREACHABLE 1.0e100
+
 class IGPRoute {
 public:
 	IGPRoute(int destination, int nextHop, double distance) :
 		destination(destination), nextHop(nextHop), distance(distance)
 	{}
-	IGPRoute() {}
+	// an unreachable destination
+	IGPRoute() :
+		destination(-1), nextHop(-1), distance(IGP_UNREACHABLE)
+	{}
 	// node ID
 	int destination;
 	// nextHop = ID of next node on the path to that destination
@@ -56,10 +64,89 @@ public:
 
 typedef QPair<int, int> QIntPair;
 
+// IGP distance from source to dest, IGP_UNREACHABLE if there is no route
+static double igpDistance(const QHash<int, IgpRoutingTable> &IGPRoutes, int source, int dest)
+{
+	if (source == dest)
+		return 0;
+	return IGPRoutes.value(source).routes.value(dest).distance;
+}
+
+// Origin of a BGP route
+enum BGPOrigin {
+	BGP_ORIGIN_IGP,
+	BGP_ORIGIN_EBGP,
+	BGP_ORIGIN_IBGP
+};
+
+inline QString bgpOriginName(int origin)
+{
+	return origin == BGP_ORIGIN_IGP ? "IGP" : origin == BGP_ORIGIN_EBGP ? "eBGP" : "iBGP";
+}
+
+// Interned AS paths: each distinct path is stored once, as its first AS and the ID of the rest
+// of the path, so routes carry an ID instead of a list and prepending an AS is a lookup.
+class ASPathTable {
+public:
+	ASPathTable() {
+		firstAS << -1;
+		rest << -1;
+		lengths << 0;
+	}
+
+	// ID of the empty path
+	static const int empty = 0;
+
+	int prepend(int ASNumber, int path) {
+		QIntPair key(ASNumber, path);
+		int id = index.value(key, -1);
+		if (id < 0) {
+			id = firstAS.count();
+			firstAS << ASNumber;
+			rest << path;
+			lengths << lengths[path] + 1;
+			index.insert(key, id);
+		}
+		return id;
+	}
+
+	bool contains(int path, int ASNumber) const {
+		for (; path != empty; path = rest[path]) {
+			if (firstAS[path] == ASNumber)
+				return true;
+		}
+		return false;
+	}
+
+	int length(int path) const {
+		return lengths[path];
+	}
+
+	// number of paths, including the empty one
+	int count() const {
+		return firstAS.count();
+	}
+
+	QList<int> toList(int path) const {
+		QList<int> result;
+		for (; path != empty; path = rest[path]) {
+			result << firstAS[path];
+		}
+		return result;
+	}
+
+private:
+	QVector<int> firstAS;
+	QVector<int> rest;
+	QVector<int> lengths;
+	// (first AS, rest) -> ID
+	QHash<QIntPair, int> index;
+};
+
 class BGPRoute {
 public:
-	BGPRoute(int destination, int nextHop, QString origin, QList<int> ASPath, double distToNextHop) :
-		destination(destination), nextHop(nextHop), origin(origin), ASPath(ASPath), distToNextHop(distToNextHop)
+	BGPRoute(int destination, int nextHop, int origin, int ASPath, int ASPathLength, double distToNextHop) :
+		destination(destination), nextHop(nextHop), origin(origin), ASPath(ASPath), ASPathLength(ASPathLength), distToNextHop(distToNextHop)
 	{}
 	BGPRoute()
 	{}
@@ -67,18 +154,19 @@ public:
 	int destination;
 	// node ID, only set if the next hop is a border router
 	int nextHop;
-	// IGP, eBGP, iBGP
-	QString origin;
-	// in normal order, does not include the current AS;
+	// BGP_ORIGIN_xxx
+	int origin;
+	// ID in the ASPathTable; in normal order, does not include the current AS;
 	// the current AS is prepended only in eBGP updates
-	QList<int> ASPath;
+	int ASPath;
+	int ASPathLength;
 	// only set if nextHop is a border router in the current AS (iBGP updates)
 	double distToNextHop;
 
 	// this is better: return -1
 	// other is better: return +1
 	// returns 0 at tie
-	int compareTo(BGPRoute other) {
+	int compareTo(const BGPRoute &other) const {
 		const int thisIsBetter = -1;
 		const int otherIsBetter = +1;
 		const int theSame = 0;
@@ -86,8 +174,8 @@ public:
 			qDebug() << __FILE__ << __LINE__ << "illegal operation";
 			exit(1);
 		}
-		if (this->origin == "IGP") {
-			if (other.origin != "IGP")
+		if (this->origin == BGP_ORIGIN_IGP) {
+			if (other.origin != BGP_ORIGIN_IGP)
 				return thisIsBetter;
 			// IGP vs IGP
 			if (this->distToNextHop < other.distToNextHop)
@@ -98,20 +186,20 @@ public:
 				return otherIsBetter;
 			return theSame;
 		}
-		if (other.origin == "IGP") {
+		if (other.origin == BGP_ORIGIN_IGP) {
 			return otherIsBetter;
 		}
 
 		// we are comparing routes coming from eBGP or iBGP
-		if (this->ASPath.length() < other.ASPath.length())
+		if (this->ASPathLength < other.ASPathLength)
 			return thisIsBetter;
-		if (this->ASPath.length() > other.ASPath.length())
+		if (this->ASPathLength > other.ASPathLength)
 			return otherIsBetter;
 		// ASPath tie
 
-		if (this->origin == "eBGP" && other.origin == "iBGP")
+		if (this->origin == BGP_ORIGIN_EBGP && other.origin == BGP_ORIGIN_IBGP)
 			return thisIsBetter;
-		if (this->origin == "iBGP" && other.origin == "eBGP")
+		if (this->origin == BGP_ORIGIN_IBGP && other.origin == BGP_ORIGIN_EBGP)
 			return otherIsBetter;
 
 		// origin tie
@@ -129,14 +217,14 @@ public:
 		return theSame;
 	}
 
-	QString toString() {
+	QString toString(const ASPathTable &paths) const {
 		QString ASPathStr = "(";
-		foreach (int ASN, ASPath) {
+		foreach (int ASN, paths.toList(ASPath)) {
 			ASPathStr += QString("%1AS%2").arg(ASPathStr.endsWith("(") ? "" : " -> ").arg(ASN);
 		}
 		ASPathStr += ")";
 
-		return QString("dest = %1, nextHop = %2, distance = %3, origin = %4, ASPath = %5").arg(destination).arg(nextHop).arg(distToNextHop).arg(origin).arg(ASPathStr);
+		return QString("dest = %1, nextHop = %2, distance = %3, origin = %4, ASPath = %5").arg(destination).arg(nextHop).arg(distToNextHop).arg(bgpOriginName(origin)).arg(ASPathStr);
 	}
 };
 
@@ -146,57 +234,108 @@ public:
 	QHash<int, BGPRoute > bestRoutes;
 	// Maps a destionation (node id) to a route
 	// QHash<int, BGPRoute > localRoutes;
+	// The destinations whose best route changed, in order (with repetitions);
+	// each peer reads the log from where it left off, and only re-examines those routes
+	QList<int> changes;
 };
 
-class PrioQueue {
+// A BGP session of a border router
+class BGPPeering {
 public:
-	// does not check for duplicates
-	void insert(int key, double prio) {
-		queue.append(QPair<int, double>(key, prio));
+	BGPPeering(int peer, double distance) :
+		peer(peer), distance(distance), seen(0)
+	{}
+	int peer;
+	// path or link metric to the peer
+	double distance;
+	// number of entries of the peer's change log already received
+	int seen;
+};
+
+// Adds a route to the table if it is better than the current one; returns true if the table changed
+static inline bool offerRoute(BGPRoutingTable &table, const BGPRoute &route)
+{
+	QHash<int, BGPRoute>::iterator current = table.bestRoutes.find(route.destination);
+	if (current == table.bestRoutes.end()) {
+		// anything is better than nothing
+		table.bestRoutes.insert(route.destination, route);
+	} else if (current.value().compareTo(route) > 0) {
+		// his is better
+		current.value() = route;
+	} else {
+		return false;
 	}
+	table.changes << route.destination;
+	return true;
+}
 
-	void update(int key, double prio) {
-		for (int i = 0; i < queue.size(); i++) {
-			if (queue[i].first == key) {
-				queue[i].second = prio;
-				return;
-			}
+// Binary min-heap of the integers 0..size-1 by priority, with decrease-key
+class IndexedHeap {
+public:
+	IndexedHeap(int size) : position(size, -1)
+	{}
+
+	// inserts key, or lowers its priority if it is already in the heap
+	void insertOrDecrease(int key, double prio) {
+		int i = position[key];
+		if (i < 0) {
+			i = heap.count();
+			heap.append(QPair<int, double>(key, prio));
 		}
+		place(i, QPair<int, double>(key, prio));
+		siftUp(i);
 	}
 
 	// does not check for empty
 	QPair<int, double> takeSmallest() {
-		int imin = 0;
-		double min = queue.at(imin).second;
-
-		for (int i = 0; i < queue.count(); i++) {
-			if (queue[i].second < min) {
-				min = queue[i].second;
-				imin = i;
-			}
+		QPair<int, double> smallest = heap.first();
+		QPair<int, double> last = heap.last();
+		heap.removeLast();
+		position[smallest.first] = -1;
+		if (!heap.isEmpty()) {
+			place(0, last);
+			siftDown(0);
 		}
+		return smallest;
+	}
 
-		// qDebug() << "take smallest" << queue << "result:" << queue.at(imin);
+	bool isEmpty() const {
+		return heap.isEmpty();
+	}
 
-		return queue.takeAt(imin);
+private:
+	void place(int i, QPair<int, double> item) {
+		heap[i] = item;
+		position[item.first] = i;
 	}
 
-	double peek(int key) {
-		for (int i = 0; i < queue.size(); i++) {
-			if (queue[i].first == key) {
-				return queue[i].second;
-			}
+	void siftUp(int i) {
+		QPair<int, double> item = heap[i];
+		while (i > 0 && item.second < heap[(i - 1) / 2].second) {
+			place(i, heap[(i - 1) / 2]);
+			i = (i - 1) / 2;
 		}
-		// you are in trouble
-		return 1;
+		place(i, item);
 	}
 
-	bool isEmpty() {
-		return queue.isEmpty();
+	void siftDown(int i) {
+		QPair<int, double> item = heap[i];
+		while (2 * i + 1 < heap.count()) {
+			int child = 2 * i + 1;
+			if (child + 1 < heap.count() && heap[child + 1].second < heap[child].second)
+				child++;
+			if (!(heap[child].second < item.second))
+				break;
+			place(i, heap[child]);
+			i = child;
+		}
+		place(i, item);
 	}
 
-private:
-	QList< QPair<int, double> > queue;
+	// (key, priority)
+	QVector<QPair<int, double> > heap;
+	// key -> index in heap, -1 if not in the heap
+	QVector<int> position;
 };
 
 bool almostEqual(qreal a, qreal b)
@@ -207,68 +346,147 @@ bool almostEqual(qreal a, qreal b)
 	return (((b - e) < a) && (a < (b + e)));
 }
 
-// nodes = the IDs of the nodes in the graph
-// root = the ID of the root node
-// neighbours = adjacencies
-// metrics = (node ID, node ID) -> edge length
-// destinations = subset of 'nodes'; only compute routes to these node IDs
-void dijkstra(QSet<int> nodes, int root, QHash<int, QList<int> > neighbours, QHash<QIntPair, double> metrics, QSet<int> destinations,
-			  QHash<int, IgpRoutingTable> &IGPRoutes)
+// The links inside one AS, in compressed sparse row form: the neighbours of node i are
+// targets[offsets[i]] ... targets[offsets[i + 1] - 1], with the link metrics in metrics[].
+// Nodes are numbered from 0 inside the AS.
+class IgpGraph {
+public:
+	// local index -> node ID
+	QVector<int> nodes;
+	QVector<int> offsets;
+	QVector<int> targets;
+	QVector<double> metrics;
+};
+
+// Builds the IGP graph of every AS with a single pass over the edges.
+// localIndex: node ID -> index of the node in the graph of its AS
+void buildIgpGraphs(NetGraph &g, QHash<int, IgpGraph> &graphs, QVector<int> &localIndex)
 {
-	// set of (node, distance), for each node that has not been visited yet
-	PrioQueue queue;
-	// node -> predecessor
-	QMultiHash<int, int> parent;
-	// visited nodes
-	QSet<int> visited;
-	// best distances
-	QHash<int, double> distances;
+	localIndex.fill(-1, g.nodes.count());
+	foreach (NetGraphNode n, g.nodes) {
+		IgpGraph &graph = graphs[n.ASNumber];
+		localIndex[n.index] = graph.nodes.count();
+		graph.nodes.append(n.index);
+	}
+	foreach (int ASNumber, graphs.keys()) {
+		graphs[ASNumber].offsets.fill(0, graphs[ASNumber].nodes.count() + 1);
+	}
 
-	foreach (int n, nodes) {
-		queue.insert(n, 1.0e100);
+	// count the links of each node, then place them
+	foreach (NetGraphEdge e, g.edges) {
+		if (g.nodes[e.source].ASNumber == g.nodes[e.dest].ASNumber) {
+			graphs[g.nodes[e.source].ASNumber].offsets[localIndex[e.source] + 1]++;
+		}
 	}
-	queue.update(root, 0);
+	QHash<int, QVector<int> > next;
+	foreach (int ASNumber, graphs.keys()) {
+		IgpGraph &graph = graphs[ASNumber];
+		for (int i = 0; i < graph.nodes.count(); i++) {
+			graph.offsets[i + 1] += graph.offsets[i];
+		}
+		graph.targets.resize(graph.offsets.last());
+		graph.metrics.resize(graph.offsets.last());
+		next[ASNumber] = graph.offsets;
+	}
+	foreach (NetGraphEdge e, g.edges) {
+		int ASNumber = g.nodes[e.source].ASNumber;
+		if (ASNumber == g.nodes[e.dest].ASNumber) {
+			IgpGraph &graph = graphs[ASNumber];
+			int k = next[ASNumber][localIndex[e.source]]++;
+			graph.targets[k] = localIndex[e.dest];
+			graph.metrics[k] = e.metric();
+		}
+	}
+	if (DEBUG_IGP) {
+		foreach (int ASNumber, graphs.keys()) {
+			qDebug() << "AS" << ASNumber << "nodes" << graphs[ASNumber].nodes << "offsets" << graphs[ASNumber].offsets
+					 << "targets" << graphs[ASNumber].targets << "metrics" << graphs[ASNumber].metrics;
+		}
+	}
+}
+
+// The IGP routes computed from one root. The roots are processed in parallel; each one only
+// writes to its own job, and the routes are merged into the routing tables afterwards.
+class IgpJob {
+public:
+	const IgpGraph *graph;
+	const QVector<int> *localIndex;
+	// node ID
+	int root;
+	// only compute routes to these node IDs
+	QList<int> destinations;
+	// result: (node ID, route of that node)
+	QList<QPair<int, IGPRoute> > routes;
+	// result: distances from the root, by local index
+	QVector<double> distances;
+};
 
+void dijkstra(IgpJob &job)
+{
+	const IgpGraph &graph = *job.graph;
+	const QVector<int> &localIndex = *job.localIndex;
+	const int count = graph.nodes.count();
+	const int root = localIndex[job.root];
+
+	// best distances
+	QVector<double> &distances = job.distances;
+	distances.fill(IGP_UNREACHABLE, count);
+	// visited nodes
+	QVector<bool> visited(count, false);
+	// node -> predecessors on the shortest paths (several for equal-cost paths), as linked lists:
+	// predecessors of n: parentNode[k] for k = parentHead[n], parentNext[k]... until -1
+	QVector<int> parentHead(count, -1);
+	QVector<int> parentNode;
+	QVector<int> parentNext;
+	// nodes that have not been visited yet, by distance
+	IndexedHeap queue(count);
+
+	distances[root] = 0;
+	queue.insertOrDecrease(root, 0);
 	while (!queue.isEmpty()) {
 		QPair<int, double> best = queue.takeSmallest();
 		int n = best.first;
 		double dist = best.second;
-		visited.insert(n);
-		distances[n] = dist;
-		//qDebug() << QString("visited: %1, dist = %2").arg(n).arg(dist);
-
-		foreach (int n2, neighbours[n]) {
-			if (!visited.contains(n2)) {
-				double metric = metrics.value(QPair<int, int>(n, n2));
-				double d2 = queue.peek(n2);
-				if (almostEqual(dist + metric, d2)) {
-					parent.insert(n2, n);
-				} else if (dist + metric < d2) {
-					queue.update(n2, dist + metric);
-					parent.remove(n2);
-					parent.insert(n2, n);
-					//qDebug() << QString("new parent: %1 -> %2").arg(n).arg(n2);
-				}
+		visited[n] = true;
+
+		for (int k = graph.offsets[n]; k < graph.offsets[n + 1]; k++) {
+			int n2 = graph.targets[k];
+			if (visited[n2])
+				continue;
+			double d2 = dist + graph.metrics[k];
+			if (almostEqual(d2, distances[n2])) {
+				parentNode.append(n);
+				parentNext.append(parentHead[n2]);
+				parentHead[n2] = parentNode.count() - 1;
+			} else if (d2 < distances[n2]) {
+				distances[n2] = d2;
+				queue.insertOrDecrease(n2, d2);
+				parentNode.append(n);
+				parentNext.append(-1);
+				parentHead[n2] = parentNode.count() - 1;
 			}
 		}
 	}
 
-	if (DEBUG_IGP) qDebug() << "dijkstra root =" << root << ":";
-	foreach (int d, destinations) {
-		if (DEBUG_IGP) qDebug() << "dijkstra dest =" << d << ":";
+	if (DEBUG_IGP) qDebug() << "dijkstra root =" << job.root << ":";
+	// destination whose routes have been set through each node
+	QVector<int> expanded(count, -1);
+	foreach (int destination, job.destinations) {
+		int d = localIndex[destination];
+		if (DEBUG_IGP) qDebug() << "dijkstra dest =" << destination << ":";
 		QList<int> leaves;
 		leaves << d;
+		expanded[d] = d;
 		while (!leaves.isEmpty()) {
 			int n = leaves.takeLast();
-			if (DEBUG_IGP) qDebug() << "parents of node" << n << ":" << parent.values(n);
-			foreach (int p, parent.values(n)) {
+			for (int k = parentHead[n]; k >= 0; k = parentNext[k]) {
+				int p = parentNode[k];
 				// a route from p to d, via n
-				IGPRoute route (d, n, distances[d] - distances[p]);
-				if (DEBUG_IGP) qDebug() << "setting route of node" << p << route;
-				if (!IGPRoutes[p].routes.contains(d, route)) {
-					IGPRoutes[p].routes.insert(d, route);
-				}
-				if (p != root) {
+				IGPRoute route(destination, graph.nodes[n], distances[d] - distances[p]);
+				if (DEBUG_IGP) qDebug() << "setting route of node" << graph.nodes[p] << route;
+				job.routes.append(QPair<int, IGPRoute>(graph.nodes[p], route));
+				if (p != root && expanded[p] != d) {
+					expanded[p] = d;
 					leaves << p;
 				}
 			}
@@ -276,53 +494,71 @@ void dijkstra(QSet<int> nodes, int root, QHash<int, QList<int> > neighbours, QHa
 	}
 }
 
-// asNodes: Maps an ASN to the set of nodes (all routers and hosts) in that AS
-void computeIGPRoutingTable(NetGraph &g, int root, QSet<int> destinations, QHash<int, QSet<int> > asNodes, QHash<int, IgpRoutingTable> &IGPRoutes)
+// Checks whether the link (source, dest) with the given metric is, or would be, on a shortest path
+// of the tree computed by job. If this is false for both the old and the new metric of every link that
+// changed, the distances and the equal-cost predecessors stay the same, so the tree can be reused.
+bool linkAffectsTree(const IgpJob &job, const QVector<int> &localIndex, int source, int dest, double metric)
 {
-	int asNumber = g.nodes[root].ASNumber;
-	QSet<int> nodeSet = asNodes.value(asNumber);
-
-	// For each node, we keep an adjacency list
-	QHash<int, QList<int> > neighbours;
-	// For each adjacency, we store the metric
-	QHash<QIntPair, double> metrics;
-
-	// build the adjacency lists
-	foreach (int n, nodeSet) {
-		foreach (NetGraphEdge e, g.edges) {
-			if (e.source == n && nodeSet.contains(e.dest)) {
-				neighbours[n] << e.dest;
-				QPair<int, int> link = QPair<int, int>(e.source, e.dest);
-				metrics[link] = e.metric();
-			}
-		}
-	}
-	if (DEBUG_IGP) qDebug() << "Adjacencies" << neighbours;
-	if (DEBUG_IGP) qDebug() << "Metrics" << metrics;
-
-	dijkstra(nodeSet, root, neighbours, metrics, destinations, IGPRoutes);
+	double d1 = job.distances[localIndex[source]];
+	double d2 = job.distances[localIndex[dest]];
+	if (d1 >= IGP_UNREACHABLE)
+		return false;
+	return d1 + metric < d2 || almostEqual(d1 + metric, d2);
 }
 
 // IGPRoutes: Maps a node (node id) to its IGP routing table
-QHash<int, BGPRoutingTable> computeBGPRoutingTables(QHash<int, QSet<int> > asBorders, QHash<int, QSet<int> > asDestinations, QHash<int, IgpRoutingTable> IGPRoutes,
-					    QHash<QPair<int, int>, double> eBGPPeers, QHash<QPair<int, int>, double> iBGPPeers,
-					    QHash<int, int> borderToASNumber)
+// The routes are propagated in rounds, like before, but a border router only re-examines the routes
+// of a peer that changed since the last round. Routes only ever get better, so a route that was
+// offered once cannot win later; the result is the same as re-offering every route in every round.
+// Only the routes to the destinations in prefixes are (re)computed; the routes to the other destinations
+// are kept. The routes to different destinations never interact, so the tables are the same as if they
+// were computed from scratch.
+void computeBGPRoutingTables(QHash<int, BGPRoutingTable> &BGPRoutingTables, const QSet<int> &prefixes,
+					 const QHash<int, QSet<int> > &asBorders, const QHash<int, QSet<int> > &asDestinations,
+					 const QHash<int, IgpRoutingTable> &IGPRoutes,
+					 const QHash<QPair<int, int>, double> &eBGPPeers, const QHash<QPair<int, int>, double> &iBGPPeers,
+					 const QHash<int, int> &borderToASNumber, ASPathTable &asPaths)
 {
-	// For each border router, keep the BGP routing table
-	QHash<int, BGPRoutingTable> BGPRoutingTables;
+	// withdraw the routes to the prefixes
+	foreach (int border, BGPRoutingTables.keys()) {
+		BGPRoutingTable &table = BGPRoutingTables[border];
+		table.changes.clear();
+		foreach (int dest, prefixes) {
+			table.bestRoutes.remove(dest);
+		}
+	}
 
 	// initialize local routes
 	if (DEBUG_BGP) qDebug() << "Advertising local networks:";
 	foreach (int ASNumber, asBorders.keys()) {
 		foreach (int border, asBorders[ASNumber]) {
-			foreach (int dest, asDestinations[ASNumber]) {
-				double dist = IGPRoutes[border].routes.value(dest).distance;
-				BGPRoutingTables[border].bestRoutes.insert(dest, BGPRoute(dest, -1, "IGP", QList<int>(), dist));
+			// every table exists before the rounds, so that references to them stay valid
+			BGPRoutingTable &table = BGPRoutingTables[border];
+			foreach (int dest, asDestinations.value(ASNumber)) {
+				if (!prefixes.contains(dest))
+					continue;
+				double dist = igpDistance(IGPRoutes, border, dest);
+				if (dist >= IGP_UNREACHABLE)
+					continue;
+				table.bestRoutes.insert(dest, BGPRoute(dest, -1, BGP_ORIGIN_IGP, ASPathTable::empty, 0, dist));
+				table.changes << dest;
 				if (DEBUG_BGP) qDebug() << QString("AS %1, border %2: IGP route to %3, dist = %4, next hop:").arg(ASNumber).arg(border).arg(dest).arg(dist) << IGPRoutes[border].routes.value(dest).nextHop;
 			}
 		}
 	}
 
+	// the peers of each border router, in the order of the peering tables
+	QHash<int, QList<BGPPeering> > eBGPSessions;
+	foreach (QIntPair peering, eBGPPeers.keys()) {
+		eBGPSessions[peering.first] << BGPPeering(peering.second, eBGPPeers[peering]);
+		BGPRoutingTables[peering.second];
+	}
+	QHash<int, QList<BGPPeering> > iBGPSessions;
+	foreach (QIntPair peering, iBGPPeers.keys()) {
+		iBGPSessions[peering.first] << BGPPeering(peering.second, iBGPPeers[peering]);
+		BGPRoutingTables[peering.second];
+	}
+
 	// BGP rounds
 	for (int roundIndex = 1; ; roundIndex++) {
 		if (DEBUG_BGP) qDebug() << QString("BGP round %1").arg(roundIndex);
@@ -333,77 +569,52 @@ QHash<int, BGPRoutingTable> computeBGPRoutingTables(QHash<int, QSet<int> > asBor
 				BGPRoutingTable &myTable = BGPRoutingTables[border];
 
 				// iterate over eBGP peers, and for each destination they have see if their route is better
-				foreach (QIntPair peering, eBGPPeers.keys()) {
-					if (peering.first == border) {
-						int peer = peering.second;
-						double distance = eBGPPeers[peering];
-						int peerAS = borderToASNumber[peer];
-						BGPRoutingTable &peerTable = BGPRoutingTables[peer];
-
-						// iterate over his routes
-						foreach (int d, peerTable.bestRoutes.keys()) {
-							BGPRoute peerRoute = peerTable.bestRoutes[d];
-							// simulate an eBGP update
-							peerRoute.ASPath.prepend(peerAS);
-							peerRoute.nextHop = peer;
-							peerRoute.distToNextHop = distance;
-							peerRoute.origin = "eBGP";
-
-							// avoid loops
-							if (peerRoute.ASPath.contains(ASNumber))
-								continue;
-
-							if (!myTable.bestRoutes.contains(d)) {
-								// anything is better than nothing
-								myTable.bestRoutes.insert(d, peerRoute);
-								changed = true;
-							} else {
-								BGPRoute myRoute = myTable.bestRoutes[d];
-								if (myRoute.compareTo(peerRoute) > 0) {
-									// his is better
-									myTable.bestRoutes.insert(d, peerRoute);
-									changed = true;
-								}
-							}
-						}
+				QList<BGPPeering> &eSessions = eBGPSessions[border];
+				for (int i = 0; i < eSessions.count(); i++) {
+					BGPPeering &peering = eSessions[i];
+					int peerAS = borderToASNumber[peering.peer];
+					const BGPRoutingTable &peerTable = BGPRoutingTables[peering.peer];
+
+					// iterate over his routes that changed since the last update
+					for (; peering.seen < peerTable.changes.count(); peering.seen++) {
+						BGPRoute peerRoute = peerTable.bestRoutes[peerTable.changes[peering.seen]];
+						// simulate an eBGP update
+						peerRoute.ASPath = asPaths.prepend(peerAS, peerRoute.ASPath);
+						peerRoute.ASPathLength = asPaths.length(peerRoute.ASPath);
+						peerRoute.nextHop = peering.peer;
+						peerRoute.distToNextHop = peering.distance;
+						peerRoute.origin = BGP_ORIGIN_EBGP;
+
+						// avoid loops
+						if (asPaths.contains(peerRoute.ASPath, ASNumber))
+							continue;
+
+						changed = offerRoute(myTable, peerRoute) || changed;
 					}
 				}
 
 				// iterate over iBGP peers, and for each destination they have see if their route is better
-				foreach (QIntPair peering, iBGPPeers.keys()) {
-					if (peering.first == border) {
-						int peer = peering.second;
-						double distance = iBGPPeers[peering];
-						BGPRoutingTable &peerTable = BGPRoutingTables[peer];
-
-						// iterate over his routes
-						foreach (int d, peerTable.bestRoutes.keys()) {
-							BGPRoute peerRoute = peerTable.bestRoutes[d];
-							// simulate an iBGP update
-							// chained updates are forbidden via iBGP
-							if (peerRoute.origin == "iBGP")
-								continue;
-							peerRoute.nextHop = peer;
-							peerRoute.distToNextHop = distance;
-							peerRoute.origin = "iBGP";
-
-							// avoid loops
-							if (peerRoute.ASPath.contains(ASNumber))
-								continue;
-
-							if (!myTable.bestRoutes.contains(d)) {
-								// anything is better than nothing
-								myTable.bestRoutes.insert(d, peerRoute);
-								changed = true;
-							} else {
-								BGPRoute myRoute = myTable.bestRoutes[d];
-								if (myRoute.compareTo(peerRoute) > 0) {
-									// his is better
-									myTable.bestRoutes.insert(d, peerRoute);
-									changed = true;
-								}
-							}
-						}
+				QList<BGPPeering> &iSessions = iBGPSessions[border];
+				for (int i = 0; i < iSessions.count(); i++) {
+					BGPPeering &peering = iSessions[i];
+					const BGPRoutingTable &peerTable = BGPRoutingTables[peering.peer];
+
+					// iterate over his routes that changed since the last update
+					for (; peering.seen < peerTable.changes.count(); peering.seen++) {
+						BGPRoute peerRoute = peerTable.bestRoutes[peerTable.changes[peering.seen]];
+						// simulate an iBGP update
+						// chained updates are forbidden via iBGP
+						if (peerRoute.origin == BGP_ORIGIN_IBGP)
+							continue;
+						peerRoute.nextHop = peering.peer;
+						peerRoute.distToNextHop = peering.distance;
+						peerRoute.origin = BGP_ORIGIN_IBGP;
+
+						// avoid loops
+						if (asPaths.contains(peerRoute.ASPath, ASNumber))
+							continue;
+
+						changed = offerRoute(myTable, peerRoute) || changed;
 					}
 				}
 			}
@@ -419,12 +630,10 @@ QHash<int, BGPRoutingTable> computeBGPRoutingTables(QHash<int, QSet<int> > asBor
 		foreach (int border, asBorders[ASNumber]) {
 			if (DEBUG_BGP) qDebug() << QString("AS%1 router %2:").arg(ASNumber).arg(border);
 			foreach (int d, BGPRoutingTables[border].bestRoutes.keys()) {
-				if (DEBUG_BGP) qDebug() << QString("To node %1: %2").arg(d).arg(BGPRoutingTables[border].bestRoutes[d].toString());
+				if (DEBUG_BGP) qDebug() << QString("To node %1: %2").arg(d).arg(BGPRoutingTables[border].bestRoutes[d].toString(asPaths));
 			}
 		}
 	}
-
-	return BGPRoutingTables;
 }
 
 // Populates the routing tables with the necessary information to route between source and routeDest via localDest.
@@ -437,15 +646,15 @@ QHash<int, BGPRoutingTable> computeBGPRoutingTables(QHash<int, QSet<int> > asBor
 //   on the path (source..routeDest) that is known via IGP routing.
 // IGPRoutes = the already computed IGP routing tables
 // Restriction: AS(source) == AS(localDest).
-void computeFinalRoutesIGP(QHash<int, RoutingTable> &routes, int source, int localDest, int routeDest, QHash<int, IgpRoutingTable> IGPRoutes)
+void computeFinalRoutesIGP(QHash<int, QMultiHash<int, int> > &routes, int source, int localDest, int routeDest, QHash<int, IgpRoutingTable> IGPRoutes)
 {
 	QList<int> queue;
 	queue << source;
 	while (!queue.isEmpty()) {
 		source = queue.takeFirst();
 		foreach (IGPRoute igpR, IGPRoutes[source].routes.values(localDest)) {
-			if (!routes[source].routes.contains(routeDest, Route(routeDest, igpR.nextHop))) {
-				routes[source].routes.insert(routeDest, Route(routeDest, igpR.nextHop));
+			if (!routes[source].contains(routeDest, igpR.nextHop)) {
+				routes[source].insert(routeDest, igpR.nextHop);
 				if (igpR.nextHop != localDest)
 					queue << igpR.nextHop;
 			}
@@ -490,7 +699,7 @@ void bestBGPExitPoint(NetGraph &g, int &closestBorder, int &nextHop,
 	}
 }
 
-void computeFinalRoutes(QHash<int, RoutingTable> &routes, NetGraph &g, int n1, int n2, QHash<int, IgpRoutingTable> IGPRoutes,
+void computeFinalRoutes(QHash<int, QMultiHash<int, int> > &routes, NetGraph &g, int n1, int n2, QHash<int, IgpRoutingTable> IGPRoutes,
 				    QHash<int, BGPRoutingTable> BGPRoutingTables, QHash<int, QSet<int> > asBorders)
 {
 	while (g.nodes[n1].ASNumber != g.nodes[n2].ASNumber) {
@@ -506,8 +715,8 @@ void computeFinalRoutes(QHash<int, RoutingTable> &routes, NetGraph &g, int n1, i
 		computeFinalRoutesIGP(routes, n1, closestBorder, n2, IGPRoutes);
 		// add routes from closestBorder to n2 via nextBorder
 		n1 = closestBorder;
-		if (!routes[n1].routes.contains(n2, Route(n2, nextBorder))) {
-			routes[n1].routes.insert(n2, Route(n2, nextBorder));
+		if (!routes[n1].contains(n2, nextBorder)) {
+			routes[n1].insert(n2, nextBorder);
 			if (n1 == 7 && n2 == 2 && nextBorder == 8) qDebug() << __FILE__ << __LINE__;
 		}
 		// continue by populating the routing table of the next border router
@@ -519,8 +728,45 @@ void computeFinalRoutes(QHash<int, RoutingTable> &routes, NetGraph &g, int n1, i
 	}
 }
 
+// Routing state kept between two calls of Bgp::computeRoutes. As long as the nodes and their ASes
+// stay the same, the IGP trees and the BGP routes that the link changes cannot affect are reused.
+class BgpState {
+public:
+	// the topology the state was computed for: (AS number, node type) of each node
+	QList<QIntPair> nodes;
+	// (source, dest) -> link metric
+	QHash<QIntPair, double> edgeMetrics;
+	// Maps an ASN to the roots of the AS
+	QHash<int, QSet<int> > asRoots;
+	// Maps a root to its IGP tree; the graph pointers are not valid between calls
+	QHash<int, IgpJob> igpJobs;
+
+	// inputs of the BGP computation
+	QHash<int, QSet<int> > asDestinations;
+	QHash<QPair<int, int>, double> eBGPPeers;
+	QHash<QPair<int, int>, double> iBGPPeers;
+	// (border router, destination in the same AS) -> IGP distance
+	QHash<QIntPair, double> localDistances;
+
+	// AS paths are never removed, so the table is rebuilt with a full BGP computation once it
+	// grows to more than twice its size after the last one
+	ASPathTable asPaths;
+	int asPathsAfterFull;
+	QHash<int, BGPRoutingTable> BGPRoutingTables;
+
+	BgpState() {
+		asPathsAfterFull = 0;
+	}
+};
+
+static BgpState bgpState;
+static QMutex bgpStateMutex;
+
 void Bgp::computeRoutes(NetGraph &g)
 {
+	QMutexLocker stateLocker(&bgpStateMutex);
+	BgpState &state = bgpState;
+
 	// Maps an ASN to the set of nodes (all routers and hosts) in that AS
 	QHash<int, QSet<int> > asNodes;
 
@@ -530,8 +776,8 @@ void Bgp::computeRoutes(NetGraph &g)
 	// Maps a node (node id) to its IGP routing table
 	QHash<int, IgpRoutingTable> IGPRoutes;
 
-	// Maps a node (node id) to its routing table; computing this is our final goal
-	QHash<int, RoutingTable> routes;
+	// Maps a node (node id) to its routes (destination -> next hop); computing this is our final goal
+	QHash<int, QMultiHash<int, int> > routes;
 
 	// First we fill up all the data structures
 	foreach (NetGraphNode n, g.nodes) {
@@ -544,6 +790,32 @@ void Bgp::computeRoutes(NetGraph &g)
 	if (DEBUG_BGP) qDebug() << "AS Numbers:" << asNodes.keys();
 	if (DEBUG_BGP) qDebug() << "Border routers:" << asBorders.values();
 
+	// the previous results can only be reused if the nodes and their ASes did not change
+	QList<QIntPair> nodes;
+	foreach (NetGraphNode n, g.nodes) {
+		nodes << QIntPair(n.ASNumber, n.nodeType);
+	}
+	bool full = nodes != state.nodes;
+	if (full) {
+		state = BgpState();
+		state.nodes = nodes;
+	}
+
+	// find the links that were added, removed or whose metric changed
+	QHash<QIntPair, double> edgeMetrics;
+	foreach (NetGraphEdge e, g.edges) {
+		edgeMetrics.insert(QIntPair(e.source, e.dest), e.metric());
+	}
+	QList<QIntPair> changedEdges;
+	foreach (QIntPair link, edgeMetrics.keys()) {
+		if (!state.edgeMetrics.contains(link) || state.edgeMetrics[link] != edgeMetrics[link])
+			changedEdges << link;
+	}
+	foreach (QIntPair link, state.edgeMetrics.keys()) {
+		if (!edgeMetrics.contains(link))
+			changedEdges << link;
+	}
+
 	// For each AS compute the interior routing table
 	// Only do it for interesting nodes
 	QSet<int> roots;
@@ -564,18 +836,77 @@ void Bgp::computeRoutes(NetGraph &g)
 		IGPRoutes[n.index] = t;
 	}
 
+	// we only keep the routes to interesting destinations: the roots of the same AS
+	QHash<int, QList<int> > asRoots;
 	foreach (int r, roots) {
-		// we only keep the routes to interesting destinations
-		QSet<int> destinations;
-		int asNumber = g.nodes[r].ASNumber;
-		foreach (int n, roots) {
-			if (g.nodes[n].ASNumber == asNumber) {
-				destinations << n;
+		asRoots[g.nodes[r].ASNumber] << r;
+	}
+
+	QHash<int, IgpGraph> igpGraphs;
+	QVector<int> localIndex;
+	buildIgpGraphs(g, igpGraphs, localIndex);
+
+	// recompute the trees of the roots whose destinations changed, or that a changed link may affect
+	QList<IgpJob> igpJobs;
+	foreach (int r, roots) {
+		int ASNumber = g.nodes[r].ASNumber;
+		if (state.igpJobs.contains(r) && state.asRoots.value(ASNumber) == asRoots[ASNumber].toSet()) {
+			const IgpJob &tree = state.igpJobs[r];
+			bool affected = false;
+			foreach (QIntPair link, changedEdges) {
+				if (g.nodes[link.first].ASNumber != ASNumber || g.nodes[link.second].ASNumber != ASNumber)
+					continue;
+				if (state.edgeMetrics.contains(link) &&
+					linkAffectsTree(tree, localIndex, link.first, link.second, state.edgeMetrics[link])) {
+					affected = true;
+					break;
+				}
+				if (edgeMetrics.contains(link) &&
+					linkAffectsTree(tree, localIndex, link.first, link.second, edgeMetrics[link])) {
+					affected = true;
+					break;
+				}
 			}
+			if (!affected)
+				continue;
 		}
-		if (DEBUG_BGP) qDebug() << "Destinations for node" << r << ":" << destinations;
+		IgpJob job;
+		job.graph = &igpGraphs[ASNumber];
+		job.localIndex = &localIndex;
+		job.root = r;
+		job.destinations = asRoots[ASNumber];
+		if (DEBUG_BGP) qDebug() << "Destinations for node" << r << ":" << job.destinations;
+		igpJobs << job;
+	}
+	QtConcurrent::blockingMap(igpJobs, dijkstra);
 
-		computeIGPRoutingTable(g, r, destinations, asNodes, IGPRoutes);
+	// keep the trees for the next call
+	foreach (int r, state.igpJobs.keys()) {
+		if (!roots.contains(r)) {
+			state.igpJobs.remove(r);
+		}
+	}
+	foreach (IgpJob job, igpJobs) {
+		job.graph = NULL;
+		job.localIndex = NULL;
+		state.igpJobs.insert(job.root, job);
+	}
+	state.asRoots.clear();
+	foreach (int ASNumber, asRoots.keys()) {
+		state.asRoots[ASNumber] = asRoots[ASNumber].toSet();
+	}
+	state.edgeMetrics = edgeMetrics;
+
+	// merge the routes; several roots may find the same one
+	foreach (int r, roots) {
+		const IgpJob &job = state.igpJobs[r];
+		for (int i = 0; i < job.routes.count(); i++) {
+			IgpRoutingTable &table = IGPRoutes[job.routes[i].first];
+			const IGPRoute &route = job.routes[i].second;
+			if (!table.routes.contains(route.destination, route)) {
+				table.routes.insert(route.destination, route);
+			}
+		}
 	}
 	foreach (NetGraphNode n, g.nodes) {
 		if (DEBUG_IGP) qDebug() << "IGPRoutes for node" << n.index << ":" << IGPRoutes[n.index].routes.values();
@@ -608,8 +939,10 @@ void Bgp::computeRoutes(NetGraph &g)
 	foreach (int ASNumber, asBorders.keys()) {
 		foreach (int br1, asBorders[ASNumber]) {
 			foreach (int br2, asBorders[ASNumber]) {
-				if (br1 != br2) {
-					iBGPPeers.insert(QPair<int, int>(br1, br2), IGPRoutes[br1].routes.value(br2).distance);
+				// no session between border routers that cannot reach each other
+				double distance = igpDistance(IGPRoutes, br1, br2);
+				if (br1 != br2 && distance < IGP_UNREACHABLE) {
+					iBGPPeers.insert(QPair<int, int>(br1, br2), distance);
 				}
 			}
 		}
@@ -624,8 +957,66 @@ void Bgp::computeRoutes(NetGraph &g)
 		}
 	}
 
+	// the IGP distances from the border routers to the local destinations
+	QHash<QIntPair, double> localDistances;
+	foreach (int ASNumber, asBorders.keys()) {
+		foreach (int border, asBorders[ASNumber]) {
+			foreach (int dest, asDestinations.value(ASNumber)) {
+				localDistances.insert(QIntPair(border, dest), igpDistance(IGPRoutes, border, dest));
+			}
+		}
+	}
+
+	// find the prefixes (destinations) whose BGP routes may change: all of them if a peering changed
+	// or the AS path table is rebuilt, otherwise those that were added or removed, or whose distance
+	// to a border router changed
+	QSet<int> prefixes;
+	bool fullBGP = full || eBGPPeers != state.eBGPPeers || iBGPPeers != state.iBGPPeers ||
+				   state.asPaths.count() > 2 * state.asPathsAfterFull;
+	if (fullBGP) {
+		state.BGPRoutingTables.clear();
+		state.asPaths = ASPathTable();
+		foreach (QSet<int> destinations, asDestinations.values()) {
+			prefixes.unite(destinations);
+		}
+	} else {
+		foreach (QSet<int> destinations, asDestinations.values()) {
+			prefixes.unite(destinations);
+		}
+		foreach (QSet<int> destinations, state.asDestinations.values()) {
+			prefixes.unite(destinations);
+		}
+		foreach (int dest, prefixes.toList()) {
+			int ASNumber = g.nodes[dest].ASNumber;
+			if (asDestinations.value(ASNumber).contains(dest) != state.asDestinations.value(ASNumber).contains(dest))
+				continue;
+			bool changed = false;
+			foreach (int border, asBorders.value(ASNumber)) {
+				QIntPair key(border, dest);
+				if (localDistances.value(key) != state.localDistances.value(key)) {
+					changed = true;
+					break;
+				}
+			}
+			if (!changed) {
+				prefixes.remove(dest);
+			}
+		}
+	}
+	state.asDestinations = asDestinations;
+	state.eBGPPeers = eBGPPeers;
+	state.iBGPPeers = iBGPPeers;
+	state.localDistances = localDistances;
+	if (DEBUG_BGP) qDebug() << "Recomputing" << igpJobs.count() << "of" << roots.count() << "IGP trees and the BGP routes to" << prefixes.count() << "prefixes" << (full ? "(full)" : "") << (fullBGP ? "(full BGP)" : "");
+
 	// compute BGP routes
-	QHash<int, BGPRoutingTable> BGPRoutingTables = computeBGPRoutingTables(asBorders, asDestinations, IGPRoutes, eBGPPeers, iBGPPeers, borderToASNumber);
+	if (!prefixes.isEmpty()) {
+		computeBGPRoutingTables(state.BGPRoutingTables, prefixes, asBorders, asDestinations, IGPRoutes, eBGPPeers, iBGPPeers, borderToASNumber, state.asPaths);
+	}
+	if (fullBGP) {
+		state.asPathsAfterFull = state.asPaths.count();
+	}
+	const QHash<int, BGPRoutingTable> &BGPRoutingTables = state.BGPRoutingTables;
 
 	// We can finally compute the final routes
 	foreach (NetGraphConnection c, g.connections) {
@@ -639,8 +1030,8 @@ void Bgp::computeRoutes(NetGraph &g)
 	}
 	// ...and save them
 	foreach (NetGraphNode n, g.nodes) {
-		g.nodes[n.index].routes = routes[n.index];
-		if (DEBUG_BGP) qDebug() << "Final routes for" << n.index << ":" << routes[n.index].routes.values();
+		g.nodes[n.index].routes.setRoutes(routes[n.index]);
+		if (DEBUG_BGP) qDebug() << "Final routes for" << n.index << ":" << g.nodes[n.index].routes.toList();
 	}
 }
 
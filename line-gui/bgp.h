@@ -24,6 +24,9 @@
 class Bgp
 {
 public:
+	// Computes the routing tables of all the nodes of g. The IGP trees and the BGP tables are kept
+	// until the next call, which only redoes the work affected by the link changes in between;
+	// everything is recomputed if the nodes or their ASes change.
 	static void computeRoutes(NetGraph &g);
 	static void testIGP();
 	static void testBGP();
@@ -18,10 +18,13 @@ SOURCES += main.cpp\
     netgraphscenenode.cpp \
     netgraphsceneedge.cpp \
     ../util/util.cpp \
+    ../util/resultsfile.cpp \
+    ../util/bitarray.cpp \
     netgraphpath.cpp \
     briteimporter.cpp \
     netgraphconnection.cpp \
     bgp.cpp \
+    routingcache.cpp \
     gephilayout.cpp \
     convexhull.cpp \
     netgraphas.cpp \
@@ -55,11 +58,15 @@ HEADERS  += mainwindow.h \
     netgraphscenenode.h \
     netgraphsceneedge.h \
     ../util/util.h \
+    ../util/resultsfile.h \
+    ../util/eventlog.h \
+    ../util/bitarray.h \
     ../util/debug.h \
     netgraphpath.h \
     briteimporter.h \
     netgraphconnection.h \
     bgp.h \
+    routingcache.h \
     gephilayout.h \
     convexhull.h \
     netgraphas.h \
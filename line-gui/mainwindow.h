@@ -190,6 +190,10 @@ private slots:
 	void on_spinASNumber_valueChanged(int );
 	void on_txtConnectionType_textChanged(const QString &arg1);
 	void on_spinLoss_valueChanged(double );
+	void on_cmbLossModel_currentIndexChanged(int index);
+	void on_spinLossGoodToBad_valueChanged(double );
+	void on_spinLossBadToGood_valueChanged(double );
+	void on_spinLossBad_valueChanged(double );
 	void on_spinBandwidth_valueChanged(double );
 	void on_spinDelay_valueChanged(int );
 	void on_checkAutoQueue_toggled(bool checked);
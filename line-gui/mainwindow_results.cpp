@@ -20,6 +20,7 @@
 #include "ui_mainwindow.h"
 
 #include "../tomo/tomodata.h"
+#include "../util/resultsfile.h"
 
 Simulation::Simulation()
 {
@@ -212,30 +213,38 @@ void MainWindow::loadSimulation()
 		accordion->addWidget("Data", txt);
 	}
 
-	accordion->addLabel("Packet events");
+	// edge and path timelines; the file is mapped, only the plotted columns are read
+	ResultsFile results;
 	{
+		QString fileName = simulations[currentSimulation].dir + "/" + "results.dat";
+		if (!results.open(fileName)) {
+			QMessageBox::critical(this, "Open file error", QString("Failed to open file %1").arg(fileName));
+		} else if (results.edgeCount() != netGraph.edges.count()) {
+			QMessageBox::critical(this, "Open file error", QString("The file %1 does not match the topology").arg(fileName));
+			results.close();
+		}
+	}
+
+	accordion->addLabel("Packet events");
+	if (results.isOpen()) {
 		// for each link, array of bits: 0 = forward, 1 = drop
 		for (int i = 0; i < netGraph.edges.count(); i++) {
-			QString fileName = simulations[currentSimulation].dir + "/" + QString("packetevents-edge-%1.dat").arg(i);
-			QFile file(fileName);
-			if (!file.open(QIODevice::ReadOnly)) {
-				QMessageBox::critical(this, "Open file error", QString("Failed to open file %1").arg(fileName));
+			quint64 eventCount = results.edge(i).eventCount;
+			qDebug() << __FILE__ << __LINE__ << "eventCount =" << eventCount;
+			if (results.edge(i).eventsLost > 0) {
+				qDebug() << __FILE__ << __LINE__ << "Edge" << i << "lost" << results.edge(i).eventsLost << "packet event words, the events are truncated";
 			}
-			QDataStream in(&file);
-			in.setVersion(QDataStream::Qt_4_0);
-
-			QVector<quint8> values;
-			in >> values;
-			qDebug() << __FILE__ << __LINE__ << "values.count() =" << values.count();
 			QString title = QString("Packet events for edge %1 -> %2").arg(netGraph.edges[i].source).arg(netGraph.edges[i].dest);
-			if (!values.isEmpty()) {
+			if (eventCount > 0) {
 				QOPlotWidget *plot = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
 				plot->plot.title = title;
 
 				QOPlotStemData *stem = new QOPlotStemData();
-				for (int i = 0; i < values.count(); i++) {
-					stem->x.append(i);
-					stem->y.append(values.at(i));
+				stem->x.reserve(eventCount);
+				stem->y.reserve(eventCount);
+				for (quint64 event = 0; event < eventCount; event++) {
+					stem->x.append(event);
+					stem->y.append(results.packetEvent(i, event));
 				}
 				stem->pen = QPen(Qt::blue);
 				stem->legendLabel = "Events (0 = forward, 1 = drop)";
@@ -251,215 +260,47 @@ void MainWindow::loadSimulation()
 	}
 
 	accordion->addLabel("Link timelines");
-	{
-		for (int iEdge = 0; iEdge < netGraph.edges.count(); iEdge++) {
-			QString fileName = simulations[currentSimulation].dir + "/" + QString("timelines-edge-%1.dat").arg(iEdge);
-			QFile file(fileName);
-			if (!file.open(QIODevice::ReadOnly)) {
-				QMessageBox::critical(this, "Open file error", QString("Failed to open file %1").arg(fileName));
-			}
-			QDataStream in(&file);
-			in.setVersion(QDataStream::Qt_4_0);
-
-			QString title = QString("Timeline for edge %1 -> %2").arg(netGraph.edges[iEdge].source).arg(netGraph.edges[iEdge].dest);
+	if (results.isOpen()) {
+		QList<QPair<int, QString> > columns;
+		columns << qMakePair(RESULTS_EDGE_ARRIVALS_P, QString(" - Arrivals (packets)"));
+		columns << qMakePair(RESULTS_EDGE_ARRIVALS_B, QString(" - Arrivals (bytes)"));
+		columns << qMakePair(RESULTS_EDGE_QDROPS_P, QString(" - Queue drops (packets)"));
+		columns << qMakePair(RESULTS_EDGE_QDROPS_B, QString(" - Queue drops (bytes)"));
+		columns << qMakePair(RESULTS_EDGE_RDROPS_P, QString(" - Random drops (packets)"));
+		columns << qMakePair(RESULTS_EDGE_RDROPS_B, QString(" - Random drops (bytes)"));
+		columns << qMakePair(RESULTS_EDGE_QUEUE_SAMPLED, QString(" - Queue size (sampled)"));
+		columns << qMakePair(RESULTS_EDGE_QUEUE_MAX, QString(" - Queue size (interval maximums)"));
+		columns << qMakePair(RESULTS_EDGE_QUEUE_AVG, QString(" - Queue size (interval mean)"));
 
-			quint64 tsMin, tsMax, tsample;
-			quint64 rate_Bps;
-			qint32 delay_ms;
-			quint64 qcapacity;
-
-			QVector<quint64> vector_timestamp;
-			QVector<quint64> vector_arrivals_p;
-			QVector<quint64> vector_arrivals_B;
-			QVector<quint64> vector_qdrops_p;
-			QVector<quint64> vector_qdrops_B;
-			QVector<quint64> vector_rdrops_p;
-			QVector<quint64> vector_rdrops_B;
-			QVector<quint64> vector_queue_sampled;
-			QVector<quint64> vector_queue_avg;
-			QVector<quint64> vector_queue_max;
-
-
-			// edge timeline range
-			in >> tsMin;
-			in >> tsMax;
-
-			// edge properties
-			in >> tsample;
-			in >> rate_Bps;
-			in >> delay_ms;
-			in >> qcapacity;
-
-			in >> vector_timestamp;
-			in >> vector_arrivals_p;
-			in >> vector_arrivals_B;
-			in >> vector_qdrops_p;
-			in >> vector_qdrops_B;
-			in >> vector_rdrops_p;
-			in >> vector_rdrops_B;
-			in >> vector_queue_sampled;
-			in >> vector_queue_avg;
-			in >> vector_queue_max;
-
-			if (vector_timestamp.isEmpty())
+		for (int iEdge = 0; iEdge < netGraph.edges.count(); iEdge++) {
+			if (results.edge(iEdge).sampleCount == 0)
 				continue;
 
-			quint64 nelem = (tsMax - tsMin)/tsample + (((tsMax - tsMin)%tsample) ? 1 : 0);
-
-			QOPlotCurveData *arrivals_p = new QOPlotCurveData;
-			QOPlotCurveData *arrivals_B = new QOPlotCurveData;
-			QOPlotCurveData *qdrops_p = new QOPlotCurveData;
-			QOPlotCurveData *qdrops_B = new QOPlotCurveData;
-			QOPlotCurveData *rdrops_p = new QOPlotCurveData;
-			QOPlotCurveData *rdrops_B = new QOPlotCurveData;
-			QOPlotCurveData *queue_sampled = new QOPlotCurveData;
-			QOPlotCurveData *queue_avg = new QOPlotCurveData;
-			QOPlotCurveData *queue_max = new QOPlotCurveData;
-
-			arrivals_p->x.reserve(nelem);
-			arrivals_p->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				arrivals_p->x << vector_timestamp.at(i);
-				arrivals_p->y << vector_arrivals_p.at(i);
-			}
-
-			QString subtitle = " - Arrivals (packets)";
-			QOPlotWidget *plot_arrivals_p = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_arrivals_p->plot.title = title + subtitle;
-			plot_arrivals_p->plot.data << QSharedPointer<QOPlotData>(arrivals_p);
-			plot_arrivals_p->plot.drag_y_enabled = false;
-			plot_arrivals_p->plot.zoom_y_enabled = false;
-			plot_arrivals_p->fixAxes(0, 1000, 0, 2);
-			plot_arrivals_p->drawPlot();
-			accordion->addWidget(title + subtitle, plot_arrivals_p);
-
-			arrivals_B->x = arrivals_p->x;
-			arrivals_B->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				arrivals_B->y << vector_arrivals_B.at(i);
-			}
-
-			subtitle = " - Arrivals (bytes)";
-			QOPlotWidget *plot_arrivals_B = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_arrivals_B->plot.title = title + subtitle;
-			plot_arrivals_B->plot.data << QSharedPointer<QOPlotData>(arrivals_B);
-			plot_arrivals_B->plot.drag_y_enabled = false;
-			plot_arrivals_B->plot.zoom_y_enabled = false;
-			plot_arrivals_B->fixAxes(0, 1000, 0, 2);
-			plot_arrivals_B->drawPlot();
-			accordion->addWidget(title + subtitle, plot_arrivals_B);
-
-			qdrops_p->x = arrivals_p->x;
-			qdrops_p->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				qdrops_p->y << vector_qdrops_p.at(i);
-			}
-
-			subtitle = " - Queue drops (packets)";
-			QOPlotWidget *plot_qdrops_p = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_qdrops_p->plot.title = title + subtitle;
-			plot_qdrops_p->plot.data << QSharedPointer<QOPlotData>(qdrops_p);
-			plot_qdrops_p->plot.drag_y_enabled = false;
-			plot_qdrops_p->plot.zoom_y_enabled = false;
-			plot_qdrops_p->fixAxes(0, 1000, 0, 2);
-			plot_qdrops_p->drawPlot();
-			accordion->addWidget(title + subtitle, plot_qdrops_p);
-
-			qdrops_B->x = arrivals_p->x;
-			qdrops_B->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				qdrops_B->y << vector_qdrops_B.at(i);
-			}
-
-			subtitle = " - Queue drops (bytes)";
-			QOPlotWidget *plot_qdrops_B = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_qdrops_B->plot.title = title + subtitle;
-			plot_qdrops_B->plot.data << QSharedPointer<QOPlotData>(qdrops_B);
-			plot_qdrops_B->plot.drag_y_enabled = false;
-			plot_qdrops_B->plot.zoom_y_enabled = false;
-			plot_qdrops_B->fixAxes(0, 1000, 0, 2);
-			plot_qdrops_B->drawPlot();
-			accordion->addWidget(title + subtitle, plot_qdrops_B);
-
-			rdrops_p->x = arrivals_p->x;
-			rdrops_p->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				rdrops_p->y << vector_rdrops_p.at(i);
-			}
-
-			subtitle = " - Random drops (packets)";
-			QOPlotWidget *plot_rdrops_p = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_rdrops_p->plot.title = title + subtitle;
-			plot_rdrops_p->plot.data << QSharedPointer<QOPlotData>(rdrops_p);
-			plot_rdrops_p->plot.drag_y_enabled = false;
-			plot_rdrops_p->plot.zoom_y_enabled = false;
-			plot_rdrops_p->fixAxes(0, 1000, 0, 2);
-			plot_rdrops_p->drawPlot();
-			accordion->addWidget(title + subtitle, plot_rdrops_p);
-
-			rdrops_B->x = arrivals_p->x;
-			rdrops_B->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				rdrops_B->y << vector_rdrops_B.at(i);
-			}
-
-			subtitle = " - Random drops (bytes)";
-			QOPlotWidget *plot_rdrops_B = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_rdrops_B->plot.title = title + subtitle;
-			plot_rdrops_B->plot.data << QSharedPointer<QOPlotData>(rdrops_B);
-			plot_rdrops_B->plot.drag_y_enabled = false;
-			plot_rdrops_B->plot.zoom_y_enabled = false;
-			plot_rdrops_B->fixAxes(0, 1000, 0, 2);
-			plot_rdrops_B->drawPlot();
-			accordion->addWidget(title + subtitle, plot_rdrops_B);
-
-			queue_sampled->x = arrivals_p->x;
-			queue_sampled->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				queue_sampled->y << vector_queue_sampled.at(i);
-			}
+			QString title = QString("Timeline for edge %1 -> %2").arg(netGraph.edges[iEdge].source).arg(netGraph.edges[iEdge].dest);
 
-			subtitle = " - Queue size (sampled)";
-			QOPlotWidget *plot_queue_sampled = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_queue_sampled->plot.title = title + subtitle;
-			plot_queue_sampled->plot.data << QSharedPointer<QOPlotData>(queue_sampled);
-			plot_queue_sampled->plot.drag_y_enabled = false;
-			plot_queue_sampled->plot.zoom_y_enabled = false;
-			plot_queue_sampled->fixAxes(0, 1000, 0, 2);
-			plot_queue_sampled->drawPlot();
-			accordion->addWidget(title + subtitle, plot_queue_sampled);
-
-			queue_max->x = arrivals_p->x;
-			queue_max->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				queue_max->y << vector_queue_max.at(i);
-			}
+			for (int c = 0; c < columns.count(); c++) {
+				QVector<quint64> x;
+				QVector<quint64> y;
+				results.unrollEdgeColumn(iEdge, columns[c].first, x, y);
+
+				QOPlotCurveData *curve = new QOPlotCurveData;
+				curve->x.reserve(x.count());
+				curve->y.reserve(y.count());
+				for (int i = 0; i < x.count(); i++) {
+					curve->x << x.at(i);
+					curve->y << y.at(i);
+				}
 
-			subtitle = " - Queue size (interval maximums)";
-			QOPlotWidget *plot_queue_max = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_queue_max->plot.title = title + subtitle;
-			plot_queue_max->plot.data << QSharedPointer<QOPlotData>(queue_max);
-			plot_queue_max->plot.drag_y_enabled = false;
-			plot_queue_max->plot.zoom_y_enabled = false;
-			plot_queue_max->fixAxes(0, 1000, 0, 2);
-			plot_queue_max->drawPlot();
-			accordion->addWidget(title + subtitle, plot_queue_max);
-
-			queue_avg->x = arrivals_p->x;
-			queue_avg->y.reserve(nelem);
-			for (int i = 0; i < vector_timestamp.count(); i++) {
-				queue_avg->y << vector_queue_avg.at(i);
+				QString subtitle = columns[c].second;
+				QOPlotWidget *plot = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
+				plot->plot.title = title + subtitle;
+				plot->plot.data << QSharedPointer<QOPlotData>(curve);
+				plot->plot.drag_y_enabled = false;
+				plot->plot.zoom_y_enabled = false;
+				plot->fixAxes(0, 1000, 0, 2);
+				plot->drawPlot();
+				accordion->addWidget(title + subtitle, plot);
 			}
-
-			subtitle = " - Queue size (interval mean)";
-			QOPlotWidget *plot_queue_avg = new QOPlotWidget(accordion, 0, 300, QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-			plot_queue_avg->plot.title = title + subtitle;
-			plot_queue_avg->plot.data << QSharedPointer<QOPlotData>(queue_avg);
-			plot_queue_avg->plot.drag_y_enabled = false;
-			plot_queue_avg->plot.zoom_y_enabled = false;
-			plot_queue_avg->fixAxes(0, 1000, 0, 2);
-			plot_queue_avg->drawPlot();
-			accordion->addWidget(title + subtitle, plot_queue_avg);
 		}
 	}
 
@@ -154,6 +154,26 @@ void MainWindow::on_spinLoss_valueChanged(double val)
 	scene.lossRateChanged(val);
 }
 
+void MainWindow::on_cmbLossModel_currentIndexChanged(int index)
+{
+	scene.lossModelChanged(index);
+}
+
+void MainWindow::on_spinLossGoodToBad_valueChanged(double val)
+{
+	scene.lossGoodToBadChanged(val);
+}
+
+void MainWindow::on_spinLossBadToGood_valueChanged(double val)
+{
+	scene.lossBadToGoodChanged(val);
+}
+
+void MainWindow::on_spinLossBad_valueChanged(double val)
+{
+	scene.lossBadChanged(val);
+}
+
 void MainWindow::on_spinQueueLength_valueChanged(int val)
 {
 	scene.queueLenghtChanged(val);
@@ -236,6 +256,10 @@ void MainWindow::edgeSelected(NetGraphEdge edge)
 	ui->spinDelay->setValue(edge.delay_ms);
 	ui->spinBandwidth->setValue(edge.bandwidth);
 	ui->spinLoss->setValue(edge.lossBernoulli);
+	ui->cmbLossModel->setCurrentIndex(edge.lossModel);
+	ui->spinLossGoodToBad->setValue(edge.lossGoodToBad);
+	ui->spinLossBadToGood->setValue(edge.lossBadToGood);
+	ui->spinLossBad->setValue(edge.lossBad);
 	ui->spinQueueLength->setValue(edge.queueLength);
 	ui->checkSampledTimeline->setChecked(edge.recordSampledTimeline);
 	ui->txtSamplingPeriod->setText(timeToString(edge.timelineSamplingPeriod));
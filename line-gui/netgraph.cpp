@@ -25,6 +25,7 @@
 #include "bgp.h"
 #include "gephilayout.h"
 #include "convexhull.h"
+#include "routingcache.h"
 #endif
 
 NetGraph::NetGraph()
@@ -162,7 +163,11 @@ int NetGraph::addConnection(NetGraphConnection c)
 #ifndef LINE_EMULATOR
 void NetGraph::computeRoutes()
 {
+	// the routes only depend on the routing inputs, which may have been seen before
+	if (RoutingCache::load(*this))
+		return;
 	Bgp::computeRoutes(*this);
+	RoutingCache::store(*this);
 }
 #endif
 
@@ -179,6 +184,24 @@ QDataStream& operator>>(QDataStream& s, NetGraph& n)
 	s >> n.domains;
 	s >> n.paths;
 	s >> n.fileName;
+
+	// loss models, added after the first version of the format; older files end here
+	if (!s.atEnd()) {
+		for (int i = 0; i < n.edges.count(); i++) {
+			n.edges[i].loadLossModel(s);
+		}
+		// the paths have their own copies of the edges
+		for (int p = 0; p < n.paths.count(); p++) {
+			for (int i = 0; i < n.paths[p].edgeList.count(); i++) {
+				n.paths[p].edgeList[i] = n.edges[n.paths[p].edgeList[i].index];
+			}
+			QSet<NetGraphEdge> edgeSet;
+			foreach (NetGraphEdge e, n.paths[p].edgeSet) {
+				edgeSet.insert(n.edges[e.index]);
+			}
+			n.paths[p].edgeSet = edgeSet;
+		}
+	}
 	return s;
 }
 
@@ -190,6 +213,9 @@ QDataStream& operator<<(QDataStream& s, const NetGraph& n)
 	s << n.domains;
 	s << n.paths;
 	s << n.fileName;
+	foreach (NetGraphEdge e, n.edges) {
+		e.saveLossModel(s);
+	}
 	return s;
 }
 
@@ -284,8 +310,22 @@ bool NetGraph::layoutGephi()
 }
 #endif
 
+// Computes the edges of p from the routing tables, or takes them from the routing cache
+static void tracePath(NetGraph &g, NetGraphPath &p, QByteArray &fingerprint)
+{
+#ifndef LINE_EMULATOR
+	RoutingCache::tracePath(g, p, fingerprint);
+#else
+	Q_UNUSED(fingerprint);
+	p.retrace(g);
+#endif
+}
+
 void NetGraph::updateUsed()
 {
+	// computed on first use by tracePath()
+	QByteArray fingerprint;
+
 	// Remove unused paths
 	for (int iPath = 0; iPath < paths.count(); iPath++) {
 		bool used = false;
@@ -315,12 +355,16 @@ void NetGraph::updateUsed()
 			if (c.source == p.source && c.dest == p.dest) {
 				found = true;
 				if (p.edgeSet.isEmpty())
-					p.retrace(*this);
+					tracePath(*this, p, fingerprint);
 				break;
 			}
 		}
 		if (!found && (c.source != c.dest)) {
-			paths << NetGraphPath(*this, c.source, c.dest);
+			NetGraphPath p;
+			p.source = c.source;
+			p.dest = c.dest;
+			tracePath(*this, p, fingerprint);
+			paths << p;
 		}
 		// reverse
 		found = false;
@@ -329,12 +373,16 @@ void NetGraph::updateUsed()
 			if (c.source == p.dest && c.dest == p.source) {
 				found = true;
 				if (p.edgeSet.isEmpty())
-					p.retrace(*this);
+					tracePath(*this, p, fingerprint);
 				break;
 			}
 		}
 		if (!found && (c.source != c.dest)) {
-			paths << NetGraphPath(*this, c.dest, c.source);
+			NetGraphPath p;
+			p.source = c.dest;
+			p.dest = c.source;
+			tracePath(*this, p, fingerprint);
+			paths << p;
 		}
 	}
 
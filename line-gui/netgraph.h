@@ -48,6 +48,24 @@ public:
 	QHash<QPair<qint32, qint32>, qint32> edgeCache;
 	// maps (node ID, node ID) -> path ID
 	QHash<QPair<qint32, qint32>, qint32 > pathCache;
+
+	// Dense forwarding plane, compiled by prepareEmulation() from the routing tables.
+	// Destinations are the nodes at which paths end, numbered 0..destCount-1.
+	qint32 destCount;
+	// maps node ID -> destination index, or -1 if no path ends at the node
+	QVector<qint32> destIndexByNode;
+	// maps (node ID, destination index) -> ID of the outgoing edge, or -1 if there is no route
+	QVector<qint32> forwardingTable;
+	// maps (source node ID, destination index) -> path ID, or -1 if there is no such path
+	QVector<qint32> pathTable;
+
+	inline qint32 forwardingEdge(qint32 node, qint32 destIndex) const {
+		return forwardingTable.constData()[node * destCount + destIndex];
+	}
+
+	inline qint32 pathIndex(qint32 source, qint32 destIndex) const {
+		return pathTable.constData()[source * destCount + destIndex];
+	}
 #endif
 
 	// Adds a node of type NETGRAPH_NODE_something, at a scene position pos
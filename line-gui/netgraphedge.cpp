@@ -22,8 +22,23 @@ NetGraphEdge::NetGraphEdge()
 {
 	used = true;
 
+	lossModel = LOSS_MODEL_BERNOULLI;
+	lossBernoulli = 0;
+	lossGoodToBad = 0;
+	lossBadToGood = 1;
+	lossBad = 0;
+
 	recordSampledTimeline = false;
 	recordFullTimeline = false;
+
+#ifdef LINE_EMULATOR
+	timelineSampled = NULL;
+	timelineFull = NULL;
+	fullTimelineLog = NULL;
+	packetEvents = NULL;
+	packetEventsValidWords = 0;
+	packetEventsLostWords = 0;
+#endif
 }
 
 QString NetGraphEdge::tooltip()
@@ -33,7 +48,9 @@ QString NetGraphEdge::tooltip()
 	result += QString("(%1) %2 KB/s %3 ms q=%4 B").arg(index).arg(bandwidth).arg(delay_ms).arg(queueLength * 1500);
 	// result = QString("id=%1").arg(index);
 
-	if (lossBernoulli > 1.0e-12) {
+	if (lossModel == LOSS_MODEL_GILBERT_ELLIOTT) {
+		result += QString(" GE=%1/%2 L=%3/%4").arg(lossGoodToBad).arg(lossBadToGood).arg(lossBernoulli).arg(lossBad);
+	} else if (lossBernoulli > 1.0e-12) {
 		result += " L=" + QString::number(lossBernoulli);
 	}
 
@@ -49,6 +66,32 @@ double NetGraphEdge::metric()
 	return referenceBw_KBps / bandwidth;
 }
 
+double NetGraphEdge::meanLossRate()
+{
+	if (lossModel == LOSS_MODEL_GILBERT_ELLIOTT) {
+		// fraction of the time spent in the bad state, in the long run
+		double bad = (lossGoodToBad + lossBadToGood > 0) ? lossGoodToBad / (lossGoodToBad + lossBadToGood) : 0;
+		return (1.0 - bad) * lossBernoulli + bad * lossBad;
+	}
+	return lossBernoulli;
+}
+
+void NetGraphEdge::loadLossModel(QDataStream& s)
+{
+	s >> lossModel;
+	s >> lossGoodToBad;
+	s >> lossBadToGood;
+	s >> lossBad;
+}
+
+void NetGraphEdge::saveLossModel(QDataStream& s) const
+{
+	s << lossModel;
+	s << lossGoodToBad;
+	s << lossBadToGood;
+	s << lossBad;
+}
+
 QDataStream& operator>>(QDataStream& s, NetGraphEdge& e)
 {
 	s >> e.index;
@@ -24,18 +24,16 @@
 #define ETH_DATA_LEN	    1500
 #define ETH_FRAME_LEN	1514 // max. bytes in frame without FCS
 
-#ifdef LINE_EMULATOR
-#include "../line-router/bitarray.h"
-#endif
+// Random loss models (before queueing)
+#define LOSS_MODEL_BERNOULLI       0 // independent losses with rate lossBernoulli
+#define LOSS_MODEL_GILBERT_ELLIOTT 1 // two-state Markov chain: losses are bursty
 
 #ifdef LINE_EMULATOR
+#include "../line-router/prng.h"
 
 class Packet;
-
-struct packetEvent {
-	quint64      timestamp;
-	int          type;
-};
+class TimelineStream;
+class EventLogEncoder;
 
 struct edgeTimelineItem {
 	quint64      timestamp;
@@ -61,7 +59,11 @@ public:
 	qint32 dest;             // index of the destination node
 
 	qint32 delay_ms;         // propagation delay in ms
-	qreal lossBernoulli;     // bernoulli loss rate (before queueing)
+	qint32 lossModel;        // LOSS_MODEL_xxx
+	qreal lossBernoulli;     // bernoulli loss rate (before queueing); for Gilbert-Elliott, the loss rate in the good state
+	qreal lossGoodToBad;     // Gilbert-Elliott: probability of moving to the bad state, per packet
+	qreal lossBadToGood;     // Gilbert-Elliott: probability of moving back to the good state, per packet
+	qreal lossBad;           // Gilbert-Elliott: loss rate in the bad state
 	qint32 queueLength;      // queue length in #Ethernet frames
 	qreal bandwidth;         // bandwidth in B/s
 
@@ -74,7 +76,12 @@ public:
 
 #ifdef LINE_EMULATOR
 	quint64 rate_Bps;        // link rate in bytes/s
-	qint32 lossRate_int;     // packet loss rate (2^31-1 means 100% loss)
+	// Random loss: thresholds for Prng::chance(), indexed by the Gilbert-Elliott state (0 = good, 1 = bad)
+	Prng prng;
+	bool lossEnabled;
+	int lossState;
+	quint64 lossThreshold[2];
+	quint64 lossTransition[2];
 
 	// Queue
 	quint64 qcapacity;     // queue size in bytes
@@ -93,20 +100,35 @@ public:
 	quint64 drops_history;      // History of the last 64 incoming packets (0 = transmitted, 1 = qdropped
 	quint64 drops_history_dcnt; // Number of 1 bits in drops_history
 
-	// Timeline
-	QList<packetEvent> timelineFull;
-	QList<edgeTimelineItem> timelineSampled;
-
-	// Packet events
-	BitArray packetEvents;      // 0 = successful forwarding; 1 = drop
+	// Timeline: the current sampling period is kept here, finished ones are streamed to disk
+	edgeTimelineItem currentSample;
+	TimelineStream *timelineSampled;
+	// Full timeline: one event per packet (or one in fullTimelineSampling), in compact blocks
+	EventLogEncoder *fullTimelineLog;
+	quint32 fullTimelineSkipped;
+	TimelineStream *timelineFull;
+
+	// Packet events (0 = successful forwarding; 1 = drop), streamed to disk 64 at a time
+	quint64 packetEventsWord;
+	int packetEventsBits;
+	TimelineStream *packetEvents;
+	// words written before the first lost one, and the number of lost words (set when the stream is closed)
+	quint64 packetEventsValidWords;
+	quint64 packetEventsLostWords;
 #endif
 
 	QString tooltip();    // shows bw, delay etc
 	double metric();
+	double meanLossRate(); // long-term random loss rate
+
+	// stream the loss model fields, which are stored separately in the graph file
+	void loadLossModel(QDataStream& s);
+	void saveLossModel(QDataStream& s) const;
 
 #ifdef LINE_EMULATOR
 	void prepareEmulation();
 	bool enqueue(Packet *p, quint64 ts_now, quint64 &ts_exit);
+	bool randomDrop();
 #endif
 
 	bool operator==(const NetGraphEdge &other) const {
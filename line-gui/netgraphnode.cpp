@@ -53,7 +53,7 @@ QString NetGraphNode::routeTooltip()
 	result += QString("<b>Routing table for node %1 (%2)</b><br/>").arg(index).arg(ip());
 	result += QString("<table border='1' cellspacing='-1' cellpadding='2'>");
 	result += QString("<tr><th>Destination</th><th>Next node</th></tr>");
-	foreach (Route r, routes.routes.values()) {
+	foreach (Route r, routes.toList()) {
 		result += QString("<tr><td>%1 (%2)</td><td>%3 (%4)</td></tr>").arg(r.destination).arg(ip(r.destination)).arg(r.nextHop).arg(ip(r.nextHop));
 	}
 	result += QString("</table>");
@@ -22,12 +22,18 @@
 NetGraphPath::NetGraphPath()
 {
 	recordSampledTimeline = false;
+#ifdef LINE_EMULATOR
+	timelineSampled = NULL;
+#endif
 }
 
 NetGraphPath::NetGraphPath(NetGraph &g, int source, int dest) :
 	source(source), dest(dest)
 {
 	recordSampledTimeline = false;
+#ifdef LINE_EMULATOR
+	timelineSampled = NULL;
+#endif
 	retrace(g);
 }
 
@@ -41,17 +47,19 @@ void NetGraphPath::retrace(NetGraph &g)
 	bool loadBalanced = false;
 	while (!nodeQueue.isEmpty()) {
 		int n = nodeQueue.takeFirst();
-		QList<Route> routes = g.nodes[n].routes.routes.values(dest);
-		loadBalanced = loadBalanced || (routes.count() > 1);
-		foreach (Route r, routes) {
-			NetGraphEdge e = g.edgeByNodeIndex(n, r.nextHop);
+		int count;
+		const qint32 *nextHops = g.nodes.at(n).routes.nextHops(dest, count);
+		loadBalanced = loadBalanced || (count > 1);
+		for (int i = 0; i < count; i++) {
+			int nextHop = nextHops[i];
+			NetGraphEdge e = g.edgeByNodeIndex(n, nextHop);
 			edgeSet.insert(e);
 			if (!loadBalanced) {
 				edgeList << e;
 			}
-			if (r.nextHop != dest && !nodesEnqueued.contains(r.nextHop)) {
-				nodeQueue << r.nextHop;
-				nodesEnqueued << r.nextHop;
+			if (nextHop != dest && !nodesEnqueued.contains(nextHop)) {
+				nodeQueue << nextHop;
+				nodesEnqueued << nextHop;
 			}
 		}
 	}
@@ -95,7 +103,7 @@ double NetGraphPath::lossBernoulli()
 {
 	double success = 1.0;
 	foreach (NetGraphEdge e, edgeList) {
-		success *= 1.0 - e.lossBernoulli;
+		success *= 1.0 - e.meanLossRate();
 	}
 	return 1.0 - success;
 }
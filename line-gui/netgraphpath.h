@@ -67,8 +67,9 @@ public:
 	quint64 total_theor_delay;   // Total packet delay - theoretical
 	quint64 total_actual_delay;  // Total packet delay - includes emulator overhead
 
-	// Timeline
-	QList<pathTimelineItem> timelineSampled;
+	// Timeline: the current sampling period is kept here, finished ones are streamed to disk
+	pathTimelineItem currentSample;
+	TimelineStream *timelineSampled;
 #endif
 
 	void retrace(NetGraph &g);
@@ -332,10 +332,16 @@ void NetGraphScene::nodeMousePressed(QGraphicsSceneMouseEvent *mouseEvent, NetGr
 		node->ungrabMouse();
 		getNewEdge()->setVisible(false);
 		if (netGraph->canAddEdge(newEdge->startIndex, newEdge->endIndex)) {
-			addEdge(newEdge->startIndex, getNewEdge()->endIndex,
-				   defaultEdge.bandwidth, defaultEdge.delay_ms,
-				   defaultEdge.lossBernoulli, defaultEdge.queueLength,
-				   startNode, node);
+			NetGraphSceneEdge *edge = addEdge(newEdge->startIndex, getNewEdge()->endIndex,
+											  defaultEdge.bandwidth, defaultEdge.delay_ms,
+											  defaultEdge.lossBernoulli, defaultEdge.queueLength,
+											  startNode, node);
+			NetGraphEdge &e = netGraph->edges[edge->edgeIndex];
+			e.lossModel = defaultEdge.lossModel;
+			e.lossGoodToBad = defaultEdge.lossGoodToBad;
+			e.lossBadToGood = defaultEdge.lossBadToGood;
+			e.lossBad = defaultEdge.lossBad;
+			edge->setText(e.tooltip());
 		}
 		destroyNewEdge();
 		startNode = 0;
@@ -562,6 +568,46 @@ void NetGraphScene::lossRateChanged(double val)
 	}
 }
 
+void NetGraphScene::lossModelChanged(int val)
+{
+	if (editMode == EditEdge && selectedEdge) {
+		netGraph->edges[selectedEdge->edgeIndex].lossModel = val;
+		selectedEdge->setText(netGraph->edges[selectedEdge->edgeIndex].tooltip());
+	} else {
+		defaultEdge.lossModel = val;
+	}
+}
+
+void NetGraphScene::lossGoodToBadChanged(double val)
+{
+	if (editMode == EditEdge && selectedEdge) {
+		netGraph->edges[selectedEdge->edgeIndex].lossGoodToBad = val;
+		selectedEdge->setText(netGraph->edges[selectedEdge->edgeIndex].tooltip());
+	} else {
+		defaultEdge.lossGoodToBad = val;
+	}
+}
+
+void NetGraphScene::lossBadToGoodChanged(double val)
+{
+	if (editMode == EditEdge && selectedEdge) {
+		netGraph->edges[selectedEdge->edgeIndex].lossBadToGood = val;
+		selectedEdge->setText(netGraph->edges[selectedEdge->edgeIndex].tooltip());
+	} else {
+		defaultEdge.lossBadToGood = val;
+	}
+}
+
+void NetGraphScene::lossBadChanged(double val)
+{
+	if (editMode == EditEdge && selectedEdge) {
+		netGraph->edges[selectedEdge->edgeIndex].lossBad = val;
+		selectedEdge->setText(netGraph->edges[selectedEdge->edgeIndex].tooltip());
+	} else {
+		defaultEdge.lossBad = val;
+	}
+}
+
 void NetGraphScene::queueLenghtChanged(int val)
 {
 	if (editMode == EditEdge && selectedEdge) {
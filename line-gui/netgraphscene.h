@@ -96,6 +96,10 @@ public slots:
 	void delayChanged(int val);
 	void bandwidthChanged(double val);
 	void lossRateChanged(double val);
+	void lossModelChanged(int val);
+	void lossGoodToBadChanged(double val);
+	void lossBadToGoodChanged(double val);
+	void lossBadChanged(double val);
 	void queueLenghtChanged(int val);
 	void samplingPeriodChanged(quint64 val);
 	void samplingChanged(bool val);
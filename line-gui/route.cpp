@@ -32,15 +32,99 @@ QDataStream& operator<<(QDataStream& s, const Route& r)
 	return s;
 }
 
+void RoutingTable::setRoutes(const QMultiHash<int, int> &routes)
+{
+	destinations.clear();
+	hops.clear();
+	ecmpOffsets.clear();
+	ecmpHops.clear();
+
+	QList<int> keys = routes.uniqueKeys();
+	qSort(keys);
+	destinations.reserve(keys.count());
+	hops.reserve(keys.count());
+	foreach (int dest, keys) {
+		// the most recently inserted next hop comes first, as with QMultiHash::value()
+		QList<int> destHops = routes.values(dest);
+		destinations.append(dest);
+		if (destHops.count() == 1) {
+			hops.append(destHops.first());
+		} else {
+			if (ecmpOffsets.isEmpty())
+				ecmpOffsets.append(0);
+			hops.append(-1 - (ecmpOffsets.count() - 1));
+			foreach (int hop, destHops) {
+				ecmpHops.append(hop);
+			}
+			ecmpOffsets.append(ecmpHops.count());
+		}
+	}
+}
+
+const qint32 *RoutingTable::nextHops(qint32 dest, int &count) const
+{
+	const qint32 *begin = destinations.constData();
+	const qint32 *end = begin + destinations.count();
+	const qint32 *found = qLowerBound(begin, end, dest);
+	if (found == end || *found != dest) {
+		count = 0;
+		return NULL;
+	}
+	int i = found - begin;
+	if (hops[i] >= 0) {
+		count = 1;
+		return hops.constData() + i;
+	}
+	int k = -1 - hops[i];
+	count = ecmpOffsets[k + 1] - ecmpOffsets[k];
+	return ecmpHops.constData() + ecmpOffsets[k];
+}
+
+QList<Route> RoutingTable::toList() const
+{
+	QList<Route> result;
+	for (int i = 0; i < destinations.count(); i++) {
+		int count;
+		const qint32 *destHops = nextHops(destinations[i], count);
+		for (int j = 0; j < count; j++) {
+			result << Route(destinations[i], destHops[j]);
+		}
+	}
+	return result;
+}
+
 QDataStream& operator>>(QDataStream& s, RoutingTable& t)
 {
-	s >> t.routes;
+	quint32 header;
+	s >> header;
+	if (header == ROUTING_TABLE_MAGIC) {
+		s >> t.destinations;
+		s >> t.hops;
+		s >> t.ecmpOffsets;
+		s >> t.ecmpHops;
+		return s;
+	}
+
+	// old format: a QMultiHash<int, Route>, the header is the number of entries
+	QMultiHash<int, int> routes;
+	for (quint32 i = 0; i < header && s.status() == QDataStream::Ok; i++) {
+		qint32 dest;
+		Route r;
+		s >> dest;
+		s >> r;
+		routes.insertMulti(dest, r.nextHop);
+	}
+	t.setRoutes(routes);
 	return s;
 }
 
 QDataStream& operator<<(QDataStream& s, const RoutingTable& t)
 {
-	s << t.routes;
+	s << quint32(ROUTING_TABLE_MAGIC);
+	s << t.destinations;
+	s << t.hops;
+	s << t.ecmpOffsets;
+	s << t.ecmpHops;
 	return s;
 }
 
@@ -39,10 +39,37 @@ public:
 	inline bool operator!=(const Route &other) const { return !(*this == other); }
 };
 
+// Written at the start of a serialized RoutingTable. The old format started with the number of
+// entries of a QMultiHash<int, Route>, which is never this large.
+#define ROUTING_TABLE_MAGIC 0xFFFFFFFEU
+
+// Routing table of a node, as arrays sorted by destination: destinations[i] is reached via hops[i].
+// For load balanced (equal-cost) destinations, hops[i] is -1 - k, and the next hops are
+// ecmpHops[ecmpOffsets[k]] ... ecmpHops[ecmpOffsets[k + 1] - 1].
+// Lookups do not allocate memory.
 class RoutingTable {
 public:
-	// Maps a destionation (node id) to one or more routes (by next hop) to that destination
-	QMultiHash<int, Route> routes;
+	// Replaces the routes; routes maps a destination (node id) to its next hops
+	void setRoutes(const QMultiHash<int, int> &routes);
+
+	// Returns the next hops to dest, and sets count to their number (0 if there is no route).
+	// The pointer is valid until the table is changed.
+	const qint32 *nextHops(qint32 dest, int &count) const;
+
+	// Returns the first next hop to dest, or -1 if there is no route
+	qint32 nextHop(qint32 dest) const {
+		int count;
+		const qint32 *result = nextHops(dest, count);
+		return count > 0 ? result[0] : -1;
+	}
+
+	// All the routes, for display
+	QList<Route> toList() const;
+
+	QVector<qint32> destinations;
+	QVector<qint32> hops;
+	QVector<qint32> ecmpOffsets;
+	QVector<qint32> ecmpHops;
 };
 
 inline QDebug operator<<(QDebug debug, const Route &route)
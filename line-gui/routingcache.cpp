@@ -0,0 +1,201 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "routingcache.h"
+#include "netgraph.h"
+
+// the last entry that was loaded or stored, so that repeated lookups do not read the file again
+static QByteArray lastFingerprint;
+static RoutingCacheEntry lastEntry;
+static QMutex cacheMutex;
+
+QDataStream& operator>>(QDataStream& s, RoutingCacheEntry& e)
+{
+	s >> e.routes;
+	s >> e.pathEdgeSets;
+	s >> e.pathEdgeLists;
+	return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const RoutingCacheEntry& e)
+{
+	s << e.routes;
+	s << e.pathEdgeSets;
+	s << e.pathEdgeLists;
+	return s;
+}
+
+QByteArray RoutingCache::fingerprint(NetGraph &g)
+{
+	QByteArray inputs;
+	QDataStream s(&inputs, QIODevice::WriteOnly);
+	s.setVersion(QDataStream::Qt_4_0);
+
+	s << qint32(ROUTING_CACHE_VERSION);
+	s << qint32(g.nodes.count());
+	foreach (NetGraphNode n, g.nodes) {
+		s << qint32(n.index) << qint32(n.ASNumber) << qint32(n.nodeType);
+	}
+	s << qint32(g.edges.count());
+	foreach (NetGraphEdge e, g.edges) {
+		s << e.index << e.source << e.dest << e.metric();
+	}
+	s << qint32(g.connections.count());
+	foreach (NetGraphConnection c, g.connections) {
+		s << qint32(c.source) << qint32(c.dest);
+	}
+
+	return QCryptographicHash::hash(inputs, QCryptographicHash::Sha1).toHex();
+}
+
+QString RoutingCache::fileName(const QByteArray &fingerprint)
+{
+	return QString("%1/%2.routes").arg(ROUTING_CACHE_DIR).arg(QString(fingerprint));
+}
+
+bool RoutingCache::lookup(const QByteArray &fingerprint, RoutingCacheEntry &entry)
+{
+	QMutexLocker locker(&cacheMutex);
+	if (fingerprint == lastFingerprint) {
+		entry = lastEntry;
+		return true;
+	}
+
+	QFile file(fileName(fingerprint));
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_4_0);
+	in >> entry;
+	if (in.status() != QDataStream::Ok) {
+		qDebug() << __FILE__ << __LINE__ << "Corrupt routing cache file:" << file.fileName();
+		return false;
+	}
+
+	lastFingerprint = fingerprint;
+	lastEntry = entry;
+	return true;
+}
+
+void RoutingCache::setPath(NetGraph &g, NetGraphPath &p, const RoutingCacheEntry &entry)
+{
+	QPair<qint32, qint32> key(p.source, p.dest);
+	p.edgeSet.clear();
+	p.edgeList.clear();
+	if (!entry.pathEdgeSets.contains(key)) {
+		p.retrace(g);
+		return;
+	}
+	foreach (qint32 e, entry.pathEdgeSets[key]) {
+		p.edgeSet.insert(g.edges[e]);
+	}
+	foreach (qint32 e, entry.pathEdgeLists[key]) {
+		p.edgeList << g.edges[e];
+	}
+}
+
+bool RoutingCache::load(NetGraph &g)
+{
+	RoutingCacheEntry entry;
+	if (!lookup(fingerprint(g), entry))
+		return false;
+	if (entry.routes.count() != g.nodes.count())
+		return false;
+
+	for (int i = 0; i < g.nodes.count(); i++) {
+		g.nodes[i].routes = entry.routes[i];
+	}
+	for (int i = 0; i < g.paths.count(); i++) {
+		setPath(g, g.paths[i], entry);
+	}
+	return true;
+}
+
+void RoutingCache::store(NetGraph &g)
+{
+	QByteArray key = fingerprint(g);
+
+	RoutingCacheEntry entry;
+	foreach (NetGraphNode n, g.nodes) {
+		entry.routes << n.routes;
+	}
+	foreach (NetGraphConnection c, g.connections) {
+		if (c.source == c.dest)
+			continue;
+		QList<QPair<qint32, qint32> > directions;
+		directions << QPair<qint32, qint32>(c.source, c.dest) << QPair<qint32, qint32>(c.dest, c.source);
+		for (int i = 0; i < directions.count(); i++) {
+			if (entry.pathEdgeSets.contains(directions[i]))
+				continue;
+			NetGraphPath p(g, directions[i].first, directions[i].second);
+			QList<qint32> edgeSet;
+			foreach (NetGraphEdge e, p.edgeSet) {
+				edgeSet << e.index;
+			}
+			QList<qint32> edgeList;
+			foreach (NetGraphEdge e, p.edgeList) {
+				edgeList << e.index;
+			}
+			entry.pathEdgeSets.insert(directions[i], edgeSet);
+			entry.pathEdgeLists.insert(directions[i], edgeList);
+		}
+	}
+
+	for (int i = 0; i < g.paths.count(); i++) {
+		setPath(g, g.paths[i], entry);
+	}
+
+	QMutexLocker locker(&cacheMutex);
+	lastFingerprint = key;
+	lastEntry = entry;
+
+	// write to a temporary file first, so that readers never see a partial entry
+	if (!QDir().mkpath(ROUTING_CACHE_DIR)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to create directory:" << ROUTING_CACHE_DIR;
+		return;
+	}
+	QFile file(fileName(key) + ".tmp");
+	if (!file.open(QIODevice::WriteOnly)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << file.fileName();
+		return;
+	}
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << entry;
+	file.close();
+	QFile::remove(fileName(key));
+	if (!file.rename(fileName(key))) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to rename file:" << file.fileName();
+		file.remove();
+	}
+}
+
+void RoutingCache::tracePath(NetGraph &g, NetGraphPath &p, QByteArray &fingerprint)
+{
+	if (fingerprint.isEmpty()) {
+		fingerprint = RoutingCache::fingerprint(g);
+	}
+	RoutingCacheEntry entry;
+	if (lookup(fingerprint, entry)) {
+		setPath(g, p, entry);
+	} else {
+		p.edgeSet.clear();
+		p.edgeList.clear();
+		p.retrace(g);
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef ROUTINGCACHE_H
+#define ROUTINGCACHE_H
+
+#include <QtCore>
+
+#include "route.h"
+
+class NetGraph;
+class NetGraphPath;
+
+// Bump this when the routing algorithm or the cache format change; old entries are then ignored
+#define ROUTING_CACHE_VERSION 1
+// Directory of the cache files, relative to the current directory (the topologies)
+#define ROUTING_CACHE_DIR "routing-cache"
+
+// The routing tables and the paths computed for a topology.
+// The paths are stored as edge indices, so that they pick up the current edge attributes.
+class RoutingCacheEntry
+{
+public:
+	// node index -> routing table
+	QList<RoutingTable> routes;
+	// (source, dest) -> the edges of the path
+	QHash<QPair<qint32, qint32>, QList<qint32> > pathEdgeSets;
+	// (source, dest) -> the edges of the path in order; empty if the path is load balanced
+	QHash<QPair<qint32, qint32>, QList<qint32> > pathEdgeLists;
+};
+
+QDataStream& operator>>(QDataStream& s, RoutingCacheEntry& e);
+QDataStream& operator<<(QDataStream& s, const RoutingCacheEntry& e);
+
+// On-disk cache of the routing results, keyed by a hash of the inputs of the routing computation:
+// the nodes with their AS numbers and types, the edges with their metrics, and the connections.
+// Changing anything else (delays, loss, queue lengths...) keeps the same key.
+class RoutingCache
+{
+public:
+	// Hash of the routing inputs of g
+	static QByteArray fingerprint(NetGraph &g);
+
+	// Sets the routing tables and the paths of g from the cache. Returns false if g is not cached.
+	static bool load(NetGraph &g);
+
+	// Stores the routing tables of g and the paths of its connections, then updates the paths of g.
+	static void store(NetGraph &g);
+
+	// Sets the edges of p from the cache, or retraces it from the routing tables if g is not cached.
+	// fingerprint is computed on first use, so it can be shared by several calls.
+	static void tracePath(NetGraph &g, NetGraphPath &p, QByteArray &fingerprint);
+
+private:
+	static bool lookup(const QByteArray &fingerprint, RoutingCacheEntry &entry);
+	static void setPath(NetGraph &g, NetGraphPath &p, const RoutingCacheEntry &entry);
+	static QString fileName(const QByteArray &fingerprint);
+};
+
+#endif // ROUTINGCACHE_H
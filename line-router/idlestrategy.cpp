@@ -0,0 +1,123 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "idlestrategy.h"
+#include "pconsumer.h"
+#include "latencyhistogram.h"
+
+#include <sched.h>
+#include <time.h>
+
+#define IDLE_CALIBRATION_SLEEPS 200
+#define IDLE_CALIBRATION_PERIOD (50 * 1000)
+
+int consumerIdleStrategy = IDLE_SPIN;
+int schedulerIdleStrategy = IDLE_YIELD;
+int senderIdleStrategy = IDLE_SPIN;
+quint64 idleMaxSleep = IDLE_MAX_SLEEP_DEFAULT;
+quint64 idleSleepEarly = 0;
+
+int idleStrategyFromString(QString name)
+{
+	if (name == "spin")
+		return IDLE_SPIN;
+	if (name == "yield")
+		return IDLE_YIELD;
+	if (name == "sleep")
+		return IDLE_SLEEP;
+	return -1;
+}
+
+const char *idleStrategyName(int strategy)
+{
+	switch (strategy) {
+		case IDLE_SPIN: return "spin";
+		case IDLE_YIELD: return "yield";
+		case IDLE_SLEEP: return "sleep";
+	}
+	return "unknown";
+}
+
+static inline void sleepUntil(quint64 ts)
+{
+	struct timespec t;
+	t.tv_sec = ts / SEC_TO_NSEC;
+	t.tv_nsec = ts % SEC_TO_NSEC;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+}
+
+void calibrateIdleSleep()
+{
+	QList<quint64> overshoot;
+	for (int i = 0; i < IDLE_CALIBRATION_SLEEPS; i++) {
+		quint64 target = get_current_time() + IDLE_CALIBRATION_PERIOD;
+		sleepUntil(target);
+		quint64 ts = get_current_time();
+		overshoot << (ts > target ? ts - target : 0);
+	}
+	qSort(overshoot);
+	// wake up early enough for 90% of the sleeps; the rest of the time is spent spinning
+	idleSleepEarly = overshoot[overshoot.count() * 9 / 10];
+	printf("Idle: sleep wake-up delay median %llu ns, max %llu ns; sleeping threads wake up %llu ns early\n",
+		   overshoot[overshoot.count() / 2], overshoot.last(), idleSleepEarly);
+}
+
+IdleStrategy::IdleStrategy(int strategy, int latencyThread)
+{
+	this->strategy = strategy;
+	this->latencyThread = latencyThread;
+	idleSince = 0;
+	yields = 0;
+	sleeps = 0;
+}
+
+void IdleStrategy::idleSlow(quint64 deadline)
+{
+	quint64 ts_now = get_current_time();
+	if (idleSince == 0) {
+		idleSince = ts_now;
+	}
+	if (ts_now - idleSince < IDLE_SPIN_TIME || deadline <= ts_now)
+		return;
+
+	if (strategy == IDLE_YIELD) {
+		if (deadline - ts_now > IDLE_YIELD_GUARD) {
+			sched_yield();
+			yields++;
+			recordLatency(latencyThread, LATENCY_STAGE_WAKEUP, get_current_time() - ts_now);
+		}
+		return;
+	}
+
+	// IDLE_SLEEP
+	quint64 wakeup = qMin(deadline, ts_now + idleMaxSleep);
+	if (wakeup < ts_now + idleSleepEarly + IDLE_MIN_SLEEP)
+		return;
+	sleepUntil(wakeup - idleSleepEarly);
+	sleeps++;
+	quint64 target;
+	if (wakeup == deadline) {
+		// spin for the rest of the time, so that the event is processed on time
+		target = deadline;
+		while ((ts_now = get_current_time()) < deadline) {}
+	} else {
+		target = wakeup - idleSleepEarly;
+		ts_now = get_current_time();
+	}
+	recordLatency(latencyThread, LATENCY_STAGE_WAKEUP, ts_now > target ? ts_now - target : 0);
+}
@@ -0,0 +1,87 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef IDLESTRATEGY_H
+#define IDLESTRATEGY_H
+
+#include <QtCore>
+
+// What a thread does when a loop iteration finds no work
+#define IDLE_SPIN  0 // keep polling (lowest latency, one core at 100%)
+#define IDLE_YIELD 1 // spin for a while, then yield the core to other threads
+#define IDLE_SLEEP 2 // spin for a while, then sleep until the next deadline (or idleMaxSleep)
+
+// Time spent spinning before yielding or sleeping (ns)
+#define IDLE_SPIN_TIME (20 * 1000)
+// The scheduler does not yield if its next event is closer than this (ns); a yield can last a
+// whole scheduler quantum
+#define IDLE_YIELD_GUARD (10 * 1000 * 1000)
+// Sleeps shorter than this are replaced by spinning (ns)
+#define IDLE_MIN_SLEEP (5 * 1000)
+// Default limit of a sleep when there is no deadline; new packets wait at most this long (ns)
+#define IDLE_MAX_SLEEP_DEFAULT (100 * 1000)
+
+// Idle policies, chosen on the command line
+extern int consumerIdleStrategy;
+extern int schedulerIdleStrategy;
+extern int senderIdleStrategy;
+extern quint64 idleMaxSleep;
+// How much earlier than the deadline a sleeping thread asks to be woken up (ns), see calibrateIdleSleep()
+extern quint64 idleSleepEarly;
+
+// Returns IDLE_xxx, or -1 if name is not a valid policy
+int idleStrategyFromString(QString name);
+const char *idleStrategyName(int strategy);
+
+// Measures how late clock_nanosleep() wakes up on this machine and sets idleSleepEarly.
+// Only needed if a thread uses IDLE_SLEEP.
+void calibrateIdleSleep();
+
+// Idle state of one thread. The wake-up error (how late the thread resumes after the time it
+// wanted to wake up at) is recorded in the LATENCY_STAGE_WAKEUP histogram of the thread.
+// A yielding thread wants to resume at once, so its error is the time spent in sched_yield().
+class IdleStrategy {
+public:
+	// latencyThread: LATENCY_THREAD_xxx of the owner thread
+	IdleStrategy(int strategy, int latencyThread);
+
+	// Called after a loop iteration that did some work
+	inline void busy() {
+		idleSince = 0;
+	}
+
+	// Called after a loop iteration that found no work. deadline is the time of the next known
+	// event (ns, ULLONG_MAX if none); more work may arrive earlier from the other threads.
+	inline void idle(quint64 deadline = ULLONG_MAX) {
+		if (strategy == IDLE_SPIN)
+			return;
+		idleSlow(deadline);
+	}
+
+	int strategy;
+	int latencyThread;
+	quint64 idleSince;
+	// statistics
+	quint64 yields;
+	quint64 sleeps;
+
+private:
+	void idleSlow(quint64 deadline);
+};
+
+#endif // IDLESTRATEGY_H
@@ -0,0 +1,124 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "latencyhistogram.h"
+
+LatencyHistogram latencyHistograms[LATENCY_THREADS][LATENCY_STAGES];
+
+static const char *latencyStageNames[LATENCY_STAGES] = {
+	"rx",
+	"queueing",
+	"lateness",
+	"tx",
+	"error",
+	"wakeup"
+};
+
+void LatencyHistogram::reset()
+{
+	count = 0;
+	sum = 0;
+	min = ULLONG_MAX;
+	max = 0;
+	memset(counts, 0, sizeof(counts));
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+	for (int i = 0; i < LATENCY_BUCKETS; i++) {
+		counts[i] += other.counts[i];
+	}
+	count += other.count;
+	sum += other.sum;
+	min = qMin(min, other.min);
+	max = qMax(max, other.max);
+}
+
+quint64 LatencyHistogram::quantile(double q) const
+{
+	if (count == 0)
+		return 0;
+	quint64 rank = qMax((quint64)1, (quint64)ceil(q * count));
+	quint64 seen = 0;
+	for (int i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= rank)
+			return qMin(bucketHigh(i), max);
+	}
+	return max;
+}
+
+quint64 LatencyHistogram::bucketLow(int index)
+{
+	if (index < LATENCY_SUB_COUNT)
+		return index;
+	int shift = (index >> LATENCY_SUB_BITS) - 1;
+	quint64 mantissa = (index & (LATENCY_SUB_COUNT - 1)) | LATENCY_SUB_COUNT;
+	return mantissa << shift;
+}
+
+quint64 LatencyHistogram::bucketHigh(int index)
+{
+	if (index + 1 >= LATENCY_BUCKETS)
+		return ULLONG_MAX;
+	return bucketLow(index + 1) - 1;
+}
+
+// File format (text, one record per line):
+//     stage <name> count <n> sum <ns> min <ns> max <ns>
+//     bucket <name> <low ns> <high ns> <count>    (only non-empty buckets)
+bool saveLatencyHistograms(QString fileName)
+{
+	LatencyHistogram *total = new LatencyHistogram[LATENCY_STAGES];
+	for (int thread = 0; thread < LATENCY_THREADS; thread++) {
+		for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+			total[stage].merge(latencyHistograms[thread][stage]);
+		}
+	}
+
+	for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+		const LatencyHistogram &h = total[stage];
+		if (h.count == 0)
+			continue;
+		printf("Latency %-8s: %llu samples, mean %.3f us, p50 %.3f us, p99 %.3f us, p99.9 %.3f us, max %.3f us\n",
+			   latencyStageNames[stage], h.count, h.sum * 1.0e-3 / h.count,
+			   h.quantile(0.5) * 1.0e-3, h.quantile(0.99) * 1.0e-3, h.quantile(0.999) * 1.0e-3, h.max * 1.0e-3);
+	}
+
+	QFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+		fprintf(stderr, "Could not write %s\n", fileName.toLatin1().constData());
+		delete [] total;
+		return false;
+	}
+	QTextStream out(&file);
+	out << "# LINE latency histograms (ns), " << LATENCY_SUB_COUNT << " buckets per power of 2\n";
+	for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+		const LatencyHistogram &h = total[stage];
+		out << "stage " << latencyStageNames[stage] << " count " << h.count << " sum " << h.sum
+			<< " min " << (h.count ? h.min : 0) << " max " << h.max << "\n";
+		for (int i = 0; i < LATENCY_BUCKETS; i++) {
+			if (h.counts[i] == 0)
+				continue;
+			out << "bucket " << latencyStageNames[stage] << " " << LatencyHistogram::bucketLow(i) << " "
+				<< LatencyHistogram::bucketHigh(i) << " " << h.counts[i] << "\n";
+		}
+	}
+	delete [] total;
+	return true;
+}
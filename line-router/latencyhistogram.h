@@ -0,0 +1,99 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QtCore>
+#include "pscheduler.h"
+
+// Log-linear histogram of durations in ns (as in HdrHistogram): values below
+// 2^LATENCY_SUB_BITS have their own bucket, larger values are grouped by their most
+// significant bit, and each group is split into 2^LATENCY_SUB_BITS linear buckets.
+// The relative error of a bucket is at most 2^-LATENCY_SUB_BITS (about 3%).
+#define LATENCY_SUB_BITS   5
+#define LATENCY_SUB_COUNT  (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS    ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+// Pipeline stages
+#define LATENCY_STAGE_RX        0 // driver timestamp -> consumer (only with driver timestamps from the same clock)
+#define LATENCY_STAGE_QUEUEING  1 // consumer -> scheduler
+#define LATENCY_STAGE_LATENESS  2 // scheduler: event processed after its deadline
+#define LATENCY_STAGE_TX        3 // scheduler -> sent
+#define LATENCY_STAGE_ERROR     4 // |actual delay - theoretical delay| of each packet
+#define LATENCY_STAGE_WAKEUP    5 // idle threads: how late they resume after sleeping (see IdleStrategy)
+#define LATENCY_STAGES          6
+
+// Threads that record latencies; each one has its own histograms
+#define LATENCY_THREAD_CONSUMER(channel) (channel)
+#define LATENCY_THREAD_SENDER            MAX_RX_CHANNELS
+#define LATENCY_THREAD_SCHEDULER(shard)  (MAX_RX_CHANNELS + 1 + (shard))
+#define LATENCY_THREADS                  (MAX_RX_CHANNELS + 1 + MAX_SCHEDULER_SHARDS)
+
+class LatencyHistogram {
+public:
+	LatencyHistogram() {
+		reset();
+	}
+
+	void reset();
+
+	inline void record(quint64 value) {
+		counts[bucketIndex(value)]++;
+		count++;
+		sum += value;
+		min = qMin(min, value);
+		max = qMax(max, value);
+	}
+
+	void merge(const LatencyHistogram &other);
+
+	// Upper bound of the bucket that holds the value at quantile q (0..1), 0 if empty
+	quint64 quantile(double q) const;
+
+	static inline int bucketIndex(quint64 value) {
+		if (value < LATENCY_SUB_COUNT)
+			return value;
+		int shift = (63 - __builtin_clzll(value)) - LATENCY_SUB_BITS;
+		return ((shift + 1) << LATENCY_SUB_BITS) + ((value >> shift) & (LATENCY_SUB_COUNT - 1));
+	}
+
+	// Range of values counted in a bucket
+	static quint64 bucketLow(int index);
+	static quint64 bucketHigh(int index);
+
+	quint64 count;
+	quint64 sum;
+	quint64 min;
+	quint64 max;
+	quint64 counts[LATENCY_BUCKETS];
+} __attribute__((aligned(64)));
+
+// latencyHistograms[thread][stage]; each thread only writes its own histograms
+extern LatencyHistogram latencyHistograms[LATENCY_THREADS][LATENCY_STAGES];
+
+inline void recordLatency(int thread, int stage, quint64 value)
+{
+	latencyHistograms[thread][stage].record(value);
+}
+
+// Merges the histograms of all the threads, prints a summary and writes them to fileName.
+// Called after all the threads have exited.
+bool saveLatencyHistograms(QString fileName);
+
+#endif // LATENCYHISTOGRAM_H
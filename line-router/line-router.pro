@@ -23,7 +23,7 @@ INSTALLS += bundle
 INCLUDEPATH += ../util/
 #INCLUDEPATH += ../PF_RING-4.6.5/userland/c++ ../PF_RING-4.6.5/kernel ../PF_RING-4.6.5/kernel/plugins ../PF_RING-4.6.5/userland/libpcap-1.1.1-ring ../PF_RING-4.6.5/userland/lib
 #QMAKE_LIBS += ../PF_RING-4.6.5/userland/c++/libpfring_cpp.a ../PF_RING-4.6.5/userland/lib/libpfring.a ../PF_RING-4.6.5/userland/libpcap-1.1.1-ring/libpcap.a
-QMAKE_LIBS += /usr/local/lib/libpfring.a /usr/local/lib/libpcap.a -lunwind -lpcap
+QMAKE_LIBS += /usr/local/lib/libpfring.a /usr/local/lib/libpcap.a -lunwind -lpcap -lrt
 
 
   QMAKE_CFLAGS += -std=gnu99 -fno-strict-overflow -fno-strict-aliasing -Wno-unused-local-typedefs -gdwarf-2
@@ -53,10 +53,16 @@ QMAKE_LIBS += /usr/local/lib/libpfring.a /usr/local/lib/libpcap.a -lunwind -lpca
 SOURCES += main.cpp \
     pfcount.cpp \
     qpairingheap.cpp \
+    timingwheel.cpp \
     pconsumer.cpp \
     pscheduler.cpp \
     psender.cpp \
-    bitarray.cpp \
+    ../util/bitarray.cpp \
+    packetpool.cpp \
+    pcapbackend.cpp \
+    timelinewriter.cpp \
+    latencyhistogram.cpp \
+    idlestrategy.cpp \
     ../line-gui/netgraphpath.cpp \
     ../line-gui/netgraphnode.cpp \
     ../line-gui/netgraphedge.cpp \
@@ -64,6 +70,8 @@ SOURCES += main.cpp \
     ../line-gui/netgraphas.cpp \
     ../line-gui/netgraph.cpp \
     ../util/util.cpp \
+    ../util/resultsfile.cpp \
+    ../util/livestats.cpp \
     ../line-gui/route.cpp \
     ../tomo/tomodata.cpp
 
@@ -74,11 +82,18 @@ OTHER_FILES += \
 
 HEADERS += \
     qpairingheap.h \
+    timingwheel.h \
     pscheduler.h \
     pconsumer.h \
-    spinlockedqueue.h \
+    spscring.h \
+    packetpool.h \
+    pcapbackend.h \
+    timelinewriter.h \
+    latencyhistogram.h \
+    idlestrategy.h \
+    prng.h \
     psender.h \
-    bitarray.h \
+    ../util/bitarray.h \
     ../line-gui/netgraphpath.h \
     ../line-gui/netgraphnode.h \
     ../line-gui/netgraphedge.h \
@@ -86,6 +101,9 @@ HEADERS += \
     ../line-gui/netgraphas.h \
     ../line-gui/netgraph.h \
     ../util/util.h \
+    ../util/resultsfile.h \
+    ../util/livestats.h \
+    ../util/eventlog.h \
     ../util/debug.h \
     ../line-gui/route.h \
     ../tomo/tomodata.h
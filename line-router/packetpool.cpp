@@ -0,0 +1,198 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "packetpool.h"
+#include "pconsumer.h"
+
+#include <sys/mman.h>
+#include <new>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+int packetPoolSize = PACKET_POOL_DEFAULT_SIZE;
+
+PacketPool *PacketPool::pools[PACKET_POOL_MAX_POOLS];
+int PacketPool::poolCount = 0;
+// serializes the registration of pools initialized by several threads at once
+static QMutex registryMutex;
+
+// packets are cache line aligned
+static inline size_t packetStride()
+{
+	return (sizeof(Packet) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+}
+
+PacketPool::PacketPool()
+{
+	memory = NULL;
+	memorySize = 0;
+	hugePages = false;
+	packetCount = 0;
+	freeList = NULL;
+	freeCount = 0;
+	exhausted = 0;
+	returnThreads = 0;
+	for (int i = 0; i < PACKET_POOL_THREADS; i++) {
+		caches[i].count = 0;
+	}
+}
+
+PacketPool::~PacketPool()
+{
+	if (memory) {
+		for (int i = 0; i < packetCount; i++) {
+			Packet *p = (Packet*)((quint8*)memory + i * packetStride());
+			p->~Packet();
+		}
+		munmap(memory, memorySize);
+	}
+	delete [] freeList;
+}
+
+bool PacketPool::init(int count)
+{
+	Q_ASSERT(!memory);
+	if (count <= 0 || count > PACKET_POOL_MAX_SIZE) {
+		fprintf(stderr, "Invalid packet pool size %d (must be between 1 and %d)\n", count, PACKET_POOL_MAX_SIZE);
+		return false;
+	}
+	QMutexLocker registryLocker(&registryMutex);
+	if (__atomic_load_n(&poolCount, __ATOMIC_ACQUIRE) >= PACKET_POOL_MAX_POOLS) {
+		fprintf(stderr, "Too many packet pools (max %d)\n", PACKET_POOL_MAX_POOLS);
+		return false;
+	}
+
+	memorySize = count * packetStride();
+	memorySize = (memorySize + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+
+	// try explicit huge pages first, then fall back to normal pages with transparent huge pages
+	memory = mmap(NULL, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (memory != MAP_FAILED) {
+		hugePages = true;
+	} else {
+		memory = mmap(NULL, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) {
+			memory = NULL;
+			perror("Could not allocate the packet pool");
+			return false;
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(memory, memorySize, MADV_HUGEPAGE);
+#endif
+	}
+	mlock(memory, memorySize);
+
+	returnThreads = PACKET_POOL_THREAD_SCHEDULER(schedulerShardCount);
+	for (int thread = 0; thread < returnThreads; thread++) {
+		if (!returned[thread].init(count)) {
+			fprintf(stderr, "Could not allocate the packet pool return queues\n");
+			return false;
+		}
+	}
+
+	// construct the packets; this touches the memory from the owner thread
+	packetCount = count;
+	freeList = new Packet*[count];
+	freeCount = 0;
+	for (int i = 0; i < count; i++) {
+		Packet *p = new ((quint8*)memory + i * packetStride()) Packet();
+		p->pool = this;
+		freeList[freeCount++] = p;
+	}
+
+	int index = __atomic_load_n(&poolCount, __ATOMIC_ACQUIRE);
+	pools[index] = this;
+	__atomic_store_n(&poolCount, index + 1, __ATOMIC_RELEASE);
+
+	printf("Packet pool: %d packets, %llu MB, %s\n", count, (quint64)memorySize / (1024 * 1024),
+		   hugePages ? "huge pages" : "normal pages");
+	return true;
+}
+
+void PacketPool::collectReturned()
+{
+	for (int thread = 0; thread < returnThreads; thread++) {
+		freeCount += returned[thread].dequeueBatch(freeList + freeCount, packetCount - freeCount);
+	}
+}
+
+Packet *PacketPool::alloc()
+{
+	if (freeCount == 0) {
+		collectReturned();
+		if (freeCount == 0) {
+			exhausted++;
+			return NULL;
+		}
+	}
+	Packet *p = freeList[--freeCount];
+	p->reset();
+	return p;
+}
+
+void PacketPool::free(Packet *p)
+{
+	Q_ASSERT(p->pool == this);
+	freeList[freeCount++] = p;
+}
+
+int PacketPool::available()
+{
+	collectReturned();
+	return freeCount;
+}
+
+void PacketPool::cache(Packet *p, int thread)
+{
+	ThreadCache &c = caches[thread];
+	c.packets[c.count++] = p;
+	if (c.count == PACKET_POOL_CACHE_SIZE) {
+		flush(thread);
+	}
+}
+
+void PacketPool::release(Packet *p, int thread)
+{
+	Q_ASSERT(p->pool);
+	Q_ASSERT(thread >= 0 && thread < p->pool->returnThreads);
+	p->pool->cache(p, thread);
+}
+
+void PacketPool::flush(int thread)
+{
+	ThreadCache &c = caches[thread];
+	if (c.count == 0)
+		return;
+	// the return queue can hold the entire pool, so this never fails
+	int n = returned[thread].enqueueBatch(c.packets, c.count);
+	Q_ASSERT(n == c.count);
+	Q_UNUSED(n);
+	c.count = 0;
+}
+
+void PacketPool::flushAll(int thread)
+{
+	int count = __atomic_load_n(&poolCount, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < count; i++) {
+		pools[i]->flush(thread);
+	}
+}
@@ -0,0 +1,124 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include <QtCore>
+#include "spscring.h"
+#include "pscheduler.h"
+
+class Packet;
+
+#define PACKET_POOL_DEFAULT_SIZE 65536
+#define PACKET_POOL_MAX_SIZE     262144
+
+// Threads that return packets to the pool (each one has its own return path):
+// the sender and the scheduler shards
+#define PACKET_POOL_THREAD_SENDER           0
+#define PACKET_POOL_THREAD_SCHEDULER(shard) (1 + (shard))
+#define PACKET_POOL_THREADS                 (1 + MAX_SCHEDULER_SHARDS)
+
+// Size of the per-thread cache of freed packets
+#define PACKET_POOL_CACHE_SIZE 64
+
+// Maximum number of pools (one per packet producer thread)
+#define PACKET_POOL_MAX_POOLS 16
+
+// Fixed-size pool of preallocated packets.
+// The pool is owned by the thread that calls init() and alloc(); the memory is
+// touched by that thread, so with the default first-touch policy it is local to
+// the owner's NUMA node. Other threads give packets back with release(); freed
+// packets are batched in a per-thread cache and then returned to the owner over
+// a lock-free queue. There is no fallback to malloc: when the pool is empty,
+// alloc() returns NULL and the exhaustion counter is incremented.
+class PacketPool {
+public:
+	PacketPool();
+	~PacketPool();
+
+	// Allocates count packets, and the return queues of the sender and of the scheduler shards.
+	// Must be called by the owner thread, after the shards are set up.
+	bool init(int count);
+
+	// Owner thread only. Returns NULL if the pool is exhausted.
+	Packet *alloc();
+
+	// Owner thread only. Puts back a packet obtained from alloc() that was not used.
+	void free(Packet *p);
+
+	// Owner thread only. Returns the number of free packets, including those given back by the other threads.
+	int available();
+
+	// Returns a packet to its pool. thread is one of PACKET_POOL_THREAD_xxx and
+	// identifies the calling thread.
+	static void release(Packet *p, int thread);
+
+	// Returns the packets cached by thread to the owner.
+	void flush(int thread);
+
+	// Flushes the caches of thread for all pools.
+	static void flushAll(int thread);
+
+	int size() const {
+		return packetCount;
+	}
+
+	quint64 getExhaustedCount() const {
+		return exhausted;
+	}
+
+	bool isHugePageBacked() const {
+		return hugePages;
+	}
+
+private:
+	void cache(Packet *p, int thread);
+	void collectReturned();
+
+	// memory
+	void *memory;
+	size_t memorySize;
+	bool hugePages;
+	int packetCount;
+
+	// owner
+	Packet **freeList;
+	int freeCount;
+	quint64 exhausted;
+
+	// per-thread caches, written only by the corresponding thread
+	struct ThreadCache {
+		Packet *packets[PACKET_POOL_CACHE_SIZE];
+		int count;
+	} __attribute__((aligned(CACHE_LINE_SIZE)));
+	ThreadCache caches[PACKET_POOL_THREADS];
+
+	// return path from each thread to the owner, sized to hold the entire pool;
+	// only the first returnThreads are allocated
+	SpscHeapRing<Packet*> returned[PACKET_POOL_THREADS];
+	int returnThreads;
+
+	// registry used by flushAll(); entries are only appended
+	static PacketPool *pools[PACKET_POOL_MAX_POOLS];
+	static int poolCount;
+};
+
+extern int packetPoolSize;
+
+#endif // PACKETPOOL_H
@@ -0,0 +1,260 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "pcapbackend.h"
+#include "pconsumer.h"
+#include "idlestrategy.h"
+#include "latencyhistogram.h"
+
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+QString pcapInputFile;
+QString pcapOutputFile;
+double pcapTimeScale = 1.0;
+
+#define ETHERTYPE_VLAN_TAG 0x8100
+#define VLAN_TAG_SIZE      4
+
+// Fills in the offsets and addresses of a packet read from the file.
+// Returns the IP version, or 0 if the frame is not IP.
+static int parseFrame(Packet *p)
+{
+	quint8 *frame = p->buffer;
+	int offset = sizeof(struct ether_header);
+	if (p->length < offset)
+		return 0;
+	quint16 etherType = ntohs(((struct ether_header*)frame)->ether_type);
+
+	memset(&p->offsets, 0, sizeof(p->offsets));
+	p->offsets.eth_offset = 0;
+	if (etherType == ETHERTYPE_VLAN_TAG) {
+		if (p->length < offset + VLAN_TAG_SIZE)
+			return 0;
+		// like PF_RING: the VLAN TCI, right after the 0x8100 ether type
+		p->offsets.vlan_offset = offset;
+		etherType = ntohs(*(quint16*)(frame + offset + 2));
+		offset += VLAN_TAG_SIZE;
+	}
+	if (etherType != ETHERTYPE_IP || p->length < offset + (int)sizeof(struct iphdr))
+		return 0;
+
+	struct iphdr *ip = (struct iphdr *)(frame + offset);
+	p->offsets.l3_offset = offset;
+	p->offsets.l4_offset = offset + ip->ihl * 4;
+	p->src_ip = ip->saddr;
+	p->dst_ip = ip->daddr;
+	p->l4_protocol = ip->protocol;
+	return ip->version;
+}
+
+void* pcap_consumer_thread(void* ) {
+	// a capture file is read on a single receive channel
+	PacketPool &packetPool = packetPools[0];
+	u_int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
+	u_long core_id = CORE_CONSUMER % numCPU;
+
+	if (numCPU > 1) {
+		if (bind2core(core_id) == 0) {
+			printf("Set thread consumer affinity to core %lu/%u\n", core_id, numCPU);
+		} else {
+			printf("Failed to set thread consumer affinity to core %lu/%u\n", core_id, numCPU);
+		}
+	}
+
+	char errbuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pcap = pcap_open_offline(pcapInputFile.toLatin1().constData(), errbuf);
+	if (!pcap) {
+		fprintf(stderr, "Cannot open %s: %s\n", pcapInputFile.toLatin1().constData(), errbuf);
+		exit(EXIT_FAILURE);
+	}
+	if (pcap_datalink(pcap) != DLT_EN10MB) {
+		fprintf(stderr, "Cannot read %s: only Ethernet captures are supported\n", pcapInputFile.toLatin1().constData());
+		exit(EXIT_FAILURE);
+	}
+
+	if (!packetPool.init(packetPoolSize)) {
+		fprintf(stderr, "Cannot allocate packets, exiting\n");
+		exit(EXIT_FAILURE);
+	}
+
+	quint64 framesRead = 0;
+	quint64 packetsReceived = 0;
+	quint64 packetsLost = 0;
+	quint64 bytesReceived = 0;
+	quint64 tsFirstFrame = 0;
+	quint64 tsStart = 0;
+
+	int burstSize = qBound(1, rxBurstSize, PACKET_RX_BURST_MAX);
+	Packet *burst[PACKET_RX_BURST_MAX];
+	Packet *p = packetPool.alloc();
+	bool endOfFile = false;
+	IdleStrategy idle(consumerIdleStrategy, LATENCY_THREAD_CONSUMER(0));
+
+	printf("Reading packets from %s\n", pcapInputFile.toLatin1().constData());
+
+	while (!do_shutdown && !endOfFile) {
+		int burstCount = 0;
+		while (burstCount < burstSize) {
+			struct pcap_pkthdr *hdr;
+			const u_char *data;
+			int rc = pcap_next_ex(pcap, &hdr, &data);
+			if (rc <= 0) {
+				if (rc == -1)
+					fprintf(stderr, "Error reading %s: %s\n", pcapInputFile.toLatin1().constData(), pcap_geterr(pcap));
+				endOfFile = true;
+				break;
+			}
+			framesRead++;
+			if (hdr->caplen != hdr->len || hdr->len > 1514)
+				continue;
+
+			// pace the replay according to the capture timestamps
+			quint64 tsFrame = hdr->ts.tv_sec * SEC_TO_NSEC + hdr->ts.tv_usec * USEC_TO_NSEC;
+			if (tsStart == 0) {
+				tsStart = get_current_time();
+				tsFirstFrame = tsFrame;
+			}
+			if (pcapTimeScale > 0) {
+				quint64 tsDue = tsStart + (quint64)((tsFrame - qMin(tsFrame, tsFirstFrame)) * pcapTimeScale);
+				if (get_current_time() < tsDue) {
+					// hand over what we have before waiting
+					if (burstCount > 0) {
+						publishPackets(0, burst, burstCount, get_current_time());
+						burstCount = 0;
+					}
+					while (get_current_time() < tsDue && !do_shutdown) {
+						idle.idle(tsDue);
+					}
+					idle.busy();
+				}
+			}
+
+			if (!p) {
+				// pool exhausted: wait for packets to come back instead of losing the frame;
+				// hand over what we have first, it may be what the pool is waiting for
+				if (burstCount > 0) {
+					publishPackets(0, burst, burstCount, get_current_time());
+					burstCount = 0;
+				}
+				while (!do_shutdown && packetPool.available() == 0) {
+					idle.idle();
+				}
+				idle.busy();
+				p = packetPool.alloc();
+				if (!p)
+					break;
+			}
+			memcpy(p->buffer, data, hdr->len);
+			p->length = hdr->len;
+			int ipVersion = parseFrame(p);
+			if (!acceptPacket(ipVersion, ntohl(p->src_ip), ntohl(p->dst_ip))) {
+				packetsLost++;
+				continue;
+			}
+			packetsReceived++;
+			bytesReceived += hdr->len;
+			p->ts_driver_rx = 0;
+			burst[burstCount++] = p;
+			p = packetPool.alloc();
+		}
+		if (burstCount > 0) {
+			quint64 ts_now = get_current_time();
+			publishPackets(0, burst, burstCount, ts_now);
+			publishConsumerStats(0, packetsReceived, bytesReceived, 0, ts_now, false);
+		}
+	}
+	pcap_close(pcap);
+	if (p) {
+		packetPool.free(p);
+	}
+
+	// wait for the packets in flight to leave the emulator
+	while (!do_shutdown && packetPool.available() < packetPool.size()) {
+		idle.idle();
+	}
+	quint64 ts_end = get_current_time();
+	publishConsumerStats(0, packetsReceived, bytesReceived, 0, ts_end, true);
+	do_shutdown = 1;
+
+	printf("Frames read from %s: %llu, not addressed to the emulated network: %llu\n", pcapInputFile.toLatin1().constData(), framesRead, packetsLost);
+	printf("Total packets received: %llu\n", packetsReceived);
+	printf("Packets received per second: %f kpps\n", tsStart ? 1.0e6 * packetsReceived / double(ts_end - tsStart) : 0.0);
+	printf("Bits received per second: %f Mbps\n", tsStart ? 1.0e3 * bytesReceived * 8.0 / double(ts_end - tsStart) : 0.0);
+	printf("Packet pool: %d packets, allocations failed because the pool was exhausted: %llu\n", packetPool.size(), packetPool.getExhaustedCount());
+	for (int i = 0; i < schedulerShardCount; i++) {
+		printf("Input queue %d: max depth %llu of %d, packets dropped because the queue was full: %llu\n", i, packetsIn[0][i].getMaxDepth(), PacketQueue::capacity(), packetsIn[0][i].getOverflows());
+	}
+
+	return(NULL);
+}
+
+PcapSink::PcapSink()
+{
+	pcap = NULL;
+	dumper = NULL;
+	packetCount = 0;
+}
+
+PcapSink::~PcapSink()
+{
+	close();
+}
+
+bool PcapSink::open(QString fileName)
+{
+	pcap = pcap_open_dead(DLT_EN10MB, 65535);
+	if (!pcap) {
+		fprintf(stderr, "Cannot create pcap handle\n");
+		return false;
+	}
+	dumper = pcap_dump_open(pcap, fileName.toLatin1().constData());
+	if (!dumper) {
+		fprintf(stderr, "Cannot open %s: %s\n", fileName.toLatin1().constData(), pcap_geterr(pcap));
+		pcap_close(pcap);
+		pcap = NULL;
+		return false;
+	}
+	printf("Writing packets to %s\n", fileName.toLatin1().constData());
+	return true;
+}
+
+void PcapSink::write(Packet *p)
+{
+	struct pcap_pkthdr hdr;
+	hdr.ts.tv_sec = p->ts_send / SEC_TO_NSEC;
+	hdr.ts.tv_usec = (p->ts_send % SEC_TO_NSEC) / USEC_TO_NSEC;
+	hdr.caplen = p->length;
+	hdr.len = p->length;
+	pcap_dump((u_char*)dumper, &hdr, p->buffer);
+	packetCount++;
+}
+
+void PcapSink::close()
+{
+	if (dumper) {
+		pcap_dump_close(dumper);
+		dumper = NULL;
+	}
+	if (pcap) {
+		pcap_close(pcap);
+		pcap = NULL;
+	}
+}
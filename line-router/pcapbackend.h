@@ -0,0 +1,58 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef PCAPBACKEND_H
+#define PCAPBACKEND_H
+
+#include <QtCore>
+#include <pcap.h>
+
+class Packet;
+
+// Offline mode: packets are read from a pcap file instead of the capture device
+extern QString pcapInputFile;
+// Offline mode: packets are written to a pcap file instead of being sent
+extern QString pcapOutputFile;
+// Scale factor for the inter-arrival times of the input file (0 = replay as fast as possible)
+extern double pcapTimeScale;
+
+// Replaces packet_consumer_thread() when reading from a file. Returns when all the
+// packets of the file have left the emulator, and then requests the shutdown.
+void* pcap_consumer_thread(void* );
+
+// Writes egress packets to a pcap file (sender thread only).
+class PcapSink {
+public:
+	PcapSink();
+	~PcapSink();
+
+	bool open(QString fileName);
+	void write(Packet *p);
+	void close();
+
+	quint64 getPacketCount() const {
+		return packetCount;
+	}
+
+private:
+	pcap_t *pcap;
+	pcap_dumper_t *dumper;
+	quint64 packetCount;
+};
+
+#endif // PCAPBACKEND_H
@@ -43,10 +43,14 @@
 #include <QtCore>
 
 #include "../line-gui/netgraphnode.h"
+#include "../util/livestats.h"
+#include "latencyhistogram.h"
+#include "idlestrategy.h"
 
 #define PROFILE_PCONSUMER 0
 
-SpinlockedQueue<Packet*> packetsIn;
+PacketQueue packetsIn[MAX_RX_CHANNELS][MAX_SCHEDULER_SHARDS];
+PacketPool packetPools[MAX_RX_CHANNELS];
 
 quint64 get_current_time()
 {
@@ -56,27 +60,127 @@ quint64 get_current_time()
 	return ((quint64)ts.tv_sec) * 1000ULL * 1000ULL * 1000ULL + ((quint64)ts.tv_nsec);
 }
 
-void* packet_consumer_thread(void* ) {
+bool acceptPacket(int ipVersion, quint32 src, quint32 dst)
+{
+	return (ipVersion == 4) &
+		   ((src & MODEL_MASK) == MODEL_SUBNET) &
+		   ((dst & MODEL_MASK) == MODEL_SUBNET) &
+		   ((dst & ~src & MODEL_FORCEBIT) != 0);
+}
+
+static inline bool acceptPacket(const struct pfring_pkthdr &hdr)
+{
+	return acceptPacket(hdr.extended_hdr.parsed_pkt.ip_version,
+						htonl(hdr.extended_hdr.parsed_pkt.ip_src.v4),
+						htonl(hdr.extended_hdr.parsed_pkt.ip_dst.v4));
+}
+
+int rxBurstSize = PACKET_RX_BURST_DEFAULT;
+
+void publishPackets(int channel, Packet **packets, int count, quint64 ts_now)
+{
+	PacketPool &packetPool = packetPools[channel];
+
+	// packets grouped by scheduler shard
+	Packet *shardBurst[MAX_SCHEDULER_SHARDS][PACKET_RX_BURST_MAX];
+	int shardBurstCount[MAX_SCHEDULER_SHARDS];
+
+	Q_ASSERT(count <= PACKET_RX_BURST_MAX);
+
+	// classify
+	for (int shard = 0; shard < schedulerShardCount; shard++) {
+		shardBurstCount[shard] = 0;
+	}
+	for (int i = 0; i < count; i++) {
+		Packet *q = packets[i];
+		if (q->ts_driver_rx && q->ts_driver_rx <= ts_now) {
+			recordLatency(LATENCY_THREAD_CONSUMER(channel), LATENCY_STAGE_RX, ts_now - q->ts_driver_rx);
+		}
+		q->ts_driver_rx = q->ts_driver_rx ? q->ts_driver_rx : ts_now;
+		q->ts_userspace_rx = ts_now;
+		q->src_id = (ntohl(q->src_ip) & MODEL_HOSTMASK) - IP_OFFSET;
+		q->dst_id = (ntohl(q->dst_ip) & MODEL_HOSTMASK) - IP_OFFSET;
+		int shard = classifyPacket(q);
+		if (shard < 0) {
+			// foreign packet
+			if (DEBUG_PACKETS) printf("Bad packet %d.%d.%d.%d -> %d.%d.%d.%d (src = %d, dst = %d)\n", NIPQUAD(q->src_ip), NIPQUAD(q->dst_ip), q->src_id, q->dst_id);
+			packetPool.free(q);
+			continue;
+		}
+		shardBurst[shard][shardBurstCount[shard]++] = q;
+	}
+
+	// publish each shard's packets with a single store
+	for (int shard = 0; shard < schedulerShardCount; shard++) {
+		int n = shardBurstCount[shard];
+		if (n == 0)
+			continue;
+		int enqueued = packetsIn[channel][shard].enqueueBatch(shardBurst[shard], n);
+		for (int i = enqueued; i < n; i++) {
+			// scheduler queue full
+			if (DEBUG_PACKETS) printf("Input queue full, dropping packet\n");
+			packetPool.free(shardBurst[shard][i]);
+		}
+	}
+}
+
+bool publishConsumerStats(int channel, quint64 packetsReceived, quint64 bytesReceived, quint64 bursts, quint64 ts_now, bool force)
+{
+	static quint64 ts_live_stats[MAX_RX_CHANNELS];
+	LiveStats *stats = __atomic_load_n(&liveStats, __ATOMIC_ACQUIRE);
+	if (!stats)
+		return true;
+	if (!force && ts_now - ts_live_stats[channel] < LIVESTATS_PUBLISH_PERIOD)
+		return false;
+	LiveStatsConsumer consumerStats;
+	consumerStats.timestamp = ts_now;
+	consumerStats.packetsReceived = packetsReceived;
+	consumerStats.bytesReceived = bytesReceived;
+	consumerStats.bursts = bursts;
+	consumerStats.poolExhausted = packetPools[channel].getExhaustedCount();
+	liveStatsPublish(stats->consumer(channel), consumerStats);
+	ts_live_stats[channel] = ts_now;
+	return true;
+}
+
+void* packet_consumer_thread(void* arg) {
+	int channel = (long)arg;
+	pfring *pd = rxRings[channel];
+	PacketPool &packetPool = packetPools[channel];
 	u_int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
 	Packet *p;
 
-	u_long core_id = CORE_CONSUMER % numCPU;
+	u_long core_id = (channel == 0 ? CORE_CONSUMER : CORE_CONSUMER_EXTRA(channel)) % numCPU;
 	struct pfring_pkthdr hdr;
 
 	if (numCPU > 1) {
 		if (bind2core(core_id) == 0) {
-			printf("Set thread consumer affinity to core %lu/%u\n", core_id, numCPU);
+			printf("Set thread consumer %d affinity to core %lu/%u\n", channel, core_id, numCPU);
 		} else {
-			printf("Failed to set thread consumer affinity to core %lu/%u\n", core_id, numCPU);
+			printf("Failed to set thread consumer %d affinity to core %lu/%u\n", channel, core_id, numCPU);
 		}
 	}
 
 	quint64 packetsReceived = 0;
     quint64 tsFirstReceivedPacket = 0;
     quint64 bytesReceived = 0;
+	quint64 bursts = 0;
+	quint64 burstPackets = 0;
+	bool statsDirty = false;
+	IdleStrategy idle(consumerIdleStrategy, LATENCY_THREAD_CONSUMER(channel));
+
+	if (!packetPool.init(packetPoolSize)) {
+		fprintf(stderr, "Cannot allocate packets, exiting\n");
+		exit(EXIT_FAILURE);
+	}
+	// receive buffer used while the pool is exhausted
+	Packet *overflowPacket = new Packet();
 
 	memset(&hdr, 0, sizeof(hdr));
-	p = new Packet();
+	p = packetPool.alloc();
+
+	int burstSize = qBound(1, rxBurstSize, PACKET_RX_BURST_MAX);
+	Packet *burst[PACKET_RX_BURST_MAX];
 
 #if PROFILE_PCONSUMER
 	quint64 ts_prev = 0;
@@ -86,11 +190,14 @@ void* packet_consumer_thread(void* ) {
 		if (do_shutdown)
 			break;
 
-        quint8 *buffer = p->buffer;
-        quint8 **buffer_ptr = &buffer;
+		// receive a burst of frames; this stops at the first empty read
+		int burstCount = 0;
+		while (burstCount < burstSize) {
+			Packet *rx = p ? p : overflowPacket;
+			quint8 *buffer = rx->buffer;
+			quint8 **buffer_ptr = &buffer;
 
-        if (pfring_recv(pd, buffer_ptr, sizeof(p->buffer), &hdr, 0) > 0) {
-			if (do_shutdown)
+			if (pfring_recv(pd, buffer_ptr, sizeof(rx->buffer), &hdr, 0) <= 0)
 				break;
 			if (hdr.caplen != hdr.len) {
 				qDebug() << "hdr.caplen != hdr.len:" << hdr.caplen << hdr.len;
@@ -100,49 +207,75 @@ void* packet_consumer_thread(void* ) {
 				qDebug() << "hdr.len =" << hdr.len;
 				continue;
 			}
-			if (hdr.extended_hdr.parsed_pkt.ip_version == 4) {
-				if (((htonl(hdr.extended_hdr.parsed_pkt.ip_src.v4) & MODEL_MASK) == MODEL_SUBNET) &&
-				    ((htonl(hdr.extended_hdr.parsed_pkt.ip_dst.v4) & MODEL_MASK) == MODEL_SUBNET) &&
-				    (htonl(hdr.extended_hdr.parsed_pkt.ip_dst.v4) & MODEL_FORCEBIT) &&
-				    !(htonl(hdr.extended_hdr.parsed_pkt.ip_src.v4) & MODEL_FORCEBIT)) {
-					if (DEBUG_PACKETS) printf("Accepted packet %d.%d.%d.%d -> %d.%d.%d.%d\n", HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_src.v4), HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_dst.v4));
-					packetsReceived++;
-                    bytesReceived += hdr.len;
-                    quint64 ts_now = get_current_time();
-                    if (tsFirstReceivedPacket == 0)
-                        tsFirstReceivedPacket = ts_now;
-#if PROFILE_PCONSUMER
-					printf("sw ts delta = +"TS_FORMAT"\n", TS_FORMAT_PARAM(ts_now-ts_prev));
-					ts_prev = ts_now;
-					//printf("hw ts = "TS_FORMAT"\n", TS_FORMAT_PARAM((quint64)hdr.extended_hdr.timestamp_ns));
-					//printf("sw ts = "TS_FORMAT"\n", TS_FORMAT_PARAM(ts_now));
-#endif
-					p->ts_driver_rx = hdr.extended_hdr.timestamp_ns ? hdr.extended_hdr.timestamp_ns : ts_now;
-					p->ts_userspace_rx = ts_now;
-					p->src_ip = htonl(hdr.extended_hdr.parsed_pkt.ip_src.v4);
-					p->dst_ip = htonl(hdr.extended_hdr.parsed_pkt.ip_dst.v4);
-					p->src_id = (ntohl(p->src_ip) & MODEL_HOSTMASK) - IP_OFFSET;
-					p->dst_id = (ntohl(p->dst_ip) & MODEL_HOSTMASK) - IP_OFFSET;
-					p->l4_protocol = hdr.extended_hdr.parsed_pkt.l3_proto; // they named it worng
-					p->offsets = hdr.extended_hdr.parsed_pkt.offset;
-					p->length = hdr.len;
-					packetsIn.enqueue(p);
-					p = new Packet();
-				} else {
-					if (DEBUG_PACKETS) printf("Dropped packet %d.%d.%d.%d -> %d.%d.%d.%d\n", HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_src.v4), HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_dst.v4));
-				}
+			if (!acceptPacket(hdr)) {
+				if (DEBUG_PACKETS) printf("Dropped packet %d.%d.%d.%d -> %d.%d.%d.%d\n", HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_src.v4), HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_dst.v4));
+				continue;
 			}
-		} else {
-//			if (wait_for_packet == 0)
-//				sched_yield();
+			if (DEBUG_PACKETS) printf("Accepted packet %d.%d.%d.%d -> %d.%d.%d.%d\n", HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_src.v4), HIPQUAD(hdr.extended_hdr.parsed_pkt.ip_dst.v4));
+			packetsReceived++;
+			if (!p) {
+				// pool exhausted, the packet is lost; try again for the next one
+				p = packetPool.alloc();
+				continue;
+			}
+			bytesReceived += hdr.len;
+			// the software timestamp is filled in for the whole burst below
+			p->ts_driver_rx = hdr.extended_hdr.timestamp_ns;
+			p->src_ip = htonl(hdr.extended_hdr.parsed_pkt.ip_src.v4);
+			p->dst_ip = htonl(hdr.extended_hdr.parsed_pkt.ip_dst.v4);
+			p->l4_protocol = hdr.extended_hdr.parsed_pkt.l3_proto; // they named it worng
+			p->offsets = hdr.extended_hdr.parsed_pkt.offset;
+			p->length = hdr.len;
+			burst[burstCount++] = p;
+			p = packetPool.alloc();
 		}
+
+		if (burstCount == 0) {
+			if (statsDirty) {
+				// idle: publish the counters of the last bursts
+				statsDirty = !publishConsumerStats(channel, packetsReceived, bytesReceived, bursts, get_current_time(), false);
+			}
+			idle.idle();
+			continue;
+		}
+		idle.busy();
+		bursts++;
+		burstPackets += burstCount;
+
+		quint64 ts_now = get_current_time();
+		if (tsFirstReceivedPacket == 0)
+			tsFirstReceivedPacket = ts_now;
+#if PROFILE_PCONSUMER
+		printf("sw ts delta = +"TS_FORMAT", burst = %d\n", TS_FORMAT_PARAM(ts_now-ts_prev), burstCount);
+		ts_prev = ts_now;
+#endif
+
+		publishPackets(channel, burst, burstCount, ts_now);
+		statsDirty = !publishConsumerStats(channel, packetsReceived, bytesReceived, bursts, ts_now, false);
 	}
 
     quint64 ts_end = get_current_time();
+	publishConsumerStats(channel, packetsReceived, bytesReceived, bursts, ts_end, true);
+	delete overflowPacket;
+	overflowPacket = NULL;
 
+	// the consumers finish at the same time; keep their reports apart
+	static QMutex reportMutex;
+	QMutexLocker reportLocker(&reportMutex);
+	if (rxChannelCount > 1) {
+		printf("Receive channel %d:\n", channel);
+	}
 	printf("Total packets received: %llu\n", packetsReceived);
     printf("Packets received per second: %f kpps\n", 1.0e6 * packetsReceived / double(ts_end - tsFirstReceivedPacket));
     printf("Bits received per second: %f Mbps\n", 1.0e3 * bytesReceived * 8.0 / double(ts_end - tsFirstReceivedPacket));
+	printf("Average receive batch fill: %f packets of %d (%llu batches)\n", bursts ? burstPackets / double(bursts) : 0.0, burstSize, bursts);
+	printf("Packet pool: %d packets, allocations failed because the pool was exhausted: %llu\n", packetPool.size(), packetPool.getExhaustedCount());
+	for (int i = 0; i < schedulerShardCount; i++) {
+		printf("Input queue %d: max depth %llu of %d, packets dropped because the queue was full: %llu\n", i, packetsIn[channel][i].getMaxDepth(), PacketQueue::capacity(), packetsIn[channel][i].getOverflows());
+	}
+	if (idle.strategy != IDLE_SPIN) {
+		printf("Consumer %d idle (%s): %llu yields, %llu sleeps\n", channel, idleStrategyName(idle.strategy), idle.yields, idle.sleeps);
+	}
 
 	return(NULL);
 }
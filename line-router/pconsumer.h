@@ -21,7 +21,8 @@
 
 #include <pfring.h>
 #include <QtCore>
-#include "spinlockedqueue.h"
+#include "spscring.h"
+#include "packetpool.h"
 
 // masks from libipaddr.so
 #define MODEL_SUBNET   htonl(0x0a000000)  /* 10.0.0.0/8 */
@@ -29,10 +30,30 @@
 #define MODEL_FORCEBIT htonl(0x00800000)  /* 0000 0000 . 1000 0000 . 0000 0000 . 0000 0000 which gives 10.128.0.0/9 */
 #define MODEL_HOSTMASK 0x7FFFFF           /* 0000 0000 . 0111 1111 . 1111 1111 . 1111 1111 */
 
+// Per-packet hop trace: enabled by default in debug builds only
+#ifndef PACKET_TRACE
+#ifdef QT_NO_DEBUG
+#define PACKET_TRACE 0
+#else
+#define PACKET_TRACE 1
+#endif
+#endif
+#define PACKET_TRACE_MAX_HOPS 64
+
+class PacketPool;
+
 class Packet {
 public:
 	Packet() {
+		pool = NULL;
+		reset();
+	}
+
+	// clears the per-packet emulation state, called when a packet is recycled
+	void reset() {
 		theoretical_delay = 0;
+		ts_end_proc = 0;
+		current_node = -1;
 		edgecount = 0;
 	}
 
@@ -41,7 +62,7 @@ public:
 	quint64 ts_driver_rx;
 	quint64 ts_userspace_rx;
 	quint64 ts_start_proc;
-	quint64 ts_end_proc;
+	quint64 ts_end_proc;     // when the scheduler hands the packet to the sender
 	quint64 ts_start_send;
 	quint64 ts_send;
 	quint64 theoretical_delay; // ideally = ts_end_proc - ts_start_proc
@@ -51,13 +72,24 @@ public:
 	in_addr_t src_ip;
 	in_addr_t dst_ip;
 	quint8 l4_protocol;
-	QList<qint32> trace; // list of edge IDs
-	int edgecount;
+	qint32 current_node; // ID of the NetGraphNode where the packet is (-1 if it has not been routed yet)
+	int edgecount; // number of edges traversed
+#if PACKET_TRACE
+	qint32 trace[PACKET_TRACE_MAX_HOPS]; // IDs of the nodes visited; trace[i] is the node reached after i edges
+#endif
 	qint32 src_id; // ID of source NetGraphNode
 	qint32 dst_id; // ID of destination NetGraphNode
+	qint32 dst_index; // destination index in the forwarding table
+	qint32 path_index; // index of the NetGraphPath
+	PacketPool *pool; // the pool that owns this packet
+	// scheduler event queue links (see TimingWheel)
+	Packet *wheelNext;
+	quint64 wheelTime;
 };
 
-extern pfring *pd;
+// One ring per receive channel; rxChannelCount rings are open
+extern pfring *rxRings[MAX_RX_CHANNELS];
+extern int rxChannelCount;
 extern quint8 wait_for_packet; // 1 = blocking read, 0 = busy waiting
 extern quint8 dna_mode;
 extern quint8 do_shutdown;
@@ -66,6 +98,8 @@ extern QString simulationId;
 
 // CPU affinity
 #define CORE_CONSUMER 0
+// the additional consumers run on the cores after those of the scheduler shards
+#define CORE_CONSUMER_EXTRA(channel) (CORE_SCHEDULER_EXTRA + schedulerShardCount - 1 + (channel) - 1)
 
 #define SEC_TO_NSEC  1000000000
 #define MSEC_TO_NSEC 1000000
@@ -78,7 +112,8 @@ extern QString simulationId;
 
 int runPacketFilter(int argc, char **argv);
 
-void* packet_consumer_thread(void* );
+// arg: the receive channel
+void* packet_consumer_thread(void* arg);
 void* packet_scheduler_thread(void* );
 
 int bind2core(u_int core_id);
@@ -87,7 +122,31 @@ quint64 get_current_time();
 
 void loadTopology(QString graphFileName);
 
-extern SpinlockedQueue<Packet*> packetsIn;
+// Lock-free queues between the consumer, scheduler and sender threads
+#define PACKET_QUEUE_CAPACITY 65536
+#define PACKET_BATCH_SIZE 64
+typedef SpscRing<Packet*, PACKET_QUEUE_CAPACITY> PacketQueue;
+
+// Maximum number of frames the consumer receives before handing them to the schedulers
+#define PACKET_RX_BURST_DEFAULT 32
+#define PACKET_RX_BURST_MAX     256
+extern int rxBurstSize;
+
+// Returns true if the packet (addresses in host byte order) is sent into the emulated network.
+// The conditions are combined without short-circuiting, to avoid unpredictable branches.
+bool acceptPacket(int ipVersion, quint32 src, quint32 dst);
+// Timestamps and classifies a burst of received packets (at most PACKET_RX_BURST_MAX),
+// then hands them to the scheduler shards. Consumer thread of the channel only.
+void publishPackets(int channel, Packet **packets, int count, quint64 ts_now);
+// Copies the consumer counters to the statistics segment if LIVESTATS_PUBLISH_PERIOD has passed
+// since the last update, or if force is true. Returns false if the counters remain to be published.
+// Consumer thread of the channel only.
+bool publishConsumerStats(int channel, quint64 packetsReceived, quint64 bytesReceived, quint64 bursts, quint64 ts_now, bool force);
+
+// one input queue per receive channel and scheduler shard
+extern PacketQueue packetsIn[MAX_RX_CHANNELS][MAX_SCHEDULER_SHARDS];
+// one packet pool per receive channel, owned by its consumer thread
+extern PacketPool packetPools[MAX_RX_CHANNELS];
 
 // Display an IP address in readable format.
 #define NIPQUAD(addr) \
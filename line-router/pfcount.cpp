@@ -22,7 +22,12 @@
  */
 
 #include "pconsumer.h"
+#include "pscheduler.h"
+#include "pcapbackend.h"
 #include "psender.h"
+#include "../util/livestats.h"
+#include "latencyhistogram.h"
+#include "idlestrategy.h"
 
 #include <signal.h>
 #include <sched.h>
@@ -43,6 +48,7 @@
 #include <time.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <getopt.h>
 
 #include <QtCore>
 
@@ -52,11 +58,14 @@
 #define DEFAULT_SNAPLEN      1600
 #define MAX_NUM_THREADS        64
 #define DEFAULT_DEVICE     "eth0"
+// PF_RING cluster of the receive rings, when the device has fewer RX queues than receive channels
+#define RX_CLUSTER_ID_DEFAULT  99
 
 int verbose = 0, num_threads = 1;
 pfring_stat pfringStats;
 pthread_rwlock_t statsLock;
-pfring *pd;
+pfring *rxRings[MAX_RX_CHANNELS];
+int rxChannelCount = 1;
 quint8 wait_for_packet; // 1 = blocking read, 0 = busy waiting
 quint8 dna_mode;
 quint8 do_shutdown;
@@ -107,7 +116,19 @@ void print_stats() {
 	gettimeofday(&endTime, NULL);
 	deltaMillisec = delta_time(&endTime, &startTime);
 
-	if (pfring_stats(pd, &pfringStat) >= 0) {
+	// the totals of the receive rings
+	bool haveStats = false;
+	memset(&pfringStat, 0, sizeof(pfringStat));
+	for (int channel = 0; channel < rxChannelCount; channel++) {
+		pfring_stat ringStat;
+		if (rxRings[channel] && pfring_stats(rxRings[channel], &ringStat) >= 0) {
+			pfringStat.recv += ringStat.recv;
+			pfringStat.drop += ringStat.drop;
+			haveStats = true;
+		}
+	}
+
+	if (haveStats) {
 		double thpt;
 		int i;
 		unsigned long long nBytes = 0, nPkts = 0;
@@ -508,6 +529,197 @@ int bind2core(u_int core_id) {
 /* *************************************** */
 QString simulationId;
 
+void printEmulatorUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options] <graph file> <simulation id>\n", name);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --pool-size <n>   Number of preallocated packets per receive channel (default %d, max %d)\n", PACKET_POOL_DEFAULT_SIZE, PACKET_POOL_MAX_SIZE);
+	fprintf(stderr, "  --event-queue <q> Scheduler event queue: wheel (default) or heap\n");
+	fprintf(stderr, "  --rx-burst <n>    Maximum number of frames received at once (default %d, max %d)\n", PACKET_RX_BURST_DEFAULT, PACKET_RX_BURST_MAX);
+	fprintf(stderr, "  --rx-channels <n> Number of receive rings and consumer threads (default 1, max %d, 0 = one per RX queue of the device)\n", MAX_RX_CHANNELS);
+	fprintf(stderr, "  --pcap-in <file>  Read packets from a pcap file instead of the capture device\n");
+	fprintf(stderr, "  --pcap-out <file> Write packets to a pcap file instead of sending them\n");
+	fprintf(stderr, "  --pcap-time-scale <x> Scale the inter-arrival times of --pcap-in by x (default 1, 0 = as fast as possible)\n");
+	fprintf(stderr, "  --shards <n>      Number of scheduler threads (default 1, max %d)\n", MAX_SCHEDULER_SHARDS);
+	fprintf(stderr, "  --shard-mode <m>  How edges are split between the schedulers: component (default) or edge\n");
+	fprintf(stderr, "  --full-timeline-sampling <n> Record one in n packet events in the full timelines (default 1)\n");
+	fprintf(stderr, "  --seed <n>        Seed of the random loss generators (default 1); runs with the same seed drop the same packets\n");
+	fprintf(stderr, "  --live-stats <name> Shared memory segment with the statistics of the running emulator (default %s, none to disable)\n", LIVESTATS_DEFAULT_NAME);
+	fprintf(stderr, "  --idle <policy>   What the threads do when they have no work: spin, yield or sleep\n");
+	fprintf(stderr, "  --idle-consumer <policy>, --idle-scheduler <policy>, --idle-sender <policy>\n");
+	fprintf(stderr, "                    Idle policy of one thread (defaults: consumer %s, scheduler %s, sender %s)\n",
+			idleStrategyName(consumerIdleStrategy), idleStrategyName(schedulerIdleStrategy), idleStrategyName(senderIdleStrategy));
+	fprintf(stderr, "  --idle-max-sleep <us> Longest sleep of an idle thread when it has no deadline (default %d)\n", IDLE_MAX_SLEEP_DEFAULT / USEC_TO_NSEC);
+}
+
+bool parseEmulatorArgs(int argc, char **argv, QString &graphFileName, QString &simulationId)
+{
+	enum {
+		OPT_POOL_SIZE = 1000,
+		OPT_EVENT_QUEUE,
+		OPT_SHARDS,
+		OPT_SHARD_MODE,
+		OPT_RX_BURST,
+		OPT_RX_CHANNELS,
+		OPT_PCAP_IN,
+		OPT_PCAP_OUT,
+		OPT_PCAP_TIME_SCALE,
+		OPT_FULL_TIMELINE_SAMPLING,
+		OPT_SEED,
+		OPT_LIVE_STATS,
+		OPT_IDLE,
+		OPT_IDLE_CONSUMER,
+		OPT_IDLE_SCHEDULER,
+		OPT_IDLE_SENDER,
+		OPT_IDLE_MAX_SLEEP
+	};
+	static struct option longOptions[] = {
+		{"pool-size", required_argument, 0, OPT_POOL_SIZE},
+		{"event-queue", required_argument, 0, OPT_EVENT_QUEUE},
+		{"shards", required_argument, 0, OPT_SHARDS},
+		{"shard-mode", required_argument, 0, OPT_SHARD_MODE},
+		{"rx-burst", required_argument, 0, OPT_RX_BURST},
+		{"rx-channels", required_argument, 0, OPT_RX_CHANNELS},
+		{"pcap-in", required_argument, 0, OPT_PCAP_IN},
+		{"pcap-out", required_argument, 0, OPT_PCAP_OUT},
+		{"pcap-time-scale", required_argument, 0, OPT_PCAP_TIME_SCALE},
+		{"full-timeline-sampling", required_argument, 0, OPT_FULL_TIMELINE_SAMPLING},
+		{"seed", required_argument, 0, OPT_SEED},
+		{"live-stats", required_argument, 0, OPT_LIVE_STATS},
+		{"idle", required_argument, 0, OPT_IDLE},
+		{"idle-consumer", required_argument, 0, OPT_IDLE_CONSUMER},
+		{"idle-scheduler", required_argument, 0, OPT_IDLE_SCHEDULER},
+		{"idle-sender", required_argument, 0, OPT_IDLE_SENDER},
+		{"idle-max-sleep", required_argument, 0, OPT_IDLE_MAX_SLEEP},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+		switch (c) {
+		case OPT_POOL_SIZE:
+			packetPoolSize = atoi(optarg);
+			if (packetPoolSize <= 0 || packetPoolSize > PACKET_POOL_MAX_SIZE) {
+				fprintf(stderr, "Invalid pool size: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_EVENT_QUEUE:
+			if (QString(optarg) == "heap") {
+				eventQueueType = EVENT_QUEUE_HEAP;
+			} else if (QString(optarg) == "wheel") {
+				eventQueueType = EVENT_QUEUE_WHEEL;
+			} else {
+				fprintf(stderr, "Invalid event queue: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_SHARDS:
+			schedulerShardCount = atoi(optarg);
+			if (schedulerShardCount <= 0 || schedulerShardCount > MAX_SCHEDULER_SHARDS) {
+				fprintf(stderr, "Invalid number of shards: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_SHARD_MODE:
+			if (QString(optarg) == "component") {
+				schedulerShardMode = SHARD_BY_COMPONENT;
+			} else if (QString(optarg) == "edge") {
+				schedulerShardMode = SHARD_BY_EDGE;
+			} else {
+				fprintf(stderr, "Invalid shard mode: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_RX_BURST:
+			rxBurstSize = atoi(optarg);
+			if (rxBurstSize <= 0 || rxBurstSize > PACKET_RX_BURST_MAX) {
+				fprintf(stderr, "Invalid receive burst size: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_RX_CHANNELS:
+			rxChannelCount = atoi(optarg);
+			if (rxChannelCount < 0 || rxChannelCount > MAX_RX_CHANNELS) {
+				fprintf(stderr, "Invalid number of receive channels: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_PCAP_IN:
+			pcapInputFile = QDir(optarg).absolutePath();
+			break;
+		case OPT_PCAP_OUT:
+			pcapOutputFile = QDir(optarg).absolutePath();
+			break;
+		case OPT_PCAP_TIME_SCALE:
+			pcapTimeScale = atof(optarg);
+			if (pcapTimeScale < 0) {
+				fprintf(stderr, "Invalid pcap time scale: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_FULL_TIMELINE_SAMPLING:
+			fullTimelineSampling = atoi(optarg);
+			if (fullTimelineSampling <= 0) {
+				fprintf(stderr, "Invalid full timeline sampling: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_SEED:
+			lossSeed = strtoull(optarg, NULL, 0);
+			break;
+		case OPT_LIVE_STATS:
+			if (QString(optarg) == "none") {
+				liveStatsName = QString();
+			} else if (QString(optarg).startsWith("/") && !QString(optarg).mid(1).contains("/")) {
+				liveStatsName = optarg;
+			} else {
+				fprintf(stderr, "Invalid shared memory segment name (must be /name): %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPT_IDLE:
+		case OPT_IDLE_CONSUMER:
+		case OPT_IDLE_SCHEDULER:
+		case OPT_IDLE_SENDER: {
+			int strategy = idleStrategyFromString(optarg);
+			if (strategy < 0) {
+				fprintf(stderr, "Invalid idle policy: %s\n", optarg);
+				return false;
+			}
+			if (c == OPT_IDLE || c == OPT_IDLE_CONSUMER)
+				consumerIdleStrategy = strategy;
+			if (c == OPT_IDLE || c == OPT_IDLE_SCHEDULER)
+				schedulerIdleStrategy = strategy;
+			if (c == OPT_IDLE || c == OPT_IDLE_SENDER)
+				senderIdleStrategy = strategy;
+			break;
+		}
+		case OPT_IDLE_MAX_SLEEP:
+			idleMaxSleep = strtoull(optarg, NULL, 10) * USEC_TO_NSEC;
+			if (idleMaxSleep < IDLE_MIN_SLEEP) {
+				fprintf(stderr, "Invalid maximum sleep time: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'h':
+		default:
+			printEmulatorUsage(argv[0]);
+			return false;
+		}
+	}
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "wrong args\n");
+		printEmulatorUsage(argv[0]);
+		return false;
+	}
+	graphFileName = argv[optind];
+	simulationId = argv[optind + 1];
+	return true;
+}
+
 int runPacketFilter(int argc, char **argv) {
 	char *device = NULL, buf[32];
 	u_char mac_address[6];
@@ -558,6 +770,11 @@ int runPacketFilter(int argc, char **argv) {
 	startTime.tv_sec = 0;
 	thiszone = gmt2local(0);
 
+	QString graphFileName;
+	if (!parseEmulatorArgs(argc, argv, graphFileName, simulationId)) {
+		exit(1);
+	}
+
 #if 0
 	char *string = NULL;
 	int c;
@@ -639,55 +856,102 @@ int runPacketFilter(int argc, char **argv) {
 	if (num_threads > 0)
 		pthread_rwlock_init(&statsLock, NULL);
 
-	if (wait_for_packet && (cpu_percentage > 0)) {
-		if (cpu_percentage > 99) cpu_percentage = 99;
-		pfring_config(cpu_percentage);
-	}
-
-    pd = pfring_open(device, snaplen, PF_RING_LONG_HEADER | PF_RING_TIMESTAMP);
-
-	if (pd == NULL) {
-		printf("pfring_open error (perhaps you use quick mode and have already a socket bound to %s, or you did not insmod pf_ring.ko ?)\n",
-			  device);
-		return(-1);
+	if (!pcapInputFile.isEmpty()) {
+		printf("Capturing from %s\n", pcapInputFile.toLatin1().constData());
+		if (rxChannelCount != 1) {
+			printf("Reading a capture file on a single receive channel\n");
+		}
+		rxChannelCount = 1;
 	} else {
-		u_int32_t version;
+		if (wait_for_packet && (cpu_percentage > 0)) {
+			if (cpu_percentage > 99) cpu_percentage = 99;
+			pfring_config(cpu_percentage);
+		}
 
-		pfring_set_application_name(pd, (char*)"pfcount");
-		pfring_version(pd, &version);
+		pfring *pd = pfring_open(device, snaplen, PF_RING_LONG_HEADER | PF_RING_TIMESTAMP);
+		rxRings[0] = pd;
 
-		printf("Using PF_RING v.%d.%d.%d\n",
-			  (version & 0xFFFF0000) >> 16,
-			  (version & 0x0000FF00) >> 8,
-			  version & 0x000000FF);
-	}
+		if (pd == NULL) {
+			printf("pfring_open error (perhaps you use quick mode and have already a socket bound to %s, or you did not insmod pf_ring.ko ?)\n",
+				  device);
+			return(-1);
+		} else {
+			u_int32_t version;
 
-	if (pfring_get_bound_device_address(pd, mac_address) != 0)
-		printf("pfring_get_bound_device_address() failed\n");
+			pfring_version(pd, &version);
 
-	printf("Capturing from %s [%s]\n", device, etheraddr_string(mac_address, buf));
+			printf("Using PF_RING v.%d.%d.%d\n",
+				  (version & 0xFFFF0000) >> 16,
+				  (version & 0x0000FF00) >> 8,
+				  version & 0x000000FF);
+		}
 
-	printf("# Device RX channels: %d\n", pfring_get_num_rx_channels(pd));
-	printf("# Polling threads:    %d\n", num_threads);
+		if (pfring_get_bound_device_address(pd, mac_address) != 0)
+			printf("pfring_get_bound_device_address() failed\n");
+
+		printf("Capturing from %s [%s]\n", device, etheraddr_string(mac_address, buf));
+
+		int deviceRxChannels = pfring_get_num_rx_channels(pd);
+		if (rxChannelCount == 0)
+			rxChannelCount = qBound(1, deviceRxChannels, MAX_RX_CHANNELS);
+		printf("# Device RX channels: %d\n", deviceRxChannels);
+		printf("# Receive channels:   %d\n", rxChannelCount);
+		printf("# Polling threads:    %d\n", num_threads);
+
+		// The packets of a flow must stay on one channel, or they could be reordered
+		// between the consumers.
+		if (rxChannelCount > 1 && deviceRxChannels == rxChannelCount) {
+			// one ring per RX queue; the NIC (RSS) hashes each flow to a queue
+			pfring_close(pd);
+			for (int channel = 0; channel < rxChannelCount; channel++) {
+				QByteArray queueDevice = QString("%1@%2").arg(device).arg(channel).toLatin1();
+				rxRings[channel] = pfring_open(queueDevice.data(), snaplen, PF_RING_LONG_HEADER | PF_RING_TIMESTAMP);
+				if (rxRings[channel] == NULL) {
+					printf("pfring_open error on %s\n", queueDevice.constData());
+					return(-1);
+				}
+			}
+		} else if (rxChannelCount > 1) {
+			// rings on the whole device, in a cluster that hashes each flow to a ring
+			for (int channel = 1; channel < rxChannelCount; channel++) {
+				rxRings[channel] = pfring_open(device, snaplen, PF_RING_LONG_HEADER | PF_RING_TIMESTAMP);
+				if (rxRings[channel] == NULL) {
+					printf("pfring_open error on %s\n", device);
+					return(-1);
+				}
+			}
+			for (int channel = 0; channel < rxChannelCount; channel++) {
+				if ((rc = pfring_set_cluster(rxRings[channel], clusterId ? clusterId : RX_CLUSTER_ID_DEFAULT, cluster_per_flow)) != 0) {
+					printf("pfring_set_cluster returned [rc=%d]\n", rc);
+					return(-1);
+				}
+			}
+		}
 
-	if (dna_mode == 0) {
-		if ((rc = pfring_set_direction(pd, direction)) != 0)
-			printf("pfring_set_direction returned [rc=%d][direction=%d]\n", rc, direction);
+		for (int channel = 0; channel < rxChannelCount; channel++) {
+			pd = rxRings[channel];
+			pfring_set_application_name(pd, (char*)"pfcount");
 
-        if ((rc = pfring_set_socket_mode(pd, recv_only_mode)) != 0)
-            fprintf(stderr, "pfring_set_socket_mode returned [rc=%d]\n", rc);
+			if (dna_mode == 0) {
+				if ((rc = pfring_set_direction(pd, direction)) != 0)
+					printf("pfring_set_direction returned [rc=%d][direction=%d]\n", rc, direction);
 
-		if (watermark > 0) {
-			if ((rc = pfring_set_poll_watermark(pd, watermark)) != 0)
-				printf("pfring_set_poll_watermark returned [rc=%d][watermark=%d]\n", rc, watermark);
-		}
+				if ((rc = pfring_set_socket_mode(pd, recv_only_mode)) != 0)
+					fprintf(stderr, "pfring_set_socket_mode returned [rc=%d]\n", rc);
 
-		if (rehash_rss)
-			pfring_enable_rss_rehash(pd);
+				if (watermark > 0) {
+					if ((rc = pfring_set_poll_watermark(pd, watermark)) != 0)
+						printf("pfring_set_poll_watermark returned [rc=%d][watermark=%d]\n", rc, watermark);
+				}
 
-		if (poll_duration > 0)
-			pfring_set_poll_duration(pd, poll_duration);
-    }
+				if (rehash_rss)
+					pfring_enable_rss_rehash(pd);
+
+				if (poll_duration > 0)
+					pfring_set_poll_duration(pd, poll_duration);
+			}
+		}
+	}
 
 	signal(SIGINT, sigproc);
 	signal(SIGTERM, sigproc);
@@ -704,19 +968,16 @@ int runPacketFilter(int argc, char **argv) {
 		// if (num_threads > 1) wait_for_packet = 1;
 	}
 
-	pfring_enable_ring(pd);
-
-	pthread_t sender_thread;
-	pthread_create(&sender_thread, NULL, packet_sender_thread, NULL);
+	for (int channel = 0; channel < rxChannelCount; channel++) {
+		if (rxRings[channel])
+			pfring_enable_ring(rxRings[channel]);
+	}
 
-	QString graphFileName;
-	argc--, argv++;
-	if (argc != 2) {
-		fprintf(stderr, "wrong args\n");
-		exit(1);
+	printf("Idle policies: consumer %s, scheduler %s, sender %s\n",
+		   idleStrategyName(consumerIdleStrategy), idleStrategyName(schedulerIdleStrategy), idleStrategyName(senderIdleStrategy));
+	if (consumerIdleStrategy == IDLE_SLEEP || schedulerIdleStrategy == IDLE_SLEEP || senderIdleStrategy == IDLE_SLEEP) {
+		calibrateIdleSleep();
 	}
-	graphFileName = argv[0];
-	simulationId = argv[1];
 
 	QDir dir(".");
 	dir.mkpath(simulationId);
@@ -738,16 +999,37 @@ int runPacketFilter(int argc, char **argv) {
 	QDir::setCurrent(QString("./%1").arg(simulationId));
 
 	loadTopology(graphFileName);
-	pthread_t scheduler_thread;
-	pthread_create(&scheduler_thread, NULL, packet_scheduler_thread, NULL);
+	startSchedulers();
 
-	packet_consumer_thread(NULL);
-	pthread_join(scheduler_thread, NULL);
+	// the sender drains one output queue per shard, so it starts once partitionShards() has set schedulerShardCount
+	pthread_t sender_thread;
+	pthread_create(&sender_thread, NULL, packet_sender_thread, NULL);
+
+	if (!pcapInputFile.isEmpty()) {
+		pcap_consumer_thread(NULL);
+	} else {
+		// the main thread receives on channel 0
+		pthread_t consumerThreads[MAX_RX_CHANNELS];
+		for (long channel = 1; channel < rxChannelCount; channel++) {
+			pthread_create(&consumerThreads[channel], NULL, packet_consumer_thread, (void*)channel);
+		}
+		packet_consumer_thread((void*)0);
+		for (int channel = 1; channel < rxChannelCount; channel++) {
+			pthread_join(consumerThreads[channel], NULL);
+		}
+	}
+	joinSchedulers();
 	pthread_join(sender_thread, NULL);
+	closeLiveStats();
+	saveLatencyHistograms("latency-histograms.txt");
 
-	print_stats();
+	if (rxRings[0]) {
+		print_stats();
 
-	pfring_close(pd);
+		for (int channel = 0; channel < rxChannelCount; channel++) {
+			pfring_close(rxRings[channel]);
+		}
+	}
 
 	return(0);
 }
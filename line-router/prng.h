@@ -0,0 +1,83 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <QtCore>
+
+// xoshiro256** pseudo-random number generator (Blackman and Vigna).
+// Small, fast and without shared state, so each edge can have its own generator
+// and a run with a given seed draws the same numbers no matter how the edges are
+// split between the scheduler threads.
+class Prng {
+public:
+	Prng() {
+		seed(0, 0);
+	}
+
+	// Seeds the state from a run seed and a stream number (e.g. the edge index)
+	void seed(quint64 runSeed, quint64 stream) {
+		quint64 x = runSeed ^ (stream * 0x9E3779B97F4A7C15ULL);
+		for (int i = 0; i < 4; i++) {
+			s[i] = splitmix64(x);
+		}
+	}
+
+	inline quint64 next() {
+		quint64 result = rotl(s[1] * 5, 7) * 9;
+		quint64 t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	// Returns true with probability threshold / 2^53 (see probabilityThreshold())
+	inline bool chance(quint64 threshold) {
+		return (next() >> 11) < threshold;
+	}
+
+	// Converts a probability (0..1) to a threshold for chance()
+	static quint64 probabilityThreshold(qreal p) {
+		if (p <= 0)
+			return 0;
+		if (p >= 1)
+			return 1ULL << 53;
+		return (quint64)(p * (qreal)(1ULL << 53));
+	}
+
+private:
+	static inline quint64 rotl(quint64 x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	static quint64 splitmix64(quint64 &x) {
+		quint64 z = (x += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	quint64 s[4];
+};
+
+#endif // PRNG_H
@@ -46,27 +46,50 @@
 #include "pconsumer.h"
 #include "psender.h"
 #include "qpairingheap.h"
-#include "bitarray.h"
+#include "timingwheel.h"
+#include "timelinewriter.h"
+#include "../util/bitarray.h"
 #include "../line-gui/netgraph.h"
 #include "../util/util.h"
 #include "../tomo/tomodata.h"
+#include "../util/resultsfile.h"
+#include "../util/eventlog.h"
+#include "../util/livestats.h"
+#include "latencyhistogram.h"
+#include "idlestrategy.h"
 
 /// topology stuff
 
 #define DEBUG_CALLS 0
 #define DEBUG_FOREIGN_PACKETS 0
-#define BUSY_WAITING 1
-
-#define PACKET_EVENT_QUEUED  1
-#define PACKET_EVENT_QDROP   2
-#define PACKET_EVENT_RDROP   3
 
 NetGraph *netGraph;
 
+// record one in this many events in the full timelines
+int fullTimelineSampling = 1;
+
+// seed of the random loss generators; each edge has its own generator
+quint64 lossSeed = 1;
+
+QString liveStatsName = LIVESTATS_DEFAULT_NAME;
+LiveStats *liveStats = NULL;
+
 void NetGraphEdge::prepareEmulation()
 {
 	rate_Bps = 1000.0 * bandwidth;
-	lossRate_int = (int) (RAND_MAX * lossBernoulli);
+	prng.seed(lossSeed, index);
+	lossState = 0;
+	if (lossModel == LOSS_MODEL_GILBERT_ELLIOTT) {
+		lossThreshold[0] = Prng::probabilityThreshold(lossBernoulli);
+		lossThreshold[1] = Prng::probabilityThreshold(lossBad);
+		lossTransition[0] = Prng::probabilityThreshold(lossGoodToBad);
+		lossTransition[1] = Prng::probabilityThreshold(lossBadToGood);
+		lossEnabled = lossThreshold[0] > 0 || (lossThreshold[1] > 0 && lossTransition[0] > 0);
+	} else {
+		lossThreshold[0] = lossThreshold[1] = Prng::probabilityThreshold(lossBernoulli);
+		lossTransition[0] = lossTransition[1] = 0;
+		lossEnabled = lossThreshold[0] > 0;
+	}
 	qcapacity = queueLength * ETH_FRAME_LEN;
 
 	qload = 0;
@@ -83,25 +106,21 @@ void NetGraphEdge::prepareEmulation()
 	drops_history = 0;
 	drops_history_dcnt = 0;
 
+	// the streams are opened by startSchedulers()
+	timelineSampled = NULL;
+	timelineFull = NULL;
+	fullTimelineLog = NULL;
+	fullTimelineSkipped = 0;
+	packetEvents = NULL;
+	packetEventsWord = 0;
+	packetEventsBits = 0;
+	packetEventsValidWords = 0;
+	packetEventsLostWords = 0;
+
+	memset(&currentSample, 0, sizeof(currentSample));
 	if (recordSampledTimeline) {
-		edgeTimelineItem current;
-		memset(&current, 0, sizeof(current));
-
 		quint64 ts_now = get_current_time();
-		current.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
-		timelineSampled << current;
-
-		// preallocate for 60 seconds (but not more than some limit)
-		quint64 estimateSize = 60 * (SEC_TO_NSEC / timelineSamplingPeriod);
-		estimateSize = qMin(estimateSize, 100000ULL);
-		// timelineSampled.reserve(estimateSize);
-	}
-
-	if (recordFullTimeline) {
-		// preallocate for some number of packets
-		quint64 estimateSize = 10000;
-		estimateSize = qMin(estimateSize, 100000ULL);
-		// timelineFull.reserve(estimateSize);
+		currentSample.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
 	}
 }
 
@@ -113,6 +132,10 @@ void NetGraphPath::prepareEmulation()
 	bytes_out = 0;
 	total_theor_delay = 0;
 	total_actual_delay = 0;
+
+	// the stream is opened by startSchedulers(); a zero timestamp marks the sample as unused
+	timelineSampled = NULL;
+	memset(&currentSample, 0, sizeof(currentSample));
 }
 
 void NetGraph::prepareEmulation()
@@ -128,6 +151,33 @@ void NetGraph::prepareEmulation()
 		paths[i].prepareEmulation();
 		pathCache.insert(QPair<qint32,qint32>(paths[i].source, paths[i].dest), i);
 	}
+
+	// compile the forwarding plane; only path destinations need routes
+	destCount = 0;
+	destIndexByNode.fill(-1, nodes.count());
+	QVector<qint32> destinations;
+	for (int i = 0; i < paths.count(); i++) {
+		if (destIndexByNode[paths[i].dest] < 0) {
+			destIndexByNode[paths[i].dest] = destCount;
+			destinations.append(paths[i].dest);
+			destCount++;
+		}
+	}
+
+	forwardingTable.fill(-1, nodes.count() * destCount);
+	for (int n = 0; n < nodes.count(); n++) {
+		for (int di = 0; di < destCount; di++) {
+			qint32 nextHop = nodes[n].routes.nextHop(destinations[di]);
+			if (nextHop < 0)
+				continue;
+			forwardingTable[n * destCount + di] = edgeCache.value(QPair<qint32,qint32>(n, nextHop), -1);
+		}
+	}
+
+	pathTable.fill(-1, nodes.count() * destCount);
+	for (int i = 0; i < paths.count(); i++) {
+		pathTable[paths[i].source * destCount + destIndexByNode[paths[i].dest]] = i;
+	}
 }
 
 void loadTopology(QString graphFileName)
@@ -135,9 +185,24 @@ void loadTopology(QString graphFileName)
 	netGraph = new NetGraph();
 	netGraph->setFileName(graphFileName);
 	netGraph->loadFromFile();
+	printf("Random loss seed: %llu\n", lossSeed);
 	netGraph->prepareEmulation();
 }
 
+// Decides if the next packet is dropped by the loss model; draws no random numbers if there is no loss.
+inline bool NetGraphEdge::randomDrop()
+{
+	if (!lossEnabled)
+		return false;
+	if (lossModel == LOSS_MODEL_GILBERT_ELLIOTT) {
+		// state transition, then loss in the new state
+		if (prng.chance(lossTransition[lossState])) {
+			lossState = 1 - lossState;
+		}
+	}
+	return prng.chance(lossThreshold[lossState]);
+}
+
 /**
  * Enqueue a packet on a link.
  *
@@ -154,7 +219,6 @@ bool NetGraphEdge::enqueue(Packet *p, quint64 ts_now, quint64 &ts_exit)
 {
 	int decision = DECISION_QUEUE;
 	quint64 qdelay;
-	int randomVal;
 
 	// update the link ingress stats
 	packets_in++;
@@ -176,6 +240,10 @@ bool NetGraphEdge::enqueue(Packet *p, quint64 ts_now, quint64 &ts_exit)
 
 	qts_head = ts_now;
 
+	// the loss model steps for every arrival, so that the loss process does not depend on congestion;
+	// a packet that is also queue-dropped counts as a queue drop
+	bool lossDrop = randomDrop();
+
 	// queue drop?
 	if (qcapacity - qload < (quint64) p->length) {
 		qdrops++;
@@ -184,10 +252,9 @@ bool NetGraphEdge::enqueue(Packet *p, quint64 ts_now, quint64 &ts_exit)
 		goto stats;
 	}
 	// random drop?
-	randomVal = rand();
-	if (lossRate_int > 0 && randomVal < lossRate_int) {
+	if (lossDrop) {
 		rdrops++;
-		if (DEBUG_PACKETS) printf("Edge: Drop: %d.%d.%d.%d -> %d.%d.%d.%d: lossRate_int = %d, randomVal = %d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), lossRate_int, randomVal);
+		if (DEBUG_PACKETS) printf("Edge: Drop: %d.%d.%d.%d -> %d.%d.%d.%d: loss model = %d, loss state = %d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), lossModel, lossState);
 		decision = DECISION_RDROP;
 		goto stats;
 	}
@@ -210,36 +277,38 @@ bool NetGraphEdge::enqueue(Packet *p, quint64 ts_now, quint64 &ts_exit)
 stats:
 	// update stats
 	if (recordSampledTimeline) {
-		if (ts_now >= timelineSampled.last().timestamp + timelineSamplingPeriod) {
-			// new time bracket, insert new aggregate
-			edgeTimelineItem current;
-			memset(&current, 0, sizeof(current));
+		if (ts_now >= currentSample.timestamp + timelineSamplingPeriod) {
+			// new time bracket, write out the finished aggregate and start a new one
+			timelineSampled->push(&currentSample, sizeof(currentSample) / sizeof(quint64));
+			memset(&currentSample, 0, sizeof(currentSample));
 
-			current.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
-			current.queue_sampled = qload;
-
-			timelineSampled << current;
+			currentSample.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
+			currentSample.queue_sampled = qload;
 		}
-		// we're in the same time bracket, update the last item
-		timelineSampled.last().arrivals_p++;
-		timelineSampled.last().arrivals_B += p->length;
+		// we're in the same time bracket, update the current item
+		currentSample.arrivals_p++;
+		currentSample.arrivals_B += p->length;
 		if (decision == DECISION_QDROP) {
-			timelineSampled.last().qdrops_p++;
-			timelineSampled.last().qdrops_B += p->length;
+			currentSample.qdrops_p++;
+			currentSample.qdrops_B += p->length;
 		}
 		if (decision == DECISION_RDROP) {
-			timelineSampled.last().rdrops_p++;
-			timelineSampled.last().rdrops_B += p->length;
+			currentSample.rdrops_p++;
+			currentSample.rdrops_B += p->length;
 		}
-		timelineSampled.last().queue_avg += qload;
-		timelineSampled.last().queue_max = qMax(timelineSampled.last().queue_max, qload);
+		currentSample.queue_avg += qload;
+		currentSample.queue_max = qMax(currentSample.queue_max, qload);
 	}
 
-	if (recordFullTimeline) {
-		packetEvent current;
-		current.timestamp = ts_now;
-		current.type = (decision == DECISION_QUEUE) ? PACKET_EVENT_QUEUED : (decision == DECISION_QDROP) ? PACKET_EVENT_QDROP : PACKET_EVENT_RDROP;
-		timelineFull << current;
+	if (recordFullTimeline && ++fullTimelineSkipped >= (quint32)fullTimelineSampling) {
+		fullTimelineSkipped = 0;
+		int type = (decision == DECISION_QUEUE) ? PACKET_EVENT_QUEUED : (decision == DECISION_QDROP) ? PACKET_EVENT_QDROP : PACKET_EVENT_RDROP;
+		if (!fullTimelineLog->append(ts_now, type)) {
+			// block full, write it out and start a new one
+			timelineFull->push(&fullTimelineLog->block, EVENTLOG_BLOCK_WORDS);
+			fullTimelineLog->reset();
+			fullTimelineLog->append(ts_now, type);
+		}
 	}
 
 	if (decision == DECISION_QDROP || decision == DECISION_RDROP) {
@@ -249,17 +318,17 @@ stats:
 		drops_lastts = ts_now;
 	}
 
-	if (decision == DECISION_QDROP || decision == DECISION_RDROP) {
-		drops_history = (drops_history << 1) | 1ULL;
-		if (recordSampledTimeline) {
-			packetEvents << 1;
-		}
-	} else {
-		if (drops_history & (1ULL << 63))
-			drops_history_dcnt--;
-		drops_history = (drops_history << 1);
-		if (recordSampledTimeline) {
-			packetEvents << 0;
+	drops_history = (drops_history << 1) | (decision != DECISION_QUEUE ? 1ULL : 0ULL);
+	drops_history_dcnt = bitCountOnes(drops_history);
+
+	if (recordSampledTimeline) {
+		// the first event goes in the least significant bit
+		packetEventsWord |= (decision != DECISION_QUEUE ? 1ULL : 0ULL) << packetEventsBits;
+		packetEventsBits++;
+		if (packetEventsBits == 64) {
+			packetEvents->push(&packetEventsWord, 1);
+			packetEventsWord = 0;
+			packetEventsBits = 0;
 		}
 	}
 
@@ -267,96 +336,257 @@ stats:
 	return (decision == DECISION_QUEUE);
 }
 
-#define PKT_QUEUED    0
-#define PKT_DROPPED   1
-#define PKT_FORWARDED 2
-int routePacket(Packet *p, quint64 ts_now, quint64 &ts_next)
+/// scheduler shards
+
+#define HANDOFF_QUEUE_CAPACITY 16384
+typedef SpscRing<Packet*, HANDOFF_QUEUE_CAPACITY> HandoffQueue;
+
+int schedulerShardCount = 1;
+int schedulerShardMode = SHARD_BY_COMPONENT;
+
+static SchedulerShard shards[MAX_SCHEDULER_SHARDS];
+static int shardCount = 1;
+// maps edge ID -> shard index
+static QVector<qint32> edgeShard;
+// handoffQueues[from][to]; the event time of a handed off packet is stored in Packet::wheelTime
+static HandoffQueue handoffQueues[MAX_SCHEDULER_SHARDS][MAX_SCHEDULER_SHARDS];
+
+static int findRoot(QVector<int> &parent, int x)
+{
+	while (parent[x] != x) {
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+	return x;
+}
+
+void partitionShards()
+{
+	int requested = qBound(1, schedulerShardCount, MAX_SCHEDULER_SHARDS);
+	edgeShard.fill(0, netGraph->edges.count());
+	shardCount = 1;
+
+	if (requested > 1 && schedulerShardMode == SHARD_BY_COMPONENT) {
+		// connected subgraphs of the used edges (ignoring direction)
+		QVector<int> parent(netGraph->nodes.count());
+		for (int n = 0; n < parent.count(); n++) {
+			parent[n] = n;
+		}
+		foreach (NetGraphEdge e, netGraph->edges) {
+			if (e.used) {
+				parent[findRoot(parent, e.source)] = findRoot(parent, e.dest);
+			}
+		}
+		QHash<int, QList<int> > componentEdges;
+		foreach (NetGraphEdge e, netGraph->edges) {
+			if (e.used) {
+				componentEdges[findRoot(parent, e.source)] << e.index;
+			}
+		}
+		// largest components first, each one on the least loaded shard
+		QList<QPair<int, int> > components;
+		foreach (int root, componentEdges.keys()) {
+			components << QPair<int, int>(-componentEdges[root].count(), root);
+		}
+		qSort(components);
+		shardCount = qMin(requested, components.count());
+		shardCount = qMax(shardCount, 1);
+		QVector<int> load(shardCount, 0);
+		for (int c = 0; c < components.count(); c++) {
+			int target = 0;
+			for (int s = 1; s < shardCount; s++) {
+				if (load[s] < load[target])
+					target = s;
+			}
+			foreach (int e, componentEdges[components[c].second]) {
+				edgeShard[e] = target;
+			}
+			load[target] += componentEdges[components[c].second].count();
+		}
+	} else if (requested > 1 && schedulerShardMode == SHARD_BY_EDGE) {
+		// used edges round robin; a packet may be handed off at every hop
+		shardCount = requested;
+		int next = 0;
+		foreach (NetGraphEdge e, netGraph->edges) {
+			if (e.used) {
+				edgeShard[e.index] = next;
+				next = (next + 1) % shardCount;
+			}
+		}
+	}
+
+	if (shardCount < requested) {
+		printf("Scheduler: only %d independent subgraphs, using %d shards instead of %d\n", shardCount, shardCount, requested);
+	}
+	schedulerShardCount = shardCount;
+	printf("Scheduler: %d shard(s)\n", shardCount);
+}
+
+// Returns the shard that owns the edge on which the packet must be enqueued next, or -1 if there is none
+static inline int nextHopShard(Packet *p)
+{
+	if (p->current_node == p->dst_id)
+		return -1;
+	qint32 edgeIndex = netGraph->forwardingEdge(p->current_node < 0 ? p->src_id : p->current_node, p->dst_index);
+	if (edgeIndex < 0)
+		return -1;
+	return edgeShard.at(edgeIndex);
+}
+
+int classifyPacket(Packet *p)
 {
-	NetGraphPath &path = netGraph->pathByNodeIndex(p->src_id, p->dst_id);
+	if (p->src_id < 0 || p->src_id >= netGraph->nodes.count() ||
+		p->dst_id < 0 || p->dst_id >= netGraph->nodes.count() ||
+		(p->dst_index = netGraph->destIndexByNode.at(p->dst_id)) < 0 ||
+		(p->path_index = netGraph->pathIndex(p->src_id, p->dst_index)) < 0) {
+		// foreign packet
+		return -1;
+	}
+	if (shardCount == 1)
+		return 0;
+	return qMax(0, nextHopShard(p));
+}
+
+// Records the current node in the packet trace (if enabled)
+static inline void traceHop(Packet *p)
+{
+#if PACKET_TRACE
+	if (p->edgecount < PACKET_TRACE_MAX_HOPS) {
+		p->trace[p->edgecount] = p->current_node;
+	}
+#else
+	Q_UNUSED(p);
+#endif
+}
+
+// Returns the sample of the current sampling period of the path.
+// When a new period begins, the finished sample is written out.
+static inline pathTimelineItem &pathSample(NetGraphPath &path, quint64 ts_now)
+{
+	pathTimelineItem &sample = path.currentSample;
+	if (ts_now >= sample.timestamp + path.timelineSamplingPeriod) {
+		if (sample.timestamp > 0) {
+			path.timelineSampled->push(&sample, sizeof(sample) / sizeof(quint64));
+		}
+		memset(&sample, 0, sizeof(sample));
+		sample.timestamp = (ts_now / path.timelineSamplingPeriod) * path.timelineSamplingPeriod;
+		sample.delay_min = ULLONG_MAX;
+	}
+	return sample;
+}
+
+// Records that the statistics of an edge or path changed and must be published
+static inline void markEdgeDirty(SchedulerShard &shard, qint32 edgeIndex)
+{
+	if (liveStats && !(*shard.edgeDirty)[edgeIndex]) {
+		(*shard.edgeDirty)[edgeIndex] = 1;
+		shard.dirtyEdges->append(edgeIndex);
+	}
+}
+
+static inline void markPathDirty(SchedulerShard &shard, qint32 pathIndex)
+{
+	if (liveStats && !(*shard.pathDirty)[pathIndex]) {
+		(*shard.pathDirty)[pathIndex] = 1;
+		shard.dirtyPaths->append(pathIndex);
+	}
+}
+
+int routePacket(SchedulerShard &shard, Packet *p, quint64 ts_now, quint64 &ts_next)
+{
+	NetGraphPath &path = (*shard.paths)[p->path_index];
 
 	// is this a new packet?
-	if (p->trace.isEmpty()) {
+	if (p->current_node < 0) {
 		// yes, update path ingress stats
-		p->trace << p->src_id;
+		p->current_node = p->src_id;
+		traceHop(p);
 		if (DEBUG_PACKETS) printf("New packet %d.%d.%d.%d -> %d.%d.%d.%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip));
 
 		path.packets_in++;
 		path.bytes_in += p->length;
+		markPathDirty(shard, p->path_index);
 
 		if (path.recordSampledTimeline) {
-			if (ts_now >= path.timelineSampled.last().timestamp + path.timelineSamplingPeriod) {
-				pathTimelineItem current;
-				memset(&current, 0, sizeof(current));
-				current.timestamp = (ts_now / path.timelineSamplingPeriod) * path.timelineSamplingPeriod;
-				path.timelineSampled << current;
-			}
-			path.timelineSampled.last().arrivals_p++;
-			path.timelineSampled.last().arrivals_B += p->length;
+			pathTimelineItem &sample = pathSample(path, ts_now);
+			sample.arrivals_p++;
+			sample.arrivals_B += p->length;
 		}
 	} // did it reach the destination?
 
-	if (p->trace.last() == p->dst_id) {
+	if (p->current_node == p->dst_id) {
 		// yes, forward the packet
 		p->ts_start_send = ts_now;
+		p->ts_end_proc = shard.ts_loop;
 		if (DEBUG_PACKETS) printf("Forwarding packet %d.%d.%d.%d -> %d.%d.%d.%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip));
+#if PACKET_TRACE
+		if (DEBUG_PACKETS) {
+			printf("Packet trace (%d edges):", p->edgecount);
+			for (int i = 0; i <= p->edgecount && i < PACKET_TRACE_MAX_HOPS; i++) {
+				printf(" %d", p->trace[i]);
+			}
+			printf("\n");
+		}
+#endif
+
+		// the sender owns the packet once it is queued, so keep what the stats need
+		qint32 pathIndex = p->path_index;
+		int length = p->length;
+		quint64 theoreticalDelay = p->theoretical_delay;
+		quint64 actualDelay = p->ts_start_send - p->ts_driver_rx;
+		if (!packetsOut[shard.index].enqueue(p)) {
+			// sender queue full, the packet is dropped on the path
+			if (path.recordSampledTimeline) {
+				pathTimelineItem &sample = pathSample(path, ts_now);
+				sample.drops_p++;
+				sample.drops_B += length;
+			}
+			return PKT_DROPPED;
+		}
 
 		// update path egress stats
 		path.packets_out++;
-		path.bytes_out += p->length;
-		path.total_theor_delay += p->theoretical_delay;
-		path.total_actual_delay += p->ts_start_send - p->ts_driver_rx;
+		path.bytes_out += length;
+		path.total_theor_delay += theoreticalDelay;
+		path.total_actual_delay += actualDelay;
+		markPathDirty(shard, pathIndex);
 		if (path.recordSampledTimeline) {
-			if (ts_now >= path.timelineSampled.last().timestamp + path.timelineSamplingPeriod) {
-				pathTimelineItem current;
-				memset(&current, 0, sizeof(current));
-				current.timestamp = (ts_now / path.timelineSamplingPeriod) * path.timelineSamplingPeriod;
-				current.delay_min = ULLONG_MAX;
-				path.timelineSampled << current;
-			}
-			path.timelineSampled.last().exits_p++;
-			path.timelineSampled.last().exits_B += p->length;
-			path.timelineSampled.last().delay_total += p->theoretical_delay;
-			path.timelineSampled.last().delay_max = qMax(path.timelineSampled.last().delay_max, p->theoretical_delay);
-			path.timelineSampled.last().delay_min = qMin(path.timelineSampled.last().delay_min, p->theoretical_delay);
+			pathTimelineItem &sample = pathSample(path, ts_now);
+			sample.exits_p++;
+			sample.exits_B += length;
+			sample.delay_total += theoreticalDelay;
+			sample.delay_max = qMax(sample.delay_max, theoreticalDelay);
+			sample.delay_min = qMin(sample.delay_min, theoreticalDelay);
 		}
-
-		packetsOut.enqueue(p);
 		return PKT_FORWARDED;
 	}
 
-	// we need to forward it, find the route
-	Route r = netGraph->nodes[p->trace.last()].routes.routes.value(p->dst_id, Route(-1, -1));
-	if (r.destination < 0) {
+	// we need to forward it, find the outgoing edge
+	qint32 edgeIndex = netGraph->forwardingEdge(p->current_node, p->dst_index);
+	if (edgeIndex < 0) {
 		// no route, update path stats
-		if (DEBUG_PACKETS) printf("No route for packet %d.%d.%d.%d -> %d.%d.%d.%d, node=%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), p->trace.last());
+		if (DEBUG_PACKETS) printf("No route for packet %d.%d.%d.%d -> %d.%d.%d.%d, node=%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), p->current_node);
 		if (path.recordSampledTimeline) {
-			if (ts_now >= path.timelineSampled.last().timestamp + path.timelineSamplingPeriod) {
-				pathTimelineItem current;
-				memset(&current, 0, sizeof(current));
-				current.timestamp = (ts_now / path.timelineSamplingPeriod) * path.timelineSamplingPeriod;
-				path.timelineSampled << current;
-			}
-			path.timelineSampled.last().drops_p++;
-			path.timelineSampled.last().drops_B += p->length;
+			pathTimelineItem &sample = pathSample(path, ts_now);
+			sample.drops_p++;
+			sample.drops_B += p->length;
 		}
 		return PKT_DROPPED;
 	} else {
-		NetGraphEdge e = netGraph->edgeByNodeIndex(p->trace.last(), r.nextHop);
-		if (DEBUG_PACKETS) printf("Found route for packet %d.%d.%d.%d -> %d.%d.%d.%d, node=%d, next hop=%d, edge = %d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), p->trace.last(), r.nextHop, e.index);
-		p->trace << r.nextHop;
-		if (netGraph->edges[e.index].enqueue(p, ts_now, ts_next)) {
+		NetGraphEdge &e = netGraph->edges[edgeIndex];
+		if (DEBUG_PACKETS) printf("Found route for packet %d.%d.%d.%d -> %d.%d.%d.%d, node=%d, next hop=%d, edge = %d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), p->current_node, e.dest, e.index);
+		p->current_node = e.dest;
+		p->edgecount++;
+		traceHop(p);
+		markEdgeDirty(shard, edgeIndex);
+		if (e.enqueue(p, ts_now, ts_next)) {
 			return PKT_QUEUED;
 		} else {
 			// packet dropped, update path stats
 			if (path.recordSampledTimeline) {
-				if (ts_now >= path.timelineSampled.last().timestamp + path.timelineSamplingPeriod) {
-					pathTimelineItem current;
-					memset(&current, 0, sizeof(current));
-					current.timestamp = (ts_now / path.timelineSamplingPeriod) * path.timelineSamplingPeriod;
-					path.timelineSampled << current;
-				}
-				path.timelineSampled.last().drops_p++;
-				path.timelineSampled.last().drops_B += p->length;
+				pathTimelineItem &sample = pathSample(path, ts_now);
+				sample.drops_p++;
+				sample.drops_B += p->length;
 			}
 			return PKT_DROPPED;
 		}
@@ -388,101 +618,283 @@ QString timeToString(quint64 value)
 	}
 }
 
-void saveEdgeTimelinesBinary(NetGraphEdge e, quint64 tsMin, quint64 tsMax)
-{
-	// now create arrays for everything
-	QVector<quint64> vector_timestamp;
-	QVector<quint64> vector_arrivals_p;
-	QVector<quint64> vector_arrivals_B;
-	QVector<quint64> vector_qdrops_p;
-	QVector<quint64> vector_qdrops_B;
-	QVector<quint64> vector_rdrops_p;
-	QVector<quint64> vector_rdrops_B;
-	QVector<quint64> vector_queue_sampled;
-	QVector<quint64> vector_queue_avg;
-	QVector<quint64> vector_queue_max;
-
-	{
-		QFile file(QString("timelines-edge-%1.dat").arg(e.index));
-		file.open(QIODevice::WriteOnly);
-		QDataStream out(&file);
-		out.setVersion(QDataStream::Qt_4_0);
-
-		// edge timeline range
-		out << tsMin;
-		out << tsMax;
-
-		// edge properties
-		out << e.timelineSamplingPeriod;
-		out << e.rate_Bps;
-		out << e.delay_ms;
-		out << e.qcapacity;
-
-		// unroll RLE data
-		quint64 lastTs = 0;
-		quint64 samplingPeriod = e.timelineSamplingPeriod;
-		quint64 lastQueueSampled = 0;
-		quint64 lastQueueAvg = 0;
-		quint64 lastQueueMax = 0;
-
-		foreach (edgeTimelineItem item, e.timelineSampled) {
-			// "extrapolate"
-			while (item.timestamp > tsMin + lastTs + samplingPeriod) {
-				quint64 delta = ((e.rate_Bps * samplingPeriod) / SEC_TO_NSEC);
-				lastQueueSampled = (delta < lastQueueSampled) ? lastQueueSampled-delta : 0;
-				lastQueueAvg = (delta < lastQueueAvg) ? lastQueueAvg-delta : 0;
-				lastQueueMax = (delta < lastQueueMax) ? lastQueueMax-delta : 0;
-
-				lastTs += samplingPeriod;
-				vector_timestamp << lastTs;
-				vector_arrivals_p << 0;
-				vector_arrivals_B << 0;
-				vector_qdrops_p << 0;
-				vector_qdrops_B << 0;
-				vector_rdrops_p << 0;
-				vector_rdrops_B << 0;
-				vector_queue_sampled << lastQueueSampled;
-				vector_queue_avg << lastQueueAvg;
-				vector_queue_max << lastQueueMax;
+// Files written by the timeline streams during the emulation
+static QString edgeTimelineFileName(int edge)
+{
+	return QString("timeline-edge-%1.raw").arg(edge);
+}
+
+static QString edgeFullTimelineFileName(int edge)
+{
+	return QString("fulltimeline-edge-%1.raw").arg(edge);
+}
+
+static QString edgePacketEventsFileName(int edge)
+{
+	return QString("packetevents-edge-%1.raw").arg(edge);
+}
+
+static QString pathTimelineFileName(int path, int shard)
+{
+	return QString("timeline-path-%1-shard-%2.raw").arg(path).arg(shard);
+}
+
+// Extends [tsMin, tsMax] with the timestamps of the first and last records of a timeline file.
+// The timestamp must be the first member of T.
+template<typename T>
+static void updateTimelineRange(QString fileName, quint64 &tsMin, quint64 &tsMax)
+{
+	TimelineReader<T> reader(fileName);
+	T first, last;
+	if (reader.count() > 0 && reader.at(0, first) && reader.at(reader.count() - 1, last)) {
+		tsMin = qMin(tsMin, first.timestamp);
+		tsMax = qMax(tsMax, last.timestamp);
+	}
+}
+
+// Extends [tsMin, tsMax] with the first and last events of an event log file
+static void updateEventLogRange(QString fileName, quint64 &tsMin, quint64 &tsMax)
+{
+	TimelineReader<EventLogBlock> reader(fileName);
+	EventLogBlock first, last;
+	if (reader.count() > 0 && reader.at(0, first) && reader.at(reader.count() - 1, last)) {
+		tsMin = qMin(tsMin, first.baseTimestamp);
+		EventLogDecoder decoder(&last);
+		quint64 timestamp;
+		int type;
+		while (decoder.next(timestamp, type)) {
+			tsMax = qMax(tsMax, timestamp);
+		}
+		if (decoder.isCorrupt()) {
+			fprintf(stderr, "Corrupt event log block in %s\n", fileName.toLatin1().constData());
+		}
+	}
+}
+
+// Value of a column of an edge timeline (one of RESULTS_EDGE_xxx)
+static inline quint64 edgeColumnValue(const edgeTimelineItem &item, int column, quint64 tsMin)
+{
+	switch (column) {
+		case RESULTS_EDGE_TIMESTAMP: return item.timestamp - tsMin;
+		case RESULTS_EDGE_ARRIVALS_P: return item.arrivals_p;
+		case RESULTS_EDGE_ARRIVALS_B: return item.arrivals_B;
+		case RESULTS_EDGE_QDROPS_P: return item.qdrops_p;
+		case RESULTS_EDGE_QDROPS_B: return item.qdrops_B;
+		case RESULTS_EDGE_RDROPS_P: return item.rdrops_p;
+		case RESULTS_EDGE_RDROPS_B: return item.rdrops_B;
+		case RESULTS_EDGE_QUEUE_SAMPLED: return item.queue_sampled;
+		case RESULTS_EDGE_QUEUE_AVG: return item.arrivals_p ? item.queue_avg / item.arrivals_p : 0;
+		case RESULTS_EDGE_QUEUE_MAX: return item.queue_max;
+	}
+	return 0;
+}
+
+// Value of a column of a path timeline (one of RESULTS_PATH_xxx)
+static inline quint64 pathColumnValue(const pathTimelineItem &item, int column, quint64 tsMin)
+{
+	switch (column) {
+		case RESULTS_PATH_TIMESTAMP: return item.timestamp - tsMin;
+		case RESULTS_PATH_ARRIVALS_P: return item.arrivals_p;
+		case RESULTS_PATH_ARRIVALS_B: return item.arrivals_B;
+		case RESULTS_PATH_EXITS_P: return item.exits_p;
+		case RESULTS_PATH_EXITS_B: return item.exits_B;
+		case RESULTS_PATH_DROPS_P: return item.drops_p;
+		case RESULTS_PATH_DROPS_B: return item.drops_B;
+		case RESULTS_PATH_DELAY_TOTAL: return item.delay_total;
+		case RESULTS_PATH_DELAY_MAX: return item.delay_max;
+		case RESULTS_PATH_DELAY_MIN: return item.delay_min;
+	}
+	return 0;
+}
+
+// Merges by timestamp the timelines of a path written by the shards, one record at a time
+class PathTimelineMerger {
+public:
+	PathTimelineMerger(int path) {
+		for (int shard = 0; shard < shardCount; shard++) {
+			readers << new TimelineReader<pathTimelineItem>(pathTimelineFileName(path, shard));
+		}
+		heads.resize(shardCount);
+		valid.resize(shardCount);
+		rewind();
+	}
+
+	~PathTimelineMerger() {
+		qDeleteAll(readers);
+	}
+
+	// Upper bound of the number of merged records
+	quint64 maxCount() {
+		quint64 count = 0;
+		foreach (TimelineReader<pathTimelineItem> *reader, readers) {
+			count += reader->count();
+		}
+		return count;
+	}
+
+	void rewind() {
+		for (int s = 0; s < readers.count(); s++) {
+			readers[s]->rewind();
+			valid[s] = readers[s]->next(heads[s]);
+		}
+	}
+
+	bool next(pathTimelineItem &item) {
+		int first = -1;
+		for (int s = 0; s < readers.count(); s++) {
+			if (valid[s] && (first < 0 || heads[s].timestamp < heads[first].timestamp))
+				first = s;
+		}
+		if (first < 0)
+			return false;
+		item = heads[first];
+		valid[first] = readers[first]->next(heads[first]);
+		for (int s = 0; s < readers.count(); s++) {
+			if (valid[s] && heads[s].timestamp == item.timestamp) {
+				item.arrivals_p += heads[s].arrivals_p;
+				item.arrivals_B += heads[s].arrivals_B;
+				item.exits_p += heads[s].exits_p;
+				item.exits_B += heads[s].exits_B;
+				item.drops_p += heads[s].drops_p;
+				item.drops_B += heads[s].drops_B;
+				item.delay_total += heads[s].delay_total;
+				item.delay_max = qMax(item.delay_max, heads[s].delay_max);
+				item.delay_min = qMin(item.delay_min, heads[s].delay_min);
+				valid[s] = readers[s]->next(heads[s]);
 			}
+		}
+		return true;
+	}
 
-			lastTs = item.timestamp - tsMin;
-			lastQueueSampled = item.queue_sampled;
-			lastQueueAvg = item.arrivals_p ? item.queue_avg / item.arrivals_p : 0;
-			lastQueueMax = item.queue_max;
+private:
+	QList<TimelineReader<pathTimelineItem>*> readers;
+	QVector<pathTimelineItem> heads;
+	QVector<bool> valid;
+};
+
+// Number of timeline records converted to columns at a time
+#define RESULTS_CHUNK_ROWS 4096
+
+// Reads a timeline once and splits its records into columns of up to maxRows values each,
+// one chunk of records at a time. Sets columnOffset and returns the number of records.
+template<typename Timeline, typename Item>
+static quint64 writeTimelineColumns(ResultsFileWriter &results, Timeline &timeline, quint64 maxRows,
+									int columns, quint64 (*columnValue)(const Item &, int, quint64),
+									quint64 tsMin, quint64 *columnOffset)
+{
+	quint64 start = results.beginColumns(columns, maxRows);
+	for (int column = 0; column < columns; column++) {
+		columnOffset[column] = start + column * maxRows * sizeof(quint64);
+	}
+	QVector<quint64> chunk(columns * RESULTS_CHUNK_ROWS);
+	quint64 rows = 0;
+	Item item;
+	while (rows < maxRows) {
+		int count = 0;
+		while (count < RESULTS_CHUNK_ROWS && rows + count < maxRows && timeline.next(item)) {
+			for (int column = 0; column < columns; column++) {
+				chunk[column * RESULTS_CHUNK_ROWS + count] = columnValue(item, column, tsMin);
+			}
+			count++;
+		}
+		if (count == 0)
+			break;
+		for (int column = 0; column < columns; column++) {
+			results.writeColumn(columnOffset[column], rows, chunk.constData() + column * RESULTS_CHUNK_ROWS, count);
+		}
+		rows += count;
+	}
+	results.endColumns();
+	return rows;
+}
 
-			vector_timestamp << lastTs;
-			vector_arrivals_p << item.arrivals_p;
-			vector_arrivals_B << item.arrivals_B;
-			vector_qdrops_p << item.qdrops_p;
-			vector_qdrops_B << item.qdrops_B;
-			vector_rdrops_p << item.rdrops_p;
-			vector_rdrops_B << item.rdrops_B;
-			vector_queue_sampled << lastQueueSampled;
-			vector_queue_avg << lastQueueAvg;
-			vector_queue_max << lastQueueMax;
+// Converts the raw timeline files to the results file loaded by the GUI, then removes them.
+// Each raw file is read once, and only a chunk of records is kept in memory.
+static void saveResultsFile(quint64 tsMin, quint64 tsMax)
+{
+	ResultsFileWriter results;
+	if (!results.open("results.dat", netGraph->edges.count(), netGraph->paths.count(), tsMin, tsMax))
+		return;
+
+	QStringList rawFiles;
+	for (int i = 0; i < netGraph->edges.count(); i++) {
+		const NetGraphEdge &e = netGraph->edges[i];
+		ResultsEdgeSection &section = results.edge(i);
+		section.samplingPeriod = e.timelineSamplingPeriod;
+		section.rate_Bps = e.rate_Bps;
+		section.qcapacity = e.qcapacity;
+		section.delay_ms = e.delay_ms;
+		section.packets_in = e.packets_in;
+		section.qdrops = e.qdrops;
+		section.rdrops = e.rdrops;
+		if (!e.recordSampledTimeline)
+			continue;
+
+		TimelineReader<edgeTimelineItem> timeline(edgeTimelineFileName(i));
+		section.sampleCount = writeTimelineColumns(results, timeline, timeline.count(), RESULTS_EDGE_COLUMNS,
+												   edgeColumnValue, tsMin, section.columnOffset);
+
+		// the last word may be partial; the events after a lost word cannot be matched to their packets
+		TimelineReader<quint64> events(edgePacketEventsFileName(i));
+		section.eventCount = qMin(e.packets_in, qMin(events.count(), e.packetEventsValidWords) * 64);
+		section.eventsLost = e.packetEventsLostWords;
+		if (e.packetEventsLostWords > 0) {
+			fprintf(stderr, "Edge %d: %llu packet event words lost, keeping only the first %llu events\n", i, e.packetEventsLostWords, section.eventCount);
+		}
+		section.eventsOffset = results.beginColumn();
+		quint64 word;
+		for (quint64 w = 0; w < (section.eventCount + 63) / 64 && events.next(word); w++) {
+			results.append(word);
 		}
 
-		// write the data
-		out << vector_timestamp;
-		out << vector_arrivals_p;
-		out << vector_arrivals_B;
-		out << vector_qdrops_p;
-		out << vector_qdrops_B;
-		out << vector_rdrops_p;
-		out << vector_rdrops_B;
-		out << vector_queue_sampled;
-		out << vector_queue_avg;
-		out << vector_queue_max;
+		rawFiles << edgeTimelineFileName(i) << edgePacketEventsFileName(i);
 	}
 
-	{
-		QFile file(QString("packetevents-edge-%1.dat").arg(e.index));
-		file.open(QIODevice::WriteOnly);
-		QDataStream out(&file);
-		out.setVersion(QDataStream::Qt_4_0);
+	// full timelines, copied block by block
+	for (int i = 0; i < netGraph->edges.count(); i++) {
+		const NetGraphEdge &e = netGraph->edges[i];
+		if (!e.recordFullTimeline)
+			continue;
+		ResultsEdgeSection &section = results.edge(i);
+		TimelineReader<EventLogBlock> log(edgeFullTimelineFileName(i));
+		section.fullTimelineSampling = fullTimelineSampling;
+		section.fullTimelineBlocks = log.count();
+		section.fullTimelineOffset = results.beginColumn();
+		EventLogBlock block;
+		for (quint64 b = 0; b < section.fullTimelineBlocks && log.next(block); b++) {
+			const quint64 *words = (const quint64*)&block;
+			for (int w = 0; w < EVENTLOG_BLOCK_WORDS; w++) {
+				results.append(words[w]);
+			}
+		}
+		rawFiles << edgeFullTimelineFileName(i);
+	}
+
+	for (int i = 0; i < netGraph->paths.count(); i++) {
+		const NetGraphPath &p = netGraph->paths[i];
+		ResultsPathSection &section = results.path(i);
+		section.samplingPeriod = p.timelineSamplingPeriod;
+		section.packets_in = p.packets_in;
+		section.packets_out = p.packets_out;
+		if (!p.recordSampledTimeline)
+			continue;
+
+		// the shards may have samples for the same period, so the columns can be shorter than the room reserved
+		PathTimelineMerger timeline(i);
+		section.sampleCount = writeTimelineColumns(results, timeline, timeline.maxCount(), RESULTS_PATH_COLUMNS,
+												   pathColumnValue, tsMin, section.columnOffset);
+
+		for (int shard = 0; shard < shardCount; shard++) {
+			rawFiles << pathTimelineFileName(i, shard);
+		}
+	}
 
-		out << e.packetEvents.toVector();
+	if (!results.close()) {
+		fprintf(stderr, "Could not write the results file, keeping the raw timelines\n");
+		return;
+	}
+	foreach (QString fileName, rawFiles) {
+		QFile::remove(fileName);
 	}
 }
 
@@ -549,80 +961,140 @@ void saveRecordedData()
 	tomoData.tsMax = 0;
 
 	foreach (NetGraphEdge e, netGraph->edges) {
-		if (e.recordFullTimeline && !e.timelineFull.isEmpty()) {
-			tomoData.tsMin = qMin(tomoData.tsMin, e.timelineFull.first().timestamp);
-			tomoData.tsMax = qMax(tomoData.tsMax, e.timelineFull.last().timestamp);
+		if (e.recordFullTimeline) {
+			updateEventLogRange(edgeFullTimelineFileName(e.index), tomoData.tsMin, tomoData.tsMax);
 		}
-		if (e.recordSampledTimeline && !e.timelineSampled.isEmpty()) {
-			tomoData.tsMin = qMin(tomoData.tsMin, e.timelineSampled.first().timestamp);
-			tomoData.tsMax = qMax(tomoData.tsMax, e.timelineSampled.last().timestamp);
+		if (e.recordSampledTimeline) {
+			updateTimelineRange<edgeTimelineItem>(edgeTimelineFileName(e.index), tomoData.tsMin, tomoData.tsMax);
 		}
 	}
-	foreach (NetGraphPath p, netGraph->paths) {
-		if (p.recordSampledTimeline && !p.timelineSampled.isEmpty()) {
-			tomoData.tsMin = qMin(tomoData.tsMin, p.timelineSampled.first().timestamp);
-			tomoData.tsMax = qMax(tomoData.tsMax, p.timelineSampled.last().timestamp);
+	for (int i = 0; i < netGraph->paths.count(); i++) {
+		if (netGraph->paths[i].recordSampledTimeline) {
+			for (int shard = 0; shard < shardCount; shard++) {
+				updateTimelineRange<pathTimelineItem>(pathTimelineFileName(i, shard), tomoData.tsMin, tomoData.tsMax);
+			}
 		}
 	}
 
 	tomoData.save("tomo-records.dat");
 
-	// edge timeline aggregates/samples
-	foreach (NetGraphEdge e, netGraph->edges) {
-		saveEdgeTimelinesBinary(e, tomoData.tsMin, tomoData.tsMax);
-	}
+	// edge and path timelines
+	saveResultsFile(tomoData.tsMin, tomoData.tsMax);
 }
 
-void* packet_scheduler_thread(void* )
+int eventQueueType = EVENT_QUEUE_WHEEL;
+
+// Routes a packet that arrived at its current node at time ts_event, and queues the next event
+template<typename EventQueue>
+static inline void schedulePacket(SchedulerShard &shard, EventQueue &eventQueue, Packet *p, quint64 ts_event, quint64 ts_now)
 {
-	u_int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
-	u_long core_id = CORE_SCHEDULER % numCPU;
+	quint64 ts_next_event = ts_event;
+	int pkt_state = routePacket(shard, p, ts_event, ts_next_event);
+	if (pkt_state == PKT_QUEUED) {
+		if (DEBUG_PACKETS) printf("Enqueue: %d.%d.%d.%d -> %d.%d.%d.%d, for time = +%llu ns, edgecount = %d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), ts_next_event - ts_now, p->edgecount);
+		eventQueue.insert(p, ts_next_event);
+	} else if (pkt_state == PKT_DROPPED) {
+		if (DEBUG_PACKETS) printf("Drop: %d.%d.%d.%d -> %d.%d.%d.%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip));
+		shard.packetsQdropped++;
+		PacketPool::release(p, PACKET_POOL_THREAD_SCHEDULER(shard.index));
+	}
+}
 
-	if (numCPU > 1) {
-		if (bind2core(core_id) == 0) {
-			printf("Set thread scheduler affinity to core %lu/%u\n", core_id, numCPU);
+// Copies the counters of the shard, and of the edges and paths changed since the last update,
+// to the statistics segment.
+static void publishLiveStats(SchedulerShard &shard, quint64 ts_now)
+{
+	LiveStatsShard shardStats;
+	shardStats.timestamp = ts_now;
+	shardStats.loops = shard.total_loops;
+	shardStats.totalLoopDelay = shard.total_loop_delay;
+	shardStats.maxLoopDelay = shard.max_loop_delay;
+	shardStats.packetsQdropped = shard.packetsQdropped;
+	shardStats.handoffs = shard.handoffs;
+	shardStats.handoffOverflows = shard.handoffOverflows;
+	liveStatsPublish(liveStats->shard(shard.index), shardStats);
+
+	QVector<qint32> &dirtyEdges = *shard.dirtyEdges;
+	int stillDirty = 0;
+	for (int i = 0; i < dirtyEdges.count(); i++) {
+		qint32 edgeIndex = dirtyEdges[i];
+		NetGraphEdge &e = netGraph->edges[edgeIndex];
+		LiveStatsEdge edgeStats;
+		edgeStats.timestamp = ts_now;
+		edgeStats.packets_in = e.packets_in;
+		edgeStats.bytes_in = e.bytes;
+		edgeStats.qdrops = e.qdrops;
+		edgeStats.rdrops = e.rdrops;
+		// the queue is only updated on arrivals; account for what was sent since then
+		edgeStats.qload = e.qload;
+		if (ts_now > e.qts_head) {
+			edgeStats.qload -= qMin(e.qload, ((ts_now - e.qts_head) * e.rate_Bps) / SEC_TO_NSEC);
+		}
+		edgeStats.qcapacity = e.qcapacity;
+		liveStatsPublish(liveStats->edge(edgeIndex), edgeStats);
+		// keep publishing the queue while it drains
+		if (edgeStats.qload > 0) {
+			dirtyEdges[stillDirty++] = edgeIndex;
 		} else {
-			printf("Failed to set thread scheduler affinity to core %lu/%u\n", core_id, numCPU);
+			(*shard.edgeDirty)[edgeIndex] = 0;
 		}
 	}
+	dirtyEdges.resize(stillDirty);
+
+	QList<NetGraphPath> &paths = *shard.paths;
+	foreach (qint32 pathIndex, *shard.dirtyPaths) {
+		const NetGraphPath &path = paths[pathIndex];
+		LiveStatsPath pathStats;
+		pathStats.timestamp = ts_now;
+		pathStats.packets_in = path.packets_in;
+		pathStats.packets_out = path.packets_out;
+		pathStats.bytes_in = path.bytes_in;
+		pathStats.bytes_out = path.bytes_out;
+		pathStats.total_theor_delay = path.total_theor_delay;
+		pathStats.total_actual_delay = path.total_actual_delay;
+		liveStatsPublish(liveStats->path(shard.index, pathIndex), pathStats);
+		(*shard.pathDirty)[pathIndex] = 0;
+	}
+	shard.dirtyPaths->resize(0);
+	shard.ts_live_stats = ts_now;
+}
 
-	QPairingHeap<Packet*> eventQueue;
-
-	quint64 max_loop_delay = 0;
-	quint64 total_loop_delay = 0;
-	quint64 total_loops = 0;
-	quint64 packetsQdropped = 0;
+// The scheduler main loop, instantiated for each event queue implementation
+template<typename EventQueue>
+void runScheduler(SchedulerShard &shard, EventQueue &eventQueue)
+{
+	IdleStrategy idle(schedulerIdleStrategy, LATENCY_THREAD_SCHEDULER(shard.index));
 	while (1) {
 		if (do_shutdown) {
-            printf("Scheduler non-idle loop time:\nAverage "TS_FORMAT", Max "TS_FORMAT"\n", TS_FORMAT_PARAM(total_loop_delay / total_loops), TS_FORMAT_PARAM(max_loop_delay));
 			break;
 		}
 
-		// process new packets
-		QLinkedList<Packet*> newPackets = packetsIn.dequeueAll();
+		// process new packets, a batch from each receive channel
+		Packet *newPackets[MAX_RX_CHANNELS * PACKET_BATCH_SIZE];
+		int newPacketCount = 0;
+		for (int channel = 0; channel < rxChannelCount; channel++) {
+			newPacketCount += packetsIn[channel][shard.index].dequeueBatch(newPackets + newPacketCount, PACKET_BATCH_SIZE);
+		}
 		quint64 ts_now = get_current_time();
+		shard.ts_loop = ts_now;
 
-		bool receivedPackets = !newPackets.isEmpty();
-		while (!newPackets.isEmpty()) {
+		bool receivedPackets = newPacketCount > 0;
+		for (int i = 0; i < newPacketCount; i++) {
 			// new packet arrived
-			Packet *p = newPackets.takeFirst();
+			Packet *p = newPackets[i];
 			p->ts_start_proc = ts_now;
-			if (p->src_id < 0 || p->src_id >= netGraph->nodes.count() ||
-				p->dst_id < 0 || p->dst_id >= netGraph->nodes.count()) {
-				// foreign packet
-				if (DEBUG_PACKETS) printf("Bad packet %d.%d.%d.%d -> %d.%d.%d.%d (src = %d, dst = %d)\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), p->src_id, p->dst_id);
-				delete p;
+			recordLatency(LATENCY_THREAD_SCHEDULER(shard.index), LATENCY_STAGE_QUEUEING, ts_now - p->ts_userspace_rx);
+			schedulePacket(shard, eventQueue, p, ts_now, ts_now);
+		}
+
+		// process packets handed off by the other shards
+		for (int from = 0; from < shardCount; from++) {
+			if (from == shard.index)
 				continue;
-			}
-            quint64 ts_next_event = ts_now;
-            int pkt_state = routePacket(p, ts_now, ts_next_event);
-			if (pkt_state == PKT_QUEUED) {
-				if (DEBUG_PACKETS) printf("Enqueue: %d.%d.%d.%d -> %d.%d.%d.%d, for time = +%llu ns, edgecount = %d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), ts_next_event - ts_now, p->edgecount);
-				eventQueue.insert(p, ts_next_event);
-			} else if (pkt_state == PKT_DROPPED) {
-				if (DEBUG_PACKETS) printf("Drop: %d.%d.%d.%d -> %d.%d.%d.%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip));
-				packetsQdropped++;
-				delete p;
+			int count = handoffQueues[from][shard.index].dequeueBatch(newPackets, PACKET_BATCH_SIZE);
+			receivedPackets = receivedPackets || count > 0;
+			for (int i = 0; i < count; i++) {
+				schedulePacket(shard, eventQueue, newPackets[i], newPackets[i]->wheelTime, ts_now);
 			}
 		}
 
@@ -634,45 +1106,293 @@ void* packet_scheduler_thread(void* )
 			if (event.second <= ts_now) {
 				eventQueue.deleteMin();
 				receivedEvents = true;
+				recordLatency(LATENCY_THREAD_SCHEDULER(shard.index), LATENCY_STAGE_LATENESS, ts_now - event.second);
 
 				Packet *p = event.first;
 				// quint64 ts_event = event.second;
 
-                quint64 ts_next_event = 0;
-                int pkt_state = routePacket(p, event.second, ts_next_event);
-				if (pkt_state == PKT_QUEUED) {
-					if (DEBUG_PACKETS) printf("Enqueue: %d.%d.%d.%d -> %d.%d.%d.%d, for time = +%llu ns, edgecount = %d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip), ts_next_event - ts_now, p->edgecount);
-					eventQueue.insert(p, ts_next_event);
-				} else if (pkt_state == PKT_DROPPED) {
-					if (DEBUG_PACKETS) printf("Drop: %d.%d.%d.%d -> %d.%d.%d.%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip));
-					packetsQdropped++;
-					delete p;
+				if (shardCount > 1) {
+					// is the next edge owned by another shard?
+					int owner = nextHopShard(p);
+					if (owner >= 0 && owner != shard.index) {
+						p->wheelTime = event.second;
+						if (handoffQueues[shard.index][owner].enqueue(p)) {
+							shard.handoffs++;
+						} else {
+							shard.handoffOverflows++;
+							shard.packetsQdropped++;
+							PacketPool::release(p, PACKET_POOL_THREAD_SCHEDULER(shard.index));
+						}
+						continue;
+					}
 				}
+
+				schedulePacket(shard, eventQueue, p, event.second, ts_now);
 			} else {
 				ts_next_queued_event = event.second;
 				break;
 			}
 		}
+		PacketPool::flushAll(PACKET_POOL_THREAD_SCHEDULER(shard.index));
+
 		// begin stats
 		quint64 ts_after = get_current_time();
-		max_loop_delay = qMax(max_loop_delay, ts_after - ts_now);
+		shard.max_loop_delay = qMax(shard.max_loop_delay, ts_after - ts_now);
         if (receivedPackets || receivedEvents) {
-            total_loop_delay += ts_after - ts_now;
-            total_loops++;
+            shard.total_loop_delay += ts_after - ts_now;
+            shard.total_loops++;
         }
+		if (liveStats && ts_after - shard.ts_live_stats >= LIVESTATS_PUBLISH_PERIOD) {
+			publishLiveStats(shard, ts_after);
+		}
 		// end stats
 
-#if BUSY_WAITING
-		if (!receivedPackets && !receivedEvents && ts_next_queued_event > ts_after + 10 * MSEC_TO_NSEC)
-			sched_yield();
-#endif
+		if (receivedPackets || receivedEvents) {
+			idle.busy();
+		} else {
+			idle.idle(ts_next_queued_event);
+		}
 
 		// qDebug() << "Loop took < " << max_loop_delay << "ns";
 	}
+	if (liveStats) {
+		publishLiveStats(shard, get_current_time());
+	}
+	if (idle.strategy != IDLE_SPIN) {
+		printf("Scheduler %d idle (%s): %llu yields, %llu sleeps\n", shard.index, idleStrategyName(idle.strategy), idle.yields, idle.sleeps);
+	}
+}
 
-	printf("Total packets qdropped: %llu\n", packetsQdropped);
+void* packet_scheduler_thread(void* arg)
+{
+	SchedulerShard &shard = *(SchedulerShard*)arg;
 
-	saveRecordedData();
+	u_int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
+	u_long core_id = (shard.index == 0 ? CORE_SCHEDULER : CORE_SCHEDULER_EXTRA + shard.index - 1) % numCPU;
+
+	if (numCPU > 1) {
+		if (bind2core(core_id) == 0) {
+			printf("Set thread scheduler %d affinity to core %lu/%u\n", shard.index, core_id, numCPU);
+		} else {
+			printf("Failed to set thread scheduler %d affinity to core %lu/%u\n", shard.index, core_id, numCPU);
+		}
+	}
+
+	if (eventQueueType == EVENT_QUEUE_HEAP) {
+		printf("Scheduler %d event queue: pairing heap\n", shard.index);
+		QPairingHeap<Packet*> eventQueue;
+		runScheduler(shard, eventQueue);
+	} else {
+		printf("Scheduler %d event queue: timing wheel\n", shard.index);
+		TimingWheel<Packet> *eventQueue = new TimingWheel<Packet>();
+		runScheduler(shard, *eventQueue);
+		delete eventQueue;
+	}
 
 	return(NULL);
 }
+
+// Shortest time between two packets on an edge: minimum size Ethernet frames at the edge rate
+static quint64 edgePacketInterval(const NetGraphEdge &e)
+{
+	return (64ULL * SEC_TO_NSEC) / qMax(e.rate_Bps, 1ULL) + 1;
+}
+
+// Creates the streams of the edges and paths that record timelines.
+// Each shard has its own copy of the paths, so each one writes its own path timelines.
+// Exits if the files cannot be opened.
+static void openTimelineStreams()
+{
+	int streamCount = 0;
+	foreach (NetGraphEdge e, netGraph->edges) {
+		streamCount += (e.recordSampledTimeline ? 2 : 0) + (e.recordFullTimeline ? 1 : 0);
+	}
+	foreach (NetGraphPath p, netGraph->paths) {
+		streamCount += p.recordSampledTimeline ? shardCount : 0;
+	}
+	if (!reserveTimelineFiles(streamCount)) {
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < netGraph->edges.count(); i++) {
+		NetGraphEdge &e = netGraph->edges[i];
+		quint64 packetInterval = edgePacketInterval(e);
+		if (e.recordSampledTimeline) {
+			e.timelineSampled = createTimelineStream(edgeTimelineFileName(e.index),
+													 timelineRingWords(sizeof(edgeTimelineItem) / sizeof(quint64), e.timelineSamplingPeriod));
+			// one word every 64 packets
+			e.packetEvents = createTimelineStream(edgePacketEventsFileName(e.index),
+												  timelineRingWords(1, 64 * packetInterval));
+		}
+		if (e.recordFullTimeline) {
+			// one block every (payload size / largest event) recorded packets
+			quint64 blockInterval = packetInterval * fullTimelineSampling * (EVENTLOG_PAYLOAD_SIZE / EVENTLOG_MAX_EVENT_SIZE);
+			e.timelineFull = createTimelineStream(edgeFullTimelineFileName(e.index),
+												  timelineRingWords(EVENTLOG_BLOCK_WORDS, blockInterval));
+			e.fullTimelineLog = new EventLogEncoder();
+		}
+	}
+	for (int s = 0; s < shardCount; s++) {
+		QList<NetGraphPath> &paths = *shards[s].paths;
+		for (int i = 0; i < paths.count(); i++) {
+			if (paths[i].recordSampledTimeline) {
+				paths[i].timelineSampled = createTimelineStream(pathTimelineFileName(i, s),
+																timelineRingWords(sizeof(pathTimelineItem) / sizeof(quint64), paths[i].timelineSamplingPeriod));
+			}
+		}
+	}
+}
+
+// Writes out the samples of the last sampling period and stops the writer.
+// Called after the scheduler threads have exited.
+static void closeTimelineStreams()
+{
+	for (int i = 0; i < netGraph->edges.count(); i++) {
+		NetGraphEdge &e = netGraph->edges[i];
+		if (e.recordSampledTimeline) {
+			e.timelineSampled->push(&e.currentSample, sizeof(e.currentSample) / sizeof(quint64));
+			if (e.packetEventsBits > 0) {
+				e.packetEvents->push(&e.packetEventsWord, 1);
+			}
+			// a lost word shifts all the events after it, so only the words before it are kept
+			e.packetEventsValidWords = e.packetEvents->getRecordsBeforeLoss();
+			e.packetEventsLostWords = e.packetEvents->getLostRecords();
+		}
+		if (e.recordFullTimeline && !e.fullTimelineLog->isEmpty()) {
+			e.timelineFull->push(&e.fullTimelineLog->block, EVENTLOG_BLOCK_WORDS);
+		}
+		delete e.fullTimelineLog;
+		e.fullTimelineLog = NULL;
+		e.timelineSampled = NULL;
+		e.timelineFull = NULL;
+		e.packetEvents = NULL;
+	}
+	for (int s = 0; s < shardCount; s++) {
+		QList<NetGraphPath> &paths = *shards[s].paths;
+		for (int i = 0; i < paths.count(); i++) {
+			if (paths[i].recordSampledTimeline && paths[i].currentSample.timestamp > 0) {
+				paths[i].timelineSampled->push(&paths[i].currentSample, sizeof(paths[i].currentSample) / sizeof(quint64));
+			}
+			paths[i].timelineSampled = NULL;
+		}
+	}
+	stopTimelineWriter();
+}
+
+// Creates the statistics segment, before the schedulers start
+static void createLiveStats()
+{
+	if (liveStatsName.isEmpty())
+		return;
+	LiveStats *stats = new LiveStats();
+	if (!stats->create(liveStatsName, netGraph->edges.count(), netGraph->paths.count(), shardCount, rxChannelCount)) {
+		fprintf(stderr, "Live statistics are disabled\n");
+		delete stats;
+		return;
+	}
+	for (int i = 0; i < netGraph->edges.count(); i++) {
+		LiveStatsEdge edgeStats;
+		memset(&edgeStats, 0, sizeof(edgeStats));
+		edgeStats.qcapacity = netGraph->edges[i].qcapacity;
+		liveStatsPublish(stats->edge(i), edgeStats);
+	}
+	printf("Live statistics: shared memory segment %s\n", liveStatsName.toLatin1().constData());
+	__atomic_store_n(&liveStats, stats, __ATOMIC_RELEASE);
+}
+
+void closeLiveStats()
+{
+	if (!liveStats)
+		return;
+	delete liveStats;
+	liveStats = NULL;
+}
+
+void startSchedulers()
+{
+	partitionShards();
+	for (int i = 0; i < shardCount; i++) {
+		SchedulerShard &shard = shards[i];
+		memset(&shard, 0, sizeof(shard));
+		shard.index = i;
+		if (i == 0) {
+			shard.paths = &netGraph->paths;
+		} else {
+			shard.paths = new QList<NetGraphPath>(netGraph->paths);
+		}
+		shard.edges = new QVector<qint32>();
+		shard.dirtyEdges = new QVector<qint32>();
+		shard.dirtyPaths = new QVector<qint32>();
+		shard.edgeDirty = new QVector<quint8>(netGraph->edges.count(), 0);
+		shard.pathDirty = new QVector<quint8>(netGraph->paths.count(), 0);
+		// reserved so that the hot loop never reallocates them
+		shard.dirtyEdges->reserve(netGraph->edges.count());
+		shard.dirtyPaths->reserve(netGraph->paths.count());
+	}
+	foreach (NetGraphEdge e, netGraph->edges) {
+		if (e.used) {
+			shards[edgeShard[e.index]].edges->append(e.index);
+		}
+	}
+	createLiveStats();
+	openTimelineStreams();
+	startTimelineWriter();
+	for (int i = 0; i < shardCount; i++) {
+		pthread_create(&shards[i].thread, NULL, packet_scheduler_thread, &shards[i]);
+	}
+}
+
+// Adds the path statistics of a shard to the graph
+static void mergePathStatistics(const QList<NetGraphPath> &shardPaths)
+{
+	for (int i = 0; i < netGraph->paths.count(); i++) {
+		NetGraphPath &path = netGraph->paths[i];
+		const NetGraphPath &other = shardPaths[i];
+
+		path.packets_in += other.packets_in;
+		path.packets_out += other.packets_out;
+		path.bytes_in += other.bytes_in;
+		path.bytes_out += other.bytes_out;
+		path.total_theor_delay += other.total_theor_delay;
+		path.total_actual_delay += other.total_actual_delay;
+	}
+}
+
+void joinSchedulers()
+{
+	for (int i = 0; i < shardCount; i++) {
+		pthread_join(shards[i].thread, NULL);
+	}
+	closeTimelineStreams();
+
+	quint64 packetsQdropped = 0;
+	for (int i = 0; i < shardCount; i++) {
+		SchedulerShard &shard = shards[i];
+		if (shard.total_loops > 0) {
+			printf("Scheduler %d non-idle loop time:\nAverage "TS_FORMAT", Max "TS_FORMAT"\n", shard.index, TS_FORMAT_PARAM(shard.total_loop_delay / shard.total_loops), TS_FORMAT_PARAM(shard.max_loop_delay));
+		}
+		if (shardCount > 1) {
+			printf("Scheduler %d: packets qdropped: %llu, handed off: %llu, handoff queue overflows: %llu\n", shard.index, shard.packetsQdropped, shard.handoffs, shard.handoffOverflows);
+		}
+		packetsQdropped += shard.packetsQdropped;
+		delete shard.edges;
+		shard.edges = NULL;
+		delete shard.dirtyEdges;
+		shard.dirtyEdges = NULL;
+		delete shard.dirtyPaths;
+		shard.dirtyPaths = NULL;
+		delete shard.edgeDirty;
+		shard.edgeDirty = NULL;
+		delete shard.pathDirty;
+		shard.pathDirty = NULL;
+		if (i > 0) {
+			mergePathStatistics(*shard.paths);
+			delete shard.paths;
+			shard.paths = NULL;
+		}
+	}
+
+	printf("Total packets qdropped: %llu\n", packetsQdropped);
+
+	saveRecordedData();
+}
@@ -19,8 +19,100 @@
 #ifndef PSCHEDULER_H
 #define PSCHEDULER_H
 
+#include <QtCore>
+#include <pthread.h>
+
 #define CORE_SCHEDULER 1
+// the additional scheduler shards run on cores CORE_SCHEDULER_EXTRA, CORE_SCHEDULER_EXTRA + 1...
+#define CORE_SCHEDULER_EXTRA 3
+
+// Event queue implementations
+#define EVENT_QUEUE_HEAP  0
+#define EVENT_QUEUE_WHEEL 1
+
+extern int eventQueueType;
+
+// Scheduler sharding
+#define MAX_SCHEDULER_SHARDS 8
+// Each connected subgraph of the used edges is assigned to one shard (packets never cross shards)
+#define SHARD_BY_COMPONENT 0
+// Edges are spread over the shards (packets are handed off between shards)
+#define SHARD_BY_EDGE      1
+
+// Receive channels: each one has its own ring, consumer thread and input queue per shard
+#define MAX_RX_CHANNELS 4
+
+// Record one in this many events in the full timelines (--full-timeline-sampling)
+extern int fullTimelineSampling;
+// Seed of the random loss generators; each edge has its own generator (--seed)
+extern quint64 lossSeed;
+
+// Number of shards: the one requested on the command line until partitionShards() replaces it
+// with the number actually used, which may be lower
+extern int schedulerShardCount;
+extern int schedulerShardMode;
+
+class Packet;
+class NetGraph;
+class NetGraphPath;
+class LiveStats;
+
+// Shared memory statistics segment (see livestats.h); liveStats is NULL until the schedulers
+// start, or if liveStatsName is empty
+extern QString liveStatsName;
+extern LiveStats *liveStats;
+
+// The emulated topology
+extern NetGraph *netGraph;
+
+// One scheduler shard: the edges assigned to it are only touched by its thread
+struct SchedulerShard {
+	int index;
+	pthread_t thread;
+	// path statistics updated by this shard (shard 0 uses netGraph->paths directly)
+	QList<NetGraphPath> *paths;
+	// the used edges owned by this shard
+	QVector<qint32> *edges;
+	// edges and paths changed since the statistics were last published, and their flags
+	// (indexed by edge and path index) that keep the lists free of duplicates
+	QVector<qint32> *dirtyEdges;
+	QVector<qint32> *dirtyPaths;
+	QVector<quint8> *edgeDirty;
+	QVector<quint8> *pathDirty;
+
+	// statistics
+	quint64 max_loop_delay;
+	quint64 total_loop_delay;
+	quint64 total_loops;
+	quint64 packetsQdropped;
+	quint64 handoffs;
+	quint64 handoffOverflows;
+	// last time the statistics were published in the shared memory segment
+	quint64 ts_live_stats;
+	// time at the start of the current scheduler loop
+	quint64 ts_loop;
+};
+
+// Splits the edges of the loaded topology between the scheduler shards
+void partitionShards();
+// Computes the destination and path indices of a new packet.
+// Returns the shard that must process it, or -1 if the packet does not belong to the emulated network.
+int classifyPacket(Packet *p);
+
+// Starts one scheduler thread per shard
+void startSchedulers();
+// Waits for the scheduler threads, merges their statistics and saves the recorded data
+void joinSchedulers();
+// Removes the statistics segment; called after all the threads that publish statistics have exited
+void closeLiveStats();
 
 void* packet_scheduler_thread(void* );
 
+// Moves a packet that reached its current node at ts_now to the next edge of its path.
+// Returns one of PKT_xxx; if the packet is queued, ts_next is the time it leaves the edge.
+#define PKT_QUEUED    0
+#define PKT_DROPPED   1
+#define PKT_FORWARDED 2
+int routePacket(SchedulerShard &shard, Packet *p, quint64 ts_now, quint64 &ts_next);
+
 #endif // PSCHEDULER_H
@@ -47,11 +47,17 @@
 
 #include "psender.h"
 #include "pconsumer.h"
+#include "pcapbackend.h"
+#include "../util/livestats.h"
+#include "latencyhistogram.h"
+#include "idlestrategy.h"
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 #include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <errno.h>
 
-SpinlockedQueue<Packet*> packetsOut;
+PacketQueue packetsOut[MAX_SCHEDULER_SHARDS];
 
 
 #define __force
@@ -174,30 +180,9 @@ __wsum csum_partial(const void *buff, int len, __wsum wsum)
 	return (__force __wsum)result;
 }
 
-void inet_proto_csum_replace4(__sum16 *sum, __be32 from, __be32 to)
-{
-	__be32 diff[] = { ~from, to };
-	*sum = csum_fold(csum_partial(diff, sizeof(diff), ~csum_unfold(*sum)));
-}
-
-static inline void csum_replace4(__sum16 *sum, __be32 from, __be32 to)
-{
-	__be32 diff[] = { ~from, to };
-
-	*sum = csum_fold(csum_partial(diff, sizeof(diff), ~csum_unfold(*sum)));
-}
-
-void fix_addresses(Packet *p)
-{
-	struct iphdr *ip;
-	__be32 newaddr;
-
-	ip = (struct iphdr *)(p->buffer + p->offsets.l3_offset);
-
 #if DEBUG_PACKETS
-	unsigned int lsrc;
-	unsigned int ldst;
-
+static void print_packet_headers(Packet *p)
+{
 	printf("fix_addresses: packet srcip %d.%d.%d.%d, dstip %d.%d.%d.%d\n", NIPQUAD(p->src_ip), NIPQUAD(p->dst_ip)); fflush(stdout);
 	printf("Offsets: eth=%d, vlan=%d, L3 = %d, L4 = %d\n", p->offsets.eth_offset, p->offsets.vlan_offset, p->offsets.l3_offset, p->offsets.l4_offset);
 	for (int i = 0; i < 50; i++) {
@@ -234,43 +219,32 @@ void fix_addresses(Packet *p)
 		// udpping
 		printf("UDPP seqno:           %lld\n", *(quint64*)(&p->buffer[p->offsets.l4_offset + 8]));
 	}
-
-	lsrc = ntohl(ip->saddr);
-	ldst = ntohl(ip->daddr);
-	printf("fix_addresses: packet srcip %d.%d.%d.%d, dstip %d.%d.%d.%d, ttl %d\n", HIPQUAD(lsrc), HIPQUAD(ldst), ip->ttl); fflush(stdout);
+}
 #endif
 
-	newaddr = ip->saddr | MODEL_FORCEBIT;
-	if (ip->protocol == IPPROTO_UDP) {
-		struct udphdr *udp = (struct udphdr *)(((u8*)ip) + ip->ihl*4);
-		if (udp->check)
-			inet_proto_csum_replace4(&udp->check, ip->saddr, newaddr);
-	} else if (ip->protocol == IPPROTO_TCP) {
-		struct tcphdr *tcp = (struct tcphdr *)(((u8*)ip) + ip->ihl*4);
-		inet_proto_csum_replace4(&tcp->check, ip->saddr, newaddr);
-	}
-	csum_replace4(&ip->check, ip->saddr, newaddr);
-	ip->saddr = newaddr;
-
-	newaddr = ip->daddr & ~(MODEL_FORCEBIT);
-	if (ip->protocol == IPPROTO_UDP) {
-		struct udphdr *udp = (struct udphdr *)(((u8*)ip) + ip->ihl*4);
-		if (udp->check)
-			inet_proto_csum_replace4(&udp->check, ip->daddr, newaddr);
-	} else if (ip->protocol == IPPROTO_TCP) {
-		struct tcphdr *tcp = (struct tcphdr *)(((u8*)ip) + ip->ihl*4);
-		inet_proto_csum_replace4(&tcp->check, ip->daddr, newaddr);
-	}
-	csum_replace4(&ip->check, ip->daddr, newaddr);
-	ip->daddr = newaddr;
-
-
-
+// Rewrites the addresses of a burst of packets before they leave the emulated network:
+// the source gets MODEL_FORCEBIT and the destination loses it.
+// acceptPacket() only lets in packets whose destination has the bit and whose source does not,
+// so the bit moves from one address to the other, at the same position of a 16-bit word. The one's
+// complement sums of the IP header and of the TCP/UDP pseudo-header stay the same, and so do the
+// checksums: they need no update.
+static inline void fix_addresses(Packet **packets, int count)
+{
+	for (int i = 0; i < count; i++) {
+		struct iphdr *ip = (struct iphdr *)(packets[i]->buffer + packets[i]->offsets.l3_offset);
+#if DEBUG_PACKETS
+		print_packet_headers(packets[i]);
+#endif
+		Q_ASSERT((ip->saddr & MODEL_FORCEBIT) == 0 && (ip->daddr & MODEL_FORCEBIT) != 0);
+		ip->saddr |= MODEL_FORCEBIT;
+		ip->daddr &= ~(MODEL_FORCEBIT);
 #if DEBUG_PACKETS
-	lsrc = ntohl(ip->saddr);
-	ldst = ntohl(ip->daddr);
-	printf("fix_addresses: packet srcip %d.%d.%d.%d, dstip %d.%d.%d.%d, ttl %d\n", HIPQUAD(lsrc), HIPQUAD(ldst), ip->ttl); fflush(stdout);
+		unsigned int lsrc = ntohl(ip->saddr);
+		unsigned int ldst = ntohl(ip->daddr);
+		printf("fix_addresses: packet srcip %d.%d.%d.%d, dstip %d.%d.%d.%d, ttl %d\n", HIPQUAD(lsrc), HIPQUAD(ldst), ip->ttl); fflush(stdout);
+		printf("IP header checksum %s\n", csum_fold(csum_partial(ip, ip->ihl * 4, 0)) == 0 ? "ok" : "bad");
 #endif
+	}
 }
 
 quint64 packetsSent;
@@ -279,26 +253,22 @@ quint64 packetsSentErr25p;
 quint64 packetsSentErr50p;
 quint64 packetsSentErrpMax;
 quint64 packetsSentErrAvg;
+quint64 packetsSendRetries;
+quint64 packetsSendDropped;
+quint64 sendBatches;
 
-void send_packet(int fd_send, Packet *p)
+// Rewrites the addresses and timestamps the packets just before they are sent
+static inline void prepare_packets(Packet **packets, int count, quint64 ts_now)
 {
-	quint64 ts_now = get_current_time();
-	p->ts_send = ts_now;
-
-	fix_addresses(p);
-
-	struct sockaddr_in daddr;
-	daddr.sin_family = AF_INET;
-	daddr.sin_port = 0; // not needed in SOCK_RAW
-	memset(daddr.sin_zero, 0, sizeof(daddr.sin_zero));
-	daddr.sin_addr.s_addr = p->dst_ip;
-
-	if (sendto(fd_send, (char *)p->buffer + p->offsets.l3_offset, p->length - p->offsets.l3_offset, 0, (struct sockaddr *)&daddr, (socklen_t)sizeof(daddr)) < 0) {
-		perror("packet send error");
-		exit(EXIT_FAILURE);
+	fix_addresses(packets, count);
+	for (int i = 0; i < count; i++) {
+		packets[i]->ts_send = ts_now;
 	}
-	packetsSent++;
+}
 
+// Updates the delay error counters and gives the packet back to its pool
+static inline void account_packet(Packet *p)
+{
 	if (DEBUG_PACKETS) printf("Sent packet with length %d\n", p->length - p->offsets.l3_offset);
 
 	if (DEBUG_PACKETS) printf("Packet theor.delay = %llu ns, actual delay = %llu ns, error = %llu ns\n", p->theoretical_delay, p->ts_send - p->ts_userspace_rx, p->ts_send - p->ts_userspace_rx - p->theoretical_delay);
@@ -322,7 +292,116 @@ void send_packet(int fd_send, Packet *p)
 
 	packetsSentErrpMax = qMax(packetsSentErrpMax, errPercent);
 
-	delete p;
+	// latency histograms
+	if (p->ts_end_proc && p->ts_end_proc <= p->ts_send) {
+		recordLatency(LATENCY_THREAD_SENDER, LATENCY_STAGE_TX, p->ts_send - p->ts_end_proc);
+	}
+	qint64 absErr = (qint64)(p->ts_send - p->ts_userspace_rx) - (qint64)p->theoretical_delay;
+	recordLatency(LATENCY_THREAD_SENDER, LATENCY_STAGE_ERROR, absErr < 0 ? -absErr : absErr);
+
+	PacketPool::release(p, PACKET_POOL_THREAD_SENDER);
+}
+
+// Returns true for send errors caused by temporary back-pressure
+static inline bool isTransientSendError(int error)
+{
+	return error == ENOBUFS || error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+// Sends the packets with as few system calls as possible.
+// Transient errors are retried up to PACKET_TX_MAX_RETRIES times, then the packet is dropped.
+void send_packets(int fd_send, Packet **packets, int count)
+{
+	struct mmsghdr msgs[PACKET_TX_BATCH_SIZE];
+	struct iovec iovecs[PACKET_TX_BATCH_SIZE];
+	struct sockaddr_in daddrs[PACKET_TX_BATCH_SIZE];
+
+	Q_ASSERT(count <= PACKET_TX_BATCH_SIZE);
+
+	prepare_packets(packets, count, get_current_time());
+	for (int i = 0; i < count; i++) {
+		Packet *p = packets[i];
+
+		daddrs[i].sin_family = AF_INET;
+		daddrs[i].sin_port = 0; // not needed in SOCK_RAW
+		memset(daddrs[i].sin_zero, 0, sizeof(daddrs[i].sin_zero));
+		daddrs[i].sin_addr.s_addr = p->dst_ip;
+
+		iovecs[i].iov_base = (char *)p->buffer + p->offsets.l3_offset;
+		iovecs[i].iov_len = p->length - p->offsets.l3_offset;
+
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &daddrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(daddrs[i]);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	sendBatches++;
+
+	int next = 0;
+	int retries = 0;
+	while (next < count) {
+		int sent = sendmmsg(fd_send, &msgs[next], count - next, 0);
+		if (sent > 0) {
+			for (int i = next; i < next + sent; i++) {
+				account_packet(packets[i]);
+			}
+			packetsSent += sent;
+			next += sent;
+			retries = 0;
+			continue;
+		}
+		if (sent < 0 && !isTransientSendError(errno)) {
+			perror("packet send error");
+			exit(EXIT_FAILURE);
+		}
+		// the socket buffer is full, try again
+		packetsSendRetries++;
+		retries++;
+		if (retries > PACKET_TX_MAX_RETRIES) {
+			if (DEBUG_PACKETS) printf("Send buffer full, dropping packet\n");
+			PacketPool::release(packets[next], PACKET_POOL_THREAD_SENDER);
+			packetsSendDropped++;
+			next++;
+			retries = 0;
+		}
+	}
+}
+
+// Copies the sender counters to the statistics segment if LIVESTATS_PUBLISH_PERIOD has passed
+// since the last update, or if force is true. Returns false if the counters remain to be published.
+static bool publishSenderStats(quint64 ts_now, bool force)
+{
+	static quint64 ts_live_stats = 0;
+	LiveStats *stats = __atomic_load_n(&liveStats, __ATOMIC_ACQUIRE);
+	if (!stats)
+		return true;
+	if (!force && ts_now - ts_live_stats < LIVESTATS_PUBLISH_PERIOD)
+		return false;
+	LiveStatsSender senderStats;
+	senderStats.timestamp = ts_now;
+	senderStats.packetsSent = packetsSent;
+	senderStats.packetsSendDropped = packetsSendDropped;
+	senderStats.packetsSentErr10p = packetsSentErr10p;
+	senderStats.packetsSentErr25p = packetsSentErr25p;
+	senderStats.packetsSentErr50p = packetsSentErr50p;
+	senderStats.packetsSentErrpMax = packetsSentErrpMax;
+	senderStats.packetsSentErrSum = packetsSentErrAvg;
+	liveStatsPublish(&stats->header()->sender, senderStats);
+	ts_live_stats = ts_now;
+	return true;
+}
+
+// Writes the packets to the pcap sink instead of sending them
+void dump_packets(PcapSink &sink, Packet **packets, int count)
+{
+	prepare_packets(packets, count, get_current_time());
+	for (int i = 0; i < count; i++) {
+		sink.write(packets[i]);
+		account_packet(packets[i]);
+	}
+	packetsSent += count;
+	sendBatches++;
 }
 
 void* packet_sender_thread(void* )
@@ -338,16 +417,23 @@ void* packet_sender_thread(void* )
 		}
 	}
 
-	// create raw socket
-	int fd_send;
-	if ((fd_send = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) < 0) {
-		perror("error: cannot create raw IP socket (are you root?)");
-		exit(EXIT_FAILURE);
-	}
+	int fd_send = -1;
+	PcapSink sink;
+	if (!pcapOutputFile.isEmpty()) {
+		if (!sink.open(pcapOutputFile)) {
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		// create raw socket
+		if ((fd_send = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) < 0) {
+			perror("error: cannot create raw IP socket (are you root?)");
+			exit(EXIT_FAILURE);
+		}
 
-	int sendbuff = 98304;
-	if (setsockopt(fd_send, SOL_SOCKET, SO_SNDBUF, &sendbuff, sizeof(sendbuff)) < 0) {
-		fprintf(stderr, "Could not set SO_SNDBUF\n");
+		int sendbuff = 98304;
+		if (setsockopt(fd_send, SOL_SOCKET, SO_SNDBUF, &sendbuff, sizeof(sendbuff)) < 0) {
+			fprintf(stderr, "Could not set SO_SNDBUF\n");
+		}
 	}
 
 	packetsSent = 0;
@@ -356,6 +442,14 @@ void* packet_sender_thread(void* )
 	packetsSentErr50p = 0;
 	packetsSentErrpMax = 0;
 	packetsSentErrAvg = 0;
+	packetsSendRetries = 0;
+	packetsSendDropped = 0;
+	sendBatches = 0;
+	quint64 tsFirstSentPacket = 0;
+	bool statsDirty = false;
+	IdleStrategy idle(senderIdleStrategy, LATENCY_THREAD_SENDER);
+	// the shard drained first; rotated so that a busy shard does not starve the others
+	int firstShard = 0;
 
 	while (1) {
 		if (do_shutdown) {
@@ -363,22 +457,57 @@ void* packet_sender_thread(void* )
 		}
 
 		// process new packets
-		QLinkedList<Packet*> newPackets = packetsOut.dequeueAll();
-
-		while (!newPackets.isEmpty()) {
-			// new packet arrived
-			Packet *p = newPackets.takeFirst();
-			send_packet(fd_send, p);
+		Packet *newPackets[PACKET_TX_BATCH_SIZE];
+		int count = 0;
+		for (int i = 0; i < schedulerShardCount && count < PACKET_TX_BATCH_SIZE; i++) {
+			int shard = (firstShard + i) % schedulerShardCount;
+			count += packetsOut[shard].dequeueBatch(newPackets + count, PACKET_TX_BATCH_SIZE - count);
+		}
+		firstShard = (firstShard + 1) % schedulerShardCount;
+
+		if (count > 0) {
+			if (tsFirstSentPacket == 0)
+				tsFirstSentPacket = get_current_time();
+			if (fd_send >= 0) {
+				send_packets(fd_send, newPackets, count);
+			} else {
+				dump_packets(sink, newPackets, count);
+			}
+			statsDirty = true;
+		}
+		PacketPool::flushAll(PACKET_POOL_THREAD_SENDER);
+		if (statsDirty) {
+			statsDirty = !publishSenderStats(get_current_time(), false);
+		}
+		if (count > 0) {
+			idle.busy();
+		} else {
+			idle.idle();
 		}
 	}
+	publishSenderStats(get_current_time(), true);
 
-	close(fd_send);
+	if (fd_send >= 0) {
+		close(fd_send);
+	}
+	sink.close();
+
+	quint64 ts_end = get_current_time();
 
 	printf("Total packets sent: %llu\n", packetsSent);
+	printf("Packets sent per second: %f kpps\n", tsFirstSentPacket ? 1.0e6 * packetsSent / double(ts_end - tsFirstSentPacket) : 0.0);
+	printf("Average send batch size: %f packets of %d (%llu batches)\n", sendBatches ? (packetsSent + packetsSendDropped) / double(sendBatches) : 0.0, PACKET_TX_BATCH_SIZE, sendBatches);
+	printf("Send retries because of a full socket buffer: %llu, packets dropped after %d retries: %llu\n", packetsSendRetries, PACKET_TX_MAX_RETRIES, packetsSendDropped);
+	for (int i = 0; i < schedulerShardCount; i++) {
+		printf("Output queue %d: max depth %llu of %d, packets dropped because the queue was full: %llu\n", i, packetsOut[i].getMaxDepth(), PacketQueue::capacity(), packetsOut[i].getOverflows());
+	}
 	printf("Total packets sent with delay error > 10%%: %llu (%f%% of total packets)\n", packetsSentErr10p, (packetsSentErr10p * 100.0)/packetsSent);
 	printf("Total packets sent with delay error > 25%%: %llu (%f%% of total packets)\n", packetsSentErr25p, (packetsSentErr25p * 100.0)/packetsSent);
 	printf("Total packets sent with delay error > 50%%: %llu (%f%% of total packets)\n", packetsSentErr50p, (packetsSentErr50p * 100.0)/packetsSent);
 	printf("Average relative delay error: %f%%, Maximum relative delay error: %llu%%\n", packetsSentErrAvg / (float)packetsSent, packetsSentErrpMax);
+	if (idle.strategy != IDLE_SPIN) {
+		printf("Sender idle (%s): %llu yields, %llu sleeps\n", idleStrategyName(idle.strategy), idle.yields, idle.sleeps);
+	}
 
 	return(NULL);
 }
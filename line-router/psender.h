@@ -21,13 +21,18 @@
 
 #include <pfring.h>
 #include <QtCore>
-#include "spinlockedqueue.h"
 #include "pconsumer.h"
 
-extern SpinlockedQueue<Packet*> packetsOut;
+// one output queue per scheduler shard
+extern PacketQueue packetsOut[MAX_SCHEDULER_SHARDS];
 
 #define CORE_SENDER 2
 
+// Maximum number of packets sent with one system call
+#define PACKET_TX_BATCH_SIZE PACKET_BATCH_SIZE
+// Number of times a send is retried when the socket buffer is full, before the packet is dropped
+#define PACKET_TX_MAX_RETRIES 1000
+
 void* packet_sender_thread(void* );
 
 #endif // PSENDER_H
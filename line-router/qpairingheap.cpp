@@ -17,6 +17,9 @@
 */
 
 #include "qpairingheap.h"
+#include "timingwheel.h"
+
+#include <time.h>
 
 void QPairingHeap_test()
 {
@@ -75,30 +78,101 @@ void QPairingHeap_test()
 	Q_ASSERT(heap.isEmpty() && heapSim.isEmpty());
 }
 
-void QPairingHeap_testPerf()
+static quint64 testPerfTime()
 {
-	QPairingHeap<int> heap;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((quint64)ts.tv_sec) * 1000ULL * 1000ULL * 1000ULL + ((quint64)ts.tv_nsec);
+}
 
-	const int opCount = 1 * 1000 * 1000;
+struct EventQueueTestNode {
+	EventQueueTestNode *wheelNext;
+	quint64 wheelTime;
+};
 
+// A delay as seen by the scheduler: either the transmission time of a frame
+// (64..1514 B at 10 Mbps..1 Gbps) or the propagation delay of a link (1..100 ms).
+static quint64 testPerfRandomDelay()
+{
+	if (rand() % 2) {
+		quint64 frameSize = 64 + rand() % 1451;
+		quint64 rate_Bps = (1 + rand() % 100) * 1250000ULL;
+		return (frameSize * 1000ULL * 1000ULL * 1000ULL) / rate_Bps;
+	} else {
+		return (1 + rand() % 100) * 1000ULL * 1000ULL;
+	}
+}
+
+// Hold model: eventCount events in flight; each extracted event is rescheduled after a random delay.
+template<typename EventQueue>
+quint64 testPerfHold(EventQueue &queue, QVector<EventQueueTestNode> &nodes, int opCount)
+{
+	quint64 ts = 0;
+	for (int i = 0; i < nodes.count(); i++) {
+		queue.insert(&nodes[i], testPerfRandomDelay());
+	}
+	quint64 ts1 = testPerfTime();
 	for (int i = 0; i < opCount; i++) {
-		// insert or delete?
-		if (rand() % 2) {
-			// insert
-			quint64 x = rand();
-			heap.insert(0, x);
-		} else {
-			//delete
-			if (!heap.isEmpty()) {
-				heap.findMin().second;
-				heap.deleteMin();
+		QPair<EventQueueTestNode*, quint64> event = queue.findMin();
+		queue.deleteMin();
+		ts = event.second;
+		queue.insert(event.first, ts + testPerfRandomDelay());
+	}
+	quint64 ts2 = testPerfTime();
+	while (!queue.isEmpty()) {
+		queue.deleteMin();
+	}
+	return ts2 - ts1;
+}
+
+void QPairingHeap_testPerf()
+{
+	{
+		QPairingHeap<int> heap;
+
+		const int opCount = 1 * 1000 * 1000;
+
+		quint64 ts1 = testPerfTime();
+		for (int i = 0; i < opCount; i++) {
+			// insert or delete?
+			if (rand() % 2) {
+				// insert
+				quint64 x = rand();
+				heap.insert(0, x);
+			} else {
+				//delete
+				if (!heap.isEmpty()) {
+					heap.findMin().second;
+					heap.deleteMin();
+				}
 			}
 		}
+		//delete
+		while (!heap.isEmpty()) {
+			heap.findMin().second;
+			heap.deleteMin();
+		}
+		Q_ASSERT(heap.isEmpty());
+		quint64 ts2 = testPerfTime();
+		printf("Pairing heap, random priorities: %.1f ns/op\n", (ts2 - ts1) / (double)opCount);
 	}
-	//delete
-	while (!heap.isEmpty()) {
-		heap.findMin().second;
-		heap.deleteMin();
+
+	// compare the pairing heap and the timing wheel with realistic event times
+	const int opCount = 5 * 1000 * 1000;
+	QList<int> eventCounts = QList<int>() << 1000 << 10000 << 100000 << 300000;
+	foreach (int eventCount, eventCounts) {
+		QVector<EventQueueTestNode> nodes(eventCount);
+
+		srand(eventCount);
+		QPairingHeap<EventQueueTestNode*> heap;
+		quint64 tHeap = testPerfHold(heap, nodes, opCount);
+
+		srand(eventCount);
+		TimingWheel<EventQueueTestNode> *wheel = new TimingWheel<EventQueueTestNode>();
+		quint64 tWheel = testPerfHold(*wheel, nodes, opCount);
+		delete wheel;
+
+		printf("%d events in flight: pairing heap %.1f ns/event, timing wheel %.1f ns/event\n",
+			   eventCount, tHeap / (double)opCount, tWheel / (double)opCount);
 	}
-	Q_ASSERT(heap.isEmpty());
 }
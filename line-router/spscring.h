@@ -0,0 +1,262 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <QtCore>
+#include <stdlib.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Bounded single-producer/single-consumer ring buffer.
+// Exactly one thread may call the enqueue functions and exactly one (other) thread
+// may call the dequeue functions. No locks and no allocation after construction.
+// Capacity must be a power of 2.
+template<typename T, int Capacity>
+class SpscRing {
+public:
+	SpscRing() {
+		Q_ASSERT((Capacity & (Capacity - 1)) == 0);
+		head = 0;
+		tailCached = 0;
+		tail = 0;
+		headCached = 0;
+		maxDepth = 0;
+		overflows = 0;
+	}
+
+	// Producer side. Returns false if the ring is full (the item is not enqueued).
+	bool enqueue(T item) {
+		return enqueueBatch(&item, 1) == 1;
+	}
+
+	// Producer side. Enqueues up to count items, returns how many were enqueued.
+	int enqueueBatch(T *batch, int count) {
+		quint64 t = tail;
+		quint64 freeSlots = Capacity - (t - headCached);
+		if (freeSlots < (quint64)count) {
+			headCached = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+			freeSlots = Capacity - (t - headCached);
+		}
+		int n = qMin((quint64)count, freeSlots);
+		for (int i = 0; i < n; i++) {
+			items[(t + i) & (Capacity - 1)] = batch[i];
+		}
+		__atomic_store_n(&tail, t + n, __ATOMIC_RELEASE);
+		overflows += count - n;
+		maxDepth = qMax(maxDepth, t + n - headCached);
+		return n;
+	}
+
+	// Producer side. Enqueues all count items, or none if there is not enough room.
+	bool enqueueAll(T *batch, int count) {
+		quint64 t = tail;
+		if (Capacity - (t - headCached) < (quint64)count) {
+			headCached = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+			if (Capacity - (t - headCached) < (quint64)count) {
+				overflows += count;
+				return false;
+			}
+		}
+		return enqueueBatch(batch, count) == count;
+	}
+
+	// Consumer side. Returns NULL if the ring is empty.
+	T dequeue() {
+		T result = NULL;
+		dequeueBatch(&result, 1);
+		return result;
+	}
+
+	// Consumer side. Dequeues up to maxCount items into batch, returns how many were dequeued.
+	int dequeueBatch(T *batch, int maxCount) {
+		quint64 h = head;
+		quint64 available = tailCached - h;
+		if (available < (quint64)maxCount) {
+			tailCached = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+			available = tailCached - h;
+		}
+		int n = qMin((quint64)maxCount, available);
+		for (int i = 0; i < n; i++) {
+			batch[i] = items[(h + i) & (Capacity - 1)];
+		}
+		__atomic_store_n(&head, h + n, __ATOMIC_RELEASE);
+		return n;
+	}
+
+	// Number of items currently in the ring. Safe to call from any thread (approximate).
+	quint64 depth() const {
+		quint64 t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		quint64 h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+		return t - h;
+	}
+
+	// Highest depth seen by the producer (updated by the producer only).
+	quint64 getMaxDepth() const {
+		return maxDepth;
+	}
+
+	// Number of items rejected because the ring was full (updated by the producer only).
+	quint64 getOverflows() const {
+		return overflows;
+	}
+
+	static int capacity() {
+		return Capacity;
+	}
+
+private:
+	// consumer cache line
+	quint64 head __attribute__((aligned(CACHE_LINE_SIZE)));
+	quint64 tailCached;
+	// producer cache line
+	quint64 tail __attribute__((aligned(CACHE_LINE_SIZE)));
+	quint64 headCached;
+	quint64 maxDepth;
+	quint64 overflows;
+	// storage
+	T items[Capacity] __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+// Same as SpscRing, but the capacity is chosen at run time (rounded up to a power of 2)
+// and the items are allocated by init(). Used where a fixed capacity would waste memory.
+template<typename T>
+class SpscHeapRing {
+public:
+	SpscHeapRing() {
+		items = NULL;
+		mask = 0;
+		head = 0;
+		tailCached = 0;
+		tail = 0;
+		headCached = 0;
+		maxDepth = 0;
+		overflows = 0;
+	}
+
+	~SpscHeapRing() {
+		free(items);
+	}
+
+	// Allocates the items; must be called before the ring is shared between threads
+	bool init(quint64 minCapacity) {
+		quint64 capacity = 1;
+		while (capacity < minCapacity)
+			capacity <<= 1;
+		free(items);
+		items = NULL;
+		mask = 0;
+		if (posix_memalign((void**)&items, CACHE_LINE_SIZE, capacity * sizeof(T)) != 0) {
+			items = NULL;
+			return false;
+		}
+		mask = capacity - 1;
+		head = tailCached = tail = headCached = 0;
+		return true;
+	}
+
+	bool enqueue(T item) {
+		return enqueueBatch(&item, 1) == 1;
+	}
+
+	int enqueueBatch(T *batch, int count) {
+		quint64 t = tail;
+		quint64 freeSlots = capacity() - (t - headCached);
+		if (freeSlots < (quint64)count) {
+			headCached = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+			freeSlots = capacity() - (t - headCached);
+		}
+		int n = qMin((quint64)count, freeSlots);
+		for (int i = 0; i < n; i++) {
+			items[(t + i) & mask] = batch[i];
+		}
+		__atomic_store_n(&tail, t + n, __ATOMIC_RELEASE);
+		overflows += count - n;
+		maxDepth = qMax(maxDepth, t + n - headCached);
+		return n;
+	}
+
+	bool enqueueAll(T *batch, int count) {
+		quint64 t = tail;
+		if (capacity() - (t - headCached) < (quint64)count) {
+			headCached = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+			if (capacity() - (t - headCached) < (quint64)count) {
+				overflows += count;
+				return false;
+			}
+		}
+		return enqueueBatch(batch, count) == count;
+	}
+
+	T dequeue() {
+		T result = NULL;
+		dequeueBatch(&result, 1);
+		return result;
+	}
+
+	int dequeueBatch(T *batch, int maxCount) {
+		quint64 h = head;
+		quint64 available = tailCached - h;
+		if (available < (quint64)maxCount) {
+			tailCached = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+			available = tailCached - h;
+		}
+		int n = qMin((quint64)maxCount, available);
+		for (int i = 0; i < n; i++) {
+			batch[i] = items[(h + i) & mask];
+		}
+		__atomic_store_n(&head, h + n, __ATOMIC_RELEASE);
+		return n;
+	}
+
+	quint64 depth() const {
+		quint64 t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		quint64 h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+		return t - h;
+	}
+
+	quint64 getMaxDepth() const {
+		return maxDepth;
+	}
+
+	quint64 getOverflows() const {
+		return overflows;
+	}
+
+	// 0 until init() succeeds
+	quint64 capacity() const {
+		return items ? mask + 1 : 0;
+	}
+
+private:
+	Q_DISABLE_COPY(SpscHeapRing)
+
+	T *items;
+	quint64 mask;
+	// consumer cache line
+	quint64 head __attribute__((aligned(CACHE_LINE_SIZE)));
+	quint64 tailCached;
+	// producer cache line
+	quint64 tail __attribute__((aligned(CACHE_LINE_SIZE)));
+	quint64 headCached;
+	quint64 maxDepth;
+	quint64 overflows;
+};
+
+#endif // SPSCRING_H
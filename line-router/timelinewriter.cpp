@@ -0,0 +1,152 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "timelinewriter.h"
+#include "pconsumer.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+
+static QList<TimelineStream*> streams;
+static pthread_t writerThread;
+static bool writerRunning = false;
+static int writerStop = 0;
+
+TimelineStream::TimelineStream(QString fileName) :
+	fileName(fileName),
+	writeError(false)
+{
+	file = fopen(fileName.toLatin1().constData(), "wb");
+}
+
+TimelineStream::~TimelineStream()
+{
+	if (file) {
+		fclose(file);
+	}
+}
+
+int timelineRingWords(int recordWords, quint64 recordInterval)
+{
+	quint64 records = TIMELINE_RING_BUFFER_NS / qMax(recordInterval, 1ULL) + 1;
+	quint64 words = records * recordWords;
+	return qBound((quint64)qMax(TIMELINE_RING_MIN_WORDS, 2 * recordWords), words, (quint64)TIMELINE_RING_MAX_WORDS);
+}
+
+bool reserveTimelineFiles(int streamCount)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+		perror("getrlimit");
+		return false;
+	}
+	rlim_t needed = streamCount + TIMELINE_RESERVED_FDS;
+	if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+		if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed) {
+			fprintf(stderr, "The timelines need %d open files, but the limit is %llu; raise it with ulimit -n or record fewer timelines\n",
+					streamCount, (unsigned long long)limit.rlim_max);
+			return false;
+		}
+		limit.rlim_cur = needed;
+		if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+			fprintf(stderr, "Could not raise the open file limit to %llu for the timelines: %s\n",
+					(unsigned long long)needed, strerror(errno));
+			return false;
+		}
+	}
+	return true;
+}
+
+TimelineStream *createTimelineStream(QString fileName, int ringWords)
+{
+	Q_ASSERT(!writerRunning);
+	TimelineRingStream *stream = new TimelineRingStream(fileName);
+	if (!stream->isOpen()) {
+		fprintf(stderr, "Could not create the timeline file %s: %s\n", fileName.toLatin1().constData(), strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (!stream->ring.init(ringWords)) {
+		fprintf(stderr, "Could not allocate the timeline ring of %s (%d words)\n", fileName.toLatin1().constData(), ringWords);
+		exit(EXIT_FAILURE);
+	}
+	streams << stream;
+	return stream;
+}
+
+static void* timeline_writer_thread(void* )
+{
+	// not bound to a core: the thread sleeps most of the time
+	quint64 lastFlush = get_current_time();
+	quint64 wordsWritten = 0;
+	while (!__atomic_load_n(&writerStop, __ATOMIC_ACQUIRE)) {
+		int words = 0;
+		foreach (TimelineStream *stream, streams) {
+			words += stream->drain();
+		}
+		wordsWritten += words;
+
+		quint64 ts_now = get_current_time();
+		if (ts_now - lastFlush >= TIMELINE_WRITER_FLUSH_INTERVAL_NS) {
+			// make the data visible on disk even if the emulator is killed
+			fflush(NULL);
+			lastFlush = ts_now;
+		}
+		if (words == 0) {
+			usleep(TIMELINE_WRITER_INTERVAL_US);
+		}
+	}
+
+	printf("Timeline writer: %llu MB written\n", (wordsWritten * sizeof(quint64)) / (1024 * 1024));
+	return(NULL);
+}
+
+void startTimelineWriter()
+{
+	if (streams.isEmpty())
+		return;
+	writerStop = 0;
+	writerRunning = true;
+	pthread_create(&writerThread, NULL, timeline_writer_thread, NULL);
+}
+
+void stopTimelineWriter()
+{
+	if (writerRunning) {
+		__atomic_store_n(&writerStop, 1, __ATOMIC_RELEASE);
+		pthread_join(writerThread, NULL);
+		writerRunning = false;
+	}
+
+	// the producers have stopped, write what is left
+	quint64 lostRecords = 0;
+	foreach (TimelineStream *stream, streams) {
+		stream->drain();
+		lostRecords += stream->getLostRecords();
+		if (stream->writeError) {
+			fprintf(stderr, "Error writing the timeline file %s, the results are incomplete\n", stream->fileName.toLatin1().constData());
+		}
+		delete stream;
+	}
+	streams.clear();
+	if (lostRecords > 0) {
+		printf("Timeline records lost because the writer fell behind: %llu\n", lostRecords);
+	}
+}
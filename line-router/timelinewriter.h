@@ -0,0 +1,170 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TIMELINEWRITER_H
+#define TIMELINEWRITER_H
+
+#include <QtCore>
+#include <stdio.h>
+#include "spscring.h"
+
+// The rings hold the records produced in TIMELINE_RING_BUFFER_NS at the highest rate of the stream
+// (see timelineRingWords()), so that the writer can be delayed that long without losing records
+#define TIMELINE_RING_BUFFER_NS 200000000ULL
+#define TIMELINE_RING_MIN_WORDS 256
+#define TIMELINE_RING_MAX_WORDS (1 << 20)
+// File descriptors kept free for the rest of the emulator when checking the limit
+#define TIMELINE_RESERVED_FDS 64
+
+// How often the writer thread drains the rings and flushes the files
+#define TIMELINE_WRITER_INTERVAL_US 1000
+#define TIMELINE_WRITER_FLUSH_INTERVAL_NS 1000000000ULL
+
+// A stream of fixed-size records from one scheduler thread to a file.
+// Records are made of 64-bit words and are written in the native byte order, back to back.
+// The producer never blocks: if the writer falls behind and the ring is full, the record is lost and counted.
+// Streams where the position of a record is meaningful (e.g. packet events) are only valid up to the first loss.
+class TimelineStream {
+public:
+	TimelineStream(QString fileName);
+	virtual ~TimelineStream();
+
+	// Producer side
+	virtual bool push(const void *record, int words) = 0;
+	virtual quint64 getLostRecords() const = 0;
+	// Number of records queued before the first lost one (all of them if none was lost)
+	virtual quint64 getRecordsBeforeLoss() const = 0;
+
+	// Writer side: appends the queued records to the file, returns the number of words written
+	virtual int drain() = 0;
+
+	bool isOpen() const {
+		return file != NULL;
+	}
+
+	QString fileName;
+	// set by drain() if the file could not be written
+	bool writeError;
+
+protected:
+	FILE *file;
+};
+
+class TimelineRingStream : public TimelineStream {
+public:
+	TimelineRingStream(QString fileName) : TimelineStream(fileName) {
+		lostRecords = 0;
+		queuedRecords = 0;
+		firstLoss = 0;
+	}
+
+	bool push(const void *record, int words) {
+		if (!ring.enqueueAll((quint64*)record, words)) {
+			if (lostRecords == 0) {
+				firstLoss = queuedRecords;
+			}
+			lostRecords++;
+			return false;
+		}
+		queuedRecords++;
+		return true;
+	}
+
+	quint64 getLostRecords() const {
+		return lostRecords;
+	}
+
+	quint64 getRecordsBeforeLoss() const {
+		return lostRecords == 0 ? queuedRecords : firstLoss;
+	}
+
+	int drain() {
+		quint64 buffer[1024];
+		int total = 0;
+		int count;
+		while ((count = ring.dequeueBatch(buffer, 1024)) > 0) {
+			if (file && fwrite(buffer, sizeof(quint64), count, file) != (size_t)count) {
+				writeError = true;
+			}
+			total += count;
+		}
+		return total;
+	}
+
+	SpscHeapRing<quint64> ring;
+
+private:
+	quint64 lostRecords;
+	quint64 queuedRecords;
+	quint64 firstLoss;
+};
+
+// Number of ring words for a stream of records of recordWords words, produced at most every
+// recordInterval ns
+int timelineRingWords(int recordWords, quint64 recordInterval);
+
+// Raises the soft limit of open files if needed, so that streamCount streams can be opened.
+// Returns false (and says why on stderr) if the hard limit is too low.
+bool reserveTimelineFiles(int streamCount);
+
+// Creates a stream that is drained by the writer thread. Must be called before startTimelineWriter().
+// Exits if the file cannot be created or the ring cannot be allocated: the results would be incomplete.
+TimelineStream *createTimelineStream(QString fileName, int ringWords);
+
+// Starts the background thread that writes the streams to disk
+void startTimelineWriter();
+// Writes the remaining records, closes the files and frees the streams
+void stopTimelineWriter();
+
+// Sequential reader for the files written by the streams; only one record is kept in memory
+template<typename T>
+class TimelineReader {
+public:
+	TimelineReader(QString fileName) : file(fileName) {
+		file.open(QIODevice::ReadOnly);
+	}
+
+	bool isOpen() {
+		return file.isOpen();
+	}
+
+	quint64 count() {
+		return file.isOpen() ? file.size() / sizeof(T) : 0;
+	}
+
+	// Random access to a record, without changing the read position
+	bool at(quint64 index, T &record) {
+		qint64 pos = file.pos();
+		bool ok = file.seek(index * sizeof(T)) && file.read((char*)&record, sizeof(T)) == sizeof(T);
+		file.seek(pos);
+		return ok;
+	}
+
+	void rewind() {
+		file.seek(0);
+	}
+
+	bool next(T &record) {
+		return file.isOpen() && file.read((char*)&record, sizeof(T)) == sizeof(T);
+	}
+
+private:
+	QFile file;
+};
+
+#endif // TIMELINEWRITER_H
@@ -0,0 +1,91 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "timingwheel.h"
+
+struct TimingWheelTestNode {
+	TimingWheelTestNode *wheelNext;
+	quint64 wheelTime;
+};
+
+void TimingWheel_test()
+{
+	TimingWheel<TimingWheelTestNode> wheel;
+
+	const int opCount = 1000000;
+
+	QVector<TimingWheelTestNode> nodes(opCount);
+	int nodeCount = 0;
+	QList<quint64> heapSim;
+	quint64 lastTs = 0;
+
+	for (int i = 0; i < opCount; i++) {
+		// insert or delete?
+		if (rand() % 2) {
+			// insert, never before the last extracted event; the delay spans many levels
+			quint64 x = lastTs + (quint64(rand()) << (rand() % 32)) % (1ULL << 40);
+			wheel.insert(&nodes[nodeCount++], x);
+			heapSim << x;
+		} else {
+			//delete
+			if (wheel.isEmpty() != heapSim.isEmpty()) {
+				qDebug() << "FAIL isEmpty" << i;
+				exit(1);
+			}
+			if (!wheel.isEmpty()) {
+				quint64 x1 = wheel.findMin().second;
+				wheel.deleteMin();
+				quint64 x2 = heapSim.first();
+				foreach (quint64 x, heapSim) {
+					if (x < x2)
+						x2 = x;
+				}
+				heapSim.removeOne(x2);
+				if (x1 != x2) {
+					qDebug() << "FAIL deleteMin" << i << x1 << x2;
+					exit(1);
+				}
+				lastTs = x1;
+			}
+		}
+	}
+	//delete
+	while (!wheel.isEmpty()) {
+		if (heapSim.isEmpty()) {
+			qDebug() << "FAIL isEmpty";
+			exit(1);
+		}
+		quint64 x1 = wheel.findMin().second;
+		wheel.deleteMin();
+		quint64 x2 = heapSim.first();
+		foreach (quint64 x, heapSim) {
+			if (x < x2)
+				x2 = x;
+		}
+		heapSim.removeOne(x2);
+		if (x1 != x2) {
+			qDebug() << "FAIL drain" << x1 << x2;
+			exit(1);
+		}
+	}
+	if (!wheel.isEmpty() || !heapSim.isEmpty()) {
+		qDebug() << "FAIL isEmpty";
+		exit(1);
+	}
+	qDebug() << "OK";
+}
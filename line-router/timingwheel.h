@@ -0,0 +1,189 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <QtCore>
+
+#define TIMINGWHEEL_LEVEL_BITS 8
+#define TIMINGWHEEL_SLOTS      (1 << TIMINGWHEEL_LEVEL_BITS)
+#define TIMINGWHEEL_LEVELS     (64 / TIMINGWHEEL_LEVEL_BITS)
+#define TIMINGWHEEL_WORDS      (TIMINGWHEEL_SLOTS / 64)
+
+// Hierarchical timing wheel with 1 ns granularity.
+//
+// The 64-bit event time is split into 8 digits of 8 bits. An event is stored on
+// the level of the most significant digit in which its time differs from the
+// wheel's current time, in the slot given by that digit. Level 0 slots hold
+// events with exactly the same timestamp, in FIFO order. When level 0 becomes
+// empty, the first non-empty slot of the lowest non-empty level is cascaded
+// into the lower levels. Every event is cascaded at most 7 times, so insert and
+// extract-min are O(1) amortized, and there is no allocation: the list links
+// are stored in the nodes themselves.
+//
+// T must have the members:
+//     T *wheelNext;
+//     quint64 wheelTime;
+//
+// The current time of the wheel only advances when an event is extracted, so
+// findMin() can peek at a future event without affecting later inserts. Events
+// inserted with a time earlier than the last extracted event are treated as due
+// immediately (they keep their own timestamp).
+template<typename T>
+class TimingWheel {
+public:
+	TimingWheel() {
+		now = 0;
+		count = 0;
+		minCache = NULL;
+		memset(heads, 0, sizeof(heads));
+		memset(tails, 0, sizeof(tails));
+		memset(bitmap, 0, sizeof(bitmap));
+	}
+
+	bool isEmpty() {
+		return count == 0;
+	}
+
+	int size() {
+		return count;
+	}
+
+	QPair<T*, quint64> findMin() {
+		Q_ASSERT(!isEmpty());
+		int slot = firstSlot(0);
+		if (slot >= 0) {
+			T *node = heads[0][slot];
+			return QPair<T*, quint64>(node, node->wheelTime);
+		}
+		if (!minCache) {
+			minCache = scanMin();
+		}
+		return QPair<T*, quint64>(minCache, minCache->wheelTime);
+	}
+
+	void deleteMin() {
+		Q_ASSERT(!isEmpty());
+		int slot = firstSlot(0);
+		if (slot < 0) {
+			cascade();
+			slot = firstSlot(0);
+		}
+		minCache = NULL;
+		T *node = heads[0][slot];
+		heads[0][slot] = node->wheelNext;
+		if (!heads[0][slot]) {
+			tails[0][slot] = NULL;
+			bitmap[0][slot / 64] &= ~(1ULL << (slot % 64));
+		}
+		node->wheelNext = NULL;
+		count--;
+	}
+
+	void insert(T *node, quint64 priority) {
+		node->wheelTime = priority;
+		link(node, qMax(priority, now));
+		count++;
+		if (minCache && priority < minCache->wheelTime) {
+			minCache = node;
+		}
+	}
+
+private:
+	void link(T *node, quint64 key) {
+		quint64 diff = key ^ now;
+		int level = diff ? (63 - __builtin_clzll(diff)) / TIMINGWHEEL_LEVEL_BITS : 0;
+		int slot = (key >> (level * TIMINGWHEEL_LEVEL_BITS)) & (TIMINGWHEEL_SLOTS - 1);
+		node->wheelNext = NULL;
+		if (tails[level][slot]) {
+			tails[level][slot]->wheelNext = node;
+		} else {
+			heads[level][slot] = node;
+			bitmap[level][slot / 64] |= 1ULL << (slot % 64);
+		}
+		tails[level][slot] = node;
+	}
+
+	int firstSlot(int level) {
+		for (int w = 0; w < TIMINGWHEEL_WORDS; w++) {
+			if (bitmap[level][w])
+				return w * 64 + __builtin_ctzll(bitmap[level][w]);
+		}
+		return -1;
+	}
+
+	// Returns the first slot of the lowest non-empty level; that slot holds the earliest event.
+	int firstBusySlot(int &level) {
+		for (level = 1; level < TIMINGWHEEL_LEVELS; level++) {
+			int slot = firstSlot(level);
+			if (slot >= 0)
+				return slot;
+		}
+		Q_ASSERT(false);
+		return -1;
+	}
+
+	// Finds the earliest event when level 0 is empty (the first one in case of ties).
+	T *scanMin() {
+		int level;
+		int slot = firstBusySlot(level);
+		T *result = heads[level][slot];
+		for (T *node = result->wheelNext; node; node = node->wheelNext) {
+			if (node->wheelTime < result->wheelTime)
+				result = node;
+		}
+		return result;
+	}
+
+	// Moves the earliest events down to level 0, advancing the current time to the earliest event.
+	void cascade() {
+		int level;
+		int slot = firstBusySlot(level);
+		T *list = heads[level][slot];
+		heads[level][slot] = NULL;
+		tails[level][slot] = NULL;
+		bitmap[level][slot / 64] &= ~(1ULL << (slot % 64));
+
+		// the earliest event of this slot is the earliest event in the wheel
+		quint64 minTime = list->wheelTime;
+		for (T *node = list->wheelNext; node; node = node->wheelNext) {
+			minTime = qMin(minTime, node->wheelTime);
+		}
+		now = minTime;
+
+		// redistribute on the lower levels, preserving the order of equal timestamps
+		while (list) {
+			T *next = list->wheelNext;
+			link(list, list->wheelTime);
+			list = next;
+		}
+	}
+
+	quint64 now;
+	int count;
+	T *minCache;
+	T *heads[TIMINGWHEEL_LEVELS][TIMINGWHEEL_SLOTS];
+	T *tails[TIMINGWHEEL_LEVELS][TIMINGWHEEL_SLOTS];
+	quint64 bitmap[TIMINGWHEEL_LEVELS][TIMINGWHEEL_WORDS];
+};
+
+// Checks the wheel against a simple priority queue; prints OK or exits on the first mismatch
+void TimingWheel_test();
+
+#endif // TIMINGWHEEL_H
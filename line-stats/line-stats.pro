@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Prints the live statistics of a running emulator
+#
+#-------------------------------------------------
+
+QT       += core
+
+QT       -= gui
+
+TARGET   = line-stats
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+bundle.path = /usr/bin
+bundle.files = $$TARGET
+INSTALLS += bundle
+
+INCLUDEPATH += ../util/
+LIBS += -lrt
+
+SOURCES += main.cpp \
+    ../util/livestats.cpp
+
+HEADERS += \
+    ../util/livestats.h
@@ -0,0 +1,208 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtCore>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "../util/livestats.h"
+
+// Polls the statistics segment of a running emulator and prints the counters.
+// Rates are computed between two consecutive polls.
+
+void printUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options] [segment name (default %s)]\n", name, LIVESTATS_DEFAULT_NAME);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --interval <ms>   Polling interval (default 1000, min 10)\n");
+	fprintf(stderr, "  --count <n>       Exit after n polls (default 0 = until the emulator stops)\n");
+	fprintf(stderr, "  --edges           Print the counters of the edges with traffic\n");
+	fprintf(stderr, "  --paths           Print the counters of the paths with traffic\n");
+}
+
+// Packets per second between two samples of a counter
+static double rate(quint64 count, quint64 prevCount, quint64 ts, quint64 prevTs)
+{
+	if (ts <= prevTs || count < prevCount)
+		return 0.0;
+	return (count - prevCount) * 1.0e9 / (ts - prevTs);
+}
+
+int main(int argc, char **argv)
+{
+	enum {
+		OPT_INTERVAL = 256,
+		OPT_COUNT,
+		OPT_EDGES,
+		OPT_PATHS
+	};
+	static struct option longOptions[] = {
+		{"interval", required_argument, 0, OPT_INTERVAL},
+		{"count", required_argument, 0, OPT_COUNT},
+		{"edges", no_argument, 0, OPT_EDGES},
+		{"paths", no_argument, 0, OPT_PATHS},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	int interval = 1000;
+	int count = 0;
+	bool showEdges = false;
+	bool showPaths = false;
+	int c;
+	while ((c = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+		switch (c) {
+		case OPT_INTERVAL:
+			interval = atoi(optarg);
+			if (interval < 10) {
+				fprintf(stderr, "Invalid interval: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_COUNT:
+			count = atoi(optarg);
+			if (count < 0) {
+				fprintf(stderr, "Invalid count: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_EDGES:
+			showEdges = true;
+			break;
+		case OPT_PATHS:
+			showPaths = true;
+			break;
+		case 'h':
+		default:
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind > 1) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	QString name = argc - optind == 1 ? QString(argv[optind]) : QString(LIVESTATS_DEFAULT_NAME);
+
+	LiveStats stats;
+	bool waiting = false;
+	while (!stats.open(name)) {
+		if (!waiting) {
+			printf("Waiting for the emulator to publish %s...\n", name.toLatin1().constData());
+			fflush(stdout);
+			waiting = true;
+		}
+		usleep(interval * 1000);
+	}
+	const LiveStatsHeader *header = stats.header();
+	printf("Emulator pid %u: %u edges, %u paths, %u scheduler shard(s), %u receive channel(s)\n",
+		   header->pid, header->edgeCount, header->pathCount, header->shardCount, header->channelCount);
+
+	LiveStatsConsumer prevConsumer;
+	LiveStatsSender prevSender;
+	QVector<LiveStatsConsumer> prevChannels(header->channelCount);
+	QVector<LiveStatsEdge> prevEdges(header->edgeCount);
+	QVector<LiveStatsPath> prevPaths(header->pathCount);
+	memset(&prevConsumer, 0, sizeof(prevConsumer));
+	memset(&prevSender, 0, sizeof(prevSender));
+	memset(prevChannels.data(), 0, prevChannels.count() * sizeof(LiveStatsConsumer));
+	memset(prevEdges.data(), 0, prevEdges.count() * sizeof(LiveStatsEdge));
+	memset(prevPaths.data(), 0, prevPaths.count() * sizeof(LiveStatsPath));
+
+	for (int poll = 0; count == 0 || poll < count; poll++) {
+		bool running = stats.isRunning();
+
+		LiveStatsConsumer consumer;
+		LiveStatsSender sender;
+		if (!stats.readConsumers(consumer) || !liveStatsRead(&header->sender, sender)) {
+			fprintf(stderr, "Could not read the statistics (the emulator may have crashed)\n");
+			return 1;
+		}
+		quint64 qdropped = 0;
+		quint64 handoffs = 0;
+		for (int s = 0; s < (int)header->shardCount; s++) {
+			LiveStatsShard shard;
+			if (liveStatsRead(stats.shard(s), shard)) {
+				qdropped += shard.packetsQdropped;
+				handoffs += shard.handoffs;
+			}
+		}
+
+		quint64 ts = qMax(consumer.timestamp, sender.timestamp);
+		printf("+%.3f s: received %llu (%.1f kpps), sent %llu (%.1f kpps), dropped %llu, delay error > 10%%: %llu, max %llu%%, avg %.2f%%",
+			   ts > header->tsStart ? (ts - header->tsStart) * 1.0e-9 : 0.0,
+			   consumer.packetsReceived, rate(consumer.packetsReceived, prevConsumer.packetsReceived, consumer.timestamp, prevConsumer.timestamp) * 1.0e-3,
+			   sender.packetsSent, rate(sender.packetsSent, prevSender.packetsSent, sender.timestamp, prevSender.timestamp) * 1.0e-3,
+			   qdropped,
+			   sender.packetsSentErr10p, sender.packetsSentErrpMax,
+			   sender.packetsSent ? sender.packetsSentErrSum / (double)sender.packetsSent : 0.0);
+		if (header->shardCount > 1) {
+			printf(", handoffs %llu", handoffs);
+		}
+		printf("\n");
+		prevConsumer = consumer;
+		prevSender = sender;
+
+		if (header->channelCount > 1) {
+			printf("  receive channels:");
+			for (int c = 0; c < (int)header->channelCount; c++) {
+				LiveStatsConsumer channel;
+				if (!liveStatsRead(stats.consumer(c), channel))
+					continue;
+				printf(" %d: %.1f kpps", c, rate(channel.packetsReceived, prevChannels[c].packetsReceived, channel.timestamp, prevChannels[c].timestamp) * 1.0e-3);
+				prevChannels[c] = channel;
+			}
+			printf("\n");
+		}
+
+		if (showEdges) {
+			for (int i = 0; i < (int)header->edgeCount; i++) {
+				LiveStatsEdge edge;
+				if (!liveStatsRead(stats.edge(i), edge) || edge.packets_in == 0)
+					continue;
+				printf("  edge %d: in %llu (%.1f kpps), qdrops %llu, rdrops %llu, queue %llu B (%.1f%%)\n",
+					   i, edge.packets_in, rate(edge.packets_in, prevEdges[i].packets_in, edge.timestamp, prevEdges[i].timestamp) * 1.0e-3,
+					   edge.qdrops, edge.rdrops, edge.qload,
+					   edge.qcapacity ? edge.qload * 100.0 / edge.qcapacity : 0.0);
+				prevEdges[i] = edge;
+			}
+		}
+
+		if (showPaths) {
+			for (int i = 0; i < (int)header->pathCount; i++) {
+				LiveStatsPath path;
+				if (!stats.readPath(i, path) || path.packets_in == 0)
+					continue;
+				printf("  path %d: in %llu (%.1f kpps), out %llu, loss %.2f%%, avg delay %.3f ms\n",
+					   i, path.packets_in, rate(path.packets_in, prevPaths[i].packets_in, path.timestamp, prevPaths[i].timestamp) * 1.0e-3,
+					   path.packets_out, 100.0 * (path.packets_in - qMin(path.packets_in, path.packets_out)) / path.packets_in,
+					   path.packets_out ? path.total_actual_delay * 1.0e-6 / path.packets_out : 0.0);
+				prevPaths[i] = path;
+			}
+		}
+		fflush(stdout);
+
+		if (!running) {
+			printf("The emulator has stopped\n");
+			break;
+		}
+		usleep(interval * 1000);
+	}
+
+	return 0;
+}
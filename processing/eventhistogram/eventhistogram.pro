@@ -15,4 +15,11 @@ CONFIG   -= app_bundle
 TEMPLATE = app
 
 
-SOURCES += main.cpp
+SOURCES += main.cpp \
+    ../../util/resultsfile.cpp \
+    ../../util/bitarray.cpp
+
+HEADERS += \
+    ../../util/resultsfile.h \
+    ../../util/eventlog.h \
+    ../../util/bitarray.h
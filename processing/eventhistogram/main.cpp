@@ -1,6 +1,9 @@
 #include <QtCore>
 #include <limits.h>
 
+#include "../../util/resultsfile.h"
+#include "../../util/bitarray.h"
+
 // PDF of a geometric distribution, i.e. the probability of having x failures before the first success,
 // when the probability of success is p. x can be 0,1,2,3,...
 double geopdf(int x, double p)
@@ -165,88 +168,67 @@ int main(int argc, char *argv[])
 	QString ylabel = argv[0];
 	argc--, argv++;
 
-	int interval = 0;
-
 	int nSkip = 10000;
 	printf("Skipping:      %d values\n", nSkip);
 
-	QHash<int, int> histogram;
-	QList<int> interDropIntervals;
-
-	int nZeros = 0;
-	int nOnes = 0;
-	QList<double> evolution;
-	QList<int> last100;
-	QList<double> evolution100;
-	QList<int> last1000;
-	QList<double> evolution1000;
-
-	// read values, count
+	// read values
+	BitArray values;
 #if !TEST
-	QFile file(inputFile);
-	if (!file.open(QIODevice::ReadOnly)) {
-		qDebug() << QString("Failed to open file %1").arg(inputFile);
+	// the input is given as results.dat:<edge index>
+	QStringList input = inputFile.split(':');
+	int edge = input.count() > 1 ? input[1].toInt() : 0;
+	ResultsFile results;
+	if (!results.open(input[0]) || edge < 0 || edge >= results.edgeCount()) {
+		qDebug() << QString("Failed to open the packet events of edge %1 in %2").arg(edge).arg(input[0]);
+		return 1;
 	}
-	QDataStream in(&file);
-	in.setVersion(QDataStream::Qt_4_0);
-
-	QVector<quint8> values = QVector<quint8>();
-	in >> values;
-	if (values.count() < 2 * nSkip) {
+	values = results.packetEvents(edge);
+	if (values.count() < 2ULL * nSkip) {
 		qDebug() << "cannot skip so much data";
 		return 1;
 	}
-	values.remove(0, nSkip);
-	values.remove(values.count() - nSkip, nSkip);
+	quint64 from = nSkip;
+	quint64 to = values.count() - nSkip;
 #else
+	while (values.count() < 30000) {
+		values << (rand() > RAND_MAX * PROB0); // (1 - prob0) loss
+	}
+	quint64 from = 0;
+	quint64 to = values.count();
 	FILE *f;
 #endif
 
-	while (1) {
-		int x;
-#if !TEST
-		if (values.isEmpty())
-			break;
-		x = values.at(0);
-		values.remove(0);
-#else
-		if (nZeros + nOnes > 30000)
-			break;
-		x = rand() > RAND_MAX * PROB0; // (1 - prob0) loss
-#endif
-		if (x > 1) {
-			printf("Warning: event with value = %d\n", x);
-			//exit(1);
-			x = 1;
-		}
-		if (x == 1) {
-			if (interval >= 0) {
-				histogram[interval]++;
-				interDropIntervals << interval;
-			}
-			interval = 0;
-			nOnes++;
-		}
-		if (x == 0) {
-			interval++;
-			nZeros++;
-		}
-		evolution << nZeros / (double) (nZeros + nOnes);
-		last100 << x;
-		if (last100.count() > 100) {
-			last100.takeFirst();
-			evolution100 << last100.count(0) / 100.0;
-		}
-		last1000 << x;
-		if (last1000.count() > 1000) {
-			last1000.takeFirst();
-			evolution1000 << last1000.count(0) / 1000.0;
-		}
+	// count
+	int nOnes = values.countOnes(from, to);
+	int nZeros = (to - from) - nOnes;
+
+	// number of successful transmissions before each drop
+	QVector<quint64> interDropIntervals = values.gaps(from, to);
+	QHash<int, int> histogram;
+	foreach (quint64 interval, interDropIntervals) {
+		histogram[interval]++;
+	}
+
+	// transmission rate: overall, and over the last 100 and 1000 packets
+	QList<double> evolution;
+	quint64 ones = 0;
+	for (quint64 i = from; i < to; i++) {
+		ones += values.at(i);
+		evolution << 1.0 - ones / (double)(i - from + 1);
+	}
+	// the windows start one packet in, so that the first one ends after window + 1 packets, as they always did
+	QList<double> evolution100;
+	foreach (qreal lossRate, values.slidingRate(100, 1, from + 1, to)) {
+		evolution100 << 1.0 - lossRate;
+	}
+	QList<double> evolution1000;
+	foreach (qreal lossRate, values.slidingRate(1000, 1, from + 1, to)) {
+		evolution1000 << 1.0 - lossRate;
 	}
 #if !TEST
 	FILE *f = fopen((inputFile + ".intervals").toLatin1().data(), "wt");
-	foreach (int x, interDropIntervals) {
-		fprintf(f, "%d ", x);
+	foreach (quint64 x, interDropIntervals) {
+		fprintf(f, "%llu ", x);
 	}
 	fclose(f);
 #endif
@@ -1,6 +1,9 @@
 #include <QtCore>
 #include <limits.h>
 
+#include "../../util/resultsfile.h"
+#include "../../util/bitarray.h"
+
 #define TEST 0
 #define PROB0 0.5
 
@@ -15,63 +18,40 @@ int main(int argc, char *argv[])
 	srand(time(NULL));
 #endif
 
-	double nLow = 0;
-	double nHigh = 0;
-	double nRuns = 1;
 	int nSkip = 10000;
 
 	printf("Skipping:      %d values\n", nSkip);
 
-	int xPrev = -1;
-	// read values, count
+	// read values
+	BitArray values;
 #if !TEST
-	//FILE *f = fopen(inputFile.toLatin1().data(), "rt");
-	QFile file(inputFile);
-	if (!file.open(QIODevice::ReadOnly)) {
-		qDebug() << QString("Failed to open file %1").arg(inputFile);
+	// the input is given as results.dat:<edge index>
+	QStringList input = inputFile.split(':');
+	int edge = input.count() > 1 ? input[1].toInt() : 0;
+	ResultsFile results;
+	if (!results.open(input[0]) || edge < 0 || edge >= results.edgeCount()) {
+		qDebug() << QString("Failed to open the packet events of edge %1 in %2").arg(edge).arg(input[0]);
+		return 1;
 	}
-	QDataStream in(&file);
-	in.setVersion(QDataStream::Qt_4_0);
-
-	QVector<quint8> values = QVector<quint8>();
-	in >> values;
-	if (values.count() < 2 * nSkip) {
+	values = results.packetEvents(edge);
+	if (values.count() < 2ULL * nSkip) {
 		qDebug() << "cannot skip so much data";
 		return 1;
 	}
-	values.remove(0, nSkip);
-	values.remove(values.count() - nSkip, nSkip);
-#endif
-	while (1) {
-		int x;
-#if !TEST
-		if (values.isEmpty())
-			break;
-		x = values.at(0);
-		values.remove(0);
+	quint64 from = nSkip;
+	quint64 to = values.count() - nSkip;
 #else
-		if (nLow + nHigh > 30000)
-			break;
-		x = rand() > RAND_MAX * PROB0; // (1 - prob0) loss
-#endif
-		if (x > 1) {
-			printf("Warning: event with value = %d\n", x);
-			//exit(1);
-			x = 1;
-		}
-		if (x == 1) {
-			nHigh += 1.0;
-		}
-		if (x == 0) {
-			nLow += 1.0;
-		}
-		if (xPrev >= 0) {
-			if (x != xPrev) {
-				nRuns += 1.0;
-			}
-		}
-		xPrev = x;
+	while (values.count() < 30000) {
+		values << (rand() > RAND_MAX * PROB0); // (1 - prob0) loss
 	}
+	quint64 from = 0;
+	quint64 to = values.count();
+#endif
+
+	// count
+	double nHigh = values.countOnes(from, to);
+	double nLow = (to - from) - nHigh;
+	double nRuns = values.countRuns(from, to);
 
 	double expectedRuns = 2.0 * nLow * nHigh / (nLow + nHigh) + 1;
 	double variance = (2.0*nLow*nHigh) * (2.0*nLow*nHigh - (nLow+nHigh)) / (((nLow+nHigh)*(nLow+nHigh))*((nLow+nHigh)-1));
@@ -0,0 +1,238 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bitarray.h"
+
+BitArray::BitArray(const quint64 *words, quint64 bitCount) :
+	bitCount(bitCount)
+{
+	bits.resize((bitCount + 63) / 64);
+	memcpy(bits.data(), words, bits.count() * sizeof(quint64));
+	if (bitCount % 64) {
+		bits.last() &= bitMask(0, bitCount % 64);
+	}
+}
+
+quint64 BitArray::countOnes(quint64 from, quint64 to) const
+{
+	if (from >= to)
+		return 0;
+	quint64 first = from / 64;
+	quint64 last = (to - 1) / 64;
+	if (first == last)
+		return bitCountOnes(bits.at(first) & bitMask(from % 64, (to - 1) % 64 + 1));
+	quint64 result = bitCountOnes(bits.at(first) & bitMask(from % 64, 64));
+	for (quint64 w = first + 1; w < last; w++) {
+		result += bitCountOnes(bits.at(w));
+	}
+	result += bitCountOnes(bits.at(last) & bitMask(0, (to - 1) % 64 + 1));
+	return result;
+}
+
+quint64 BitArray::findNext(int bit, quint64 from, quint64 to) const
+{
+	if (from >= to)
+		return to;
+	// search for 1 bits in the words, or in their complement
+	quint64 flip = bit ? 0ULL : ~0ULL;
+	quint64 w = from / 64;
+	quint64 word = (bits.at(w) ^ flip) & bitMask(from % 64, 64);
+	while (!word) {
+		w++;
+		if (w * 64 >= to)
+			return to;
+		word = bits.at(w) ^ flip;
+	}
+	return qMin(to, w * 64 + bitFirstOne(word));
+}
+
+quint64 BitArray::countRuns(quint64 from, quint64 to) const
+{
+	quint64 runs = 0;
+	for (quint64 i = from; i < to; i += runLength(i, to)) {
+		runs++;
+	}
+	return runs;
+}
+
+QVector<quint64> BitArray::gaps(quint64 from, quint64 to) const
+{
+	QVector<quint64> result;
+	result.reserve(countOnes(from, to));
+	for (quint64 i = findNext(1, from, to), start = from; i < to; start = i + 1, i = findNext(1, i + 1, to)) {
+		result << i - start;
+	}
+	return result;
+}
+
+QVector<qreal> BitArray::slidingRate(quint64 window, quint64 step, quint64 from, quint64 to) const
+{
+	QVector<qreal> result;
+	if (window == 0 || step == 0 || to < from + window)
+		return result;
+	result.reserve((to - from - window) / step + 1);
+	quint64 ones = countOnes(from, from + window);
+	result << ones / (qreal)window;
+	for (quint64 start = from + step; start + window <= to; start += step) {
+		if (step == 1) {
+			ones += at(start + window - 1) - at(start - 1);
+		} else {
+			ones = countOnes(start, start + window);
+		}
+		result << ones / (qreal)window;
+	}
+	return result;
+}
+
+QByteArray BitArray::serialize() const
+{
+	QByteArray result;
+	for (quint64 i = 0; i < bitCount; i++) {
+		result += at(i) ? "1 " : "0 ";
+	}
+	return result;
+}
+
+void BitArray::test()
+{
+	BitArray bits;
+	QByteArray reference;
+	QList<int> values;
+
+	for (int i = 0; i < 100; i++) {
+		for (int c = i; c > 0; c--) {
+			bits << 0;
+			values << 0;
+			reference += "0 ";
+		}
+		for (int c = i; c > 0; c--) {
+			bits << 1;
+			values << 1;
+			reference += "1 ";
+		}
+		if (reference != bits.serialize()) {
+			qDebug() << "FAIL serialize" << bits.count();
+			exit(1);
+		}
+	}
+	// short random runs, which cross the word boundaries at every offset
+	for (int i = 0; i < 1000; i++) {
+		int bit = rand() % 4 == 0;
+		bits << bit;
+		values << bit;
+	}
+
+	// compare the word-level queries with a bit by bit computation
+	for (quint64 from = 0; from < bits.count(); from += 37) {
+		for (quint64 to = from; to <= bits.count(); to += 53) {
+			quint64 ones = 0;
+			quint64 runs = 0;
+			QVector<quint64> gaps;
+			quint64 gap = 0;
+			quint64 next[2] = { to, to };
+			for (quint64 i = from; i < to; i++) {
+				ones += values[i];
+				if (i == from || values[i] != values[i - 1])
+					runs++;
+				if (values[i]) {
+					gaps << gap;
+					gap = 0;
+				} else {
+					gap++;
+				}
+				if (next[values[i]] == to)
+					next[values[i]] = i;
+			}
+			if (bits.countOnes(from, to) != ones || bits.countRuns(from, to) != runs || bits.gaps(from, to) != gaps ||
+				bits.findNext(0, from, to) != next[0] || bits.findNext(1, from, to) != next[1]) {
+				qDebug() << "FAIL queries" << from << to;
+				exit(1);
+			}
+			if (from < to && bits.runLength(from, to) != next[!values[from]] - from) {
+				qDebug() << "FAIL runLength" << from << to;
+				exit(1);
+			}
+		}
+	}
+
+	// sliding windows, against prefix sums
+	QVector<quint64> prefix(bits.count() + 1, 0);
+	for (quint64 i = 0; i < bits.count(); i++) {
+		prefix[i + 1] = prefix[i] + values[i];
+	}
+	const quint64 windows[][2] = { {1, 1}, {10, 1}, {64, 3}, {100, 1}, {1000, 64} };
+	for (quint64 from = 0; from < bits.count(); from += 397) {
+		for (quint64 to = from; to <= bits.count(); to += 611) {
+			for (uint k = 0; k < sizeof(windows) / sizeof(windows[0]); k++) {
+				quint64 window = windows[k][0];
+				quint64 step = windows[k][1];
+				QVector<qreal> rates;
+				for (quint64 start = from; start + window <= to; start += step) {
+					rates << (prefix[start + window] - prefix[start]) / (qreal)window;
+				}
+				if (bits.slidingRate(window, step, from, to) != rates) {
+					qDebug() << "FAIL slidingRate" << from << to << window << step;
+					exit(1);
+				}
+			}
+		}
+	}
+
+	// stream round trip, and a copy made from the words
+	QByteArray data;
+	{
+		QDataStream out(&data, QIODevice::WriteOnly);
+		out << bits << BitArray();
+	}
+	BitArray loaded;
+	BitArray loadedEmpty;
+	loadedEmpty << 1;
+	{
+		QDataStream in(data);
+		in >> loaded >> loadedEmpty;
+	}
+	BitArray copy(bits.words().constData(), bits.count());
+	if (loaded.count() != bits.count() || loaded.words() != bits.words() || loaded.serialize() != bits.serialize() ||
+		loadedEmpty.count() != 0 || copy.words() != bits.words() || copy.count() != bits.count()) {
+		qDebug() << "FAIL stream";
+		exit(1);
+	}
+	qDebug() << "OK";
+}
+
+QDataStream &operator<<(QDataStream &s, const BitArray &b)
+{
+	s << b.count();
+	foreach (quint64 word, b.words()) {
+		s << word;
+	}
+	return s;
+}
+
+QDataStream &operator>>(QDataStream &s, BitArray &b)
+{
+	quint64 bitCount;
+	s >> bitCount;
+	b.clear();
+	b.bits.resize((bitCount + 63) / 64);
+	for (int i = 0; i < b.bits.count(); i++) {
+		s >> b.bits[i];
+	}
+	b.bitCount = bitCount;
+	return s;
+}
@@ -0,0 +1,125 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef BITARRAY_H
+#define BITARRAY_H
+
+#include <QtCore>
+
+// Bit operations on 64-bit words
+static inline int bitCountOnes(quint64 word)
+{
+	return __builtin_popcountll(word);
+}
+
+// Index of the lowest 1 bit; word must not be 0
+static inline int bitFirstOne(quint64 word)
+{
+	return __builtin_ctzll(word);
+}
+
+// Mask of the bits [from, to) of a word, 0 <= from <= to <= 64
+static inline quint64 bitMask(int from, int to)
+{
+	quint64 high = to >= 64 ? ~0ULL : ((1ULL << to) - 1);
+	return high & ~((1ULL << from) - 1);
+}
+
+// Array of bits, packed 64 per word; bit i is bit i % 64 of word i / 64.
+// Used for packet events: 0 = successful forwarding; 1 = drop.
+// The queries work on whole words with popcount and count-trailing-zeros.
+class BitArray {
+public:
+	BitArray() {
+		bitCount = 0;
+	}
+
+	// Copies bitCount bits from words
+	BitArray(const quint64 *words, quint64 bitCount);
+
+	BitArray &append(int bit) {
+		if (bitCount % 64 == 0) {
+			bits << 0ULL;
+		}
+		if (bit) {
+			bits.last() |= 1ULL << (bitCount % 64);
+		}
+		bitCount++;
+		return *this;
+	}
+
+	BitArray &operator<< (int bit) {
+		return append(bit);
+	}
+
+	int at(quint64 index) const {
+		return (bits.at(index / 64) >> (index % 64)) & 1;
+	}
+
+	quint64 count() const {
+		return bitCount;
+	}
+
+	const QVector<quint64> &words() const {
+		return bits;
+	}
+
+	void clear() {
+		bits.clear();
+		bitCount = 0;
+	}
+
+	// Number of 1 bits in [from, to)
+	quint64 countOnes(quint64 from, quint64 to) const;
+
+	// Index of the first bit equal to bit in [from, to), or to if there is none
+	quint64 findNext(int bit, quint64 from, quint64 to) const;
+
+	// Length of the run of equal bits that starts at from, not going past to
+	quint64 runLength(quint64 from, quint64 to) const {
+		return findNext(!at(from), from, to) - from;
+	}
+
+	// Number of runs of equal bits in [from, to)
+	quint64 countRuns(quint64 from, quint64 to) const;
+
+	// Number of 0 bits before each 1 bit in [from, to) (counting from from or from the previous 1 bit)
+	QVector<quint64> gaps(quint64 from, quint64 to) const;
+
+	// Fraction of 1 bits in a sliding window of window bits, moved by step bits over [from, to)
+	QVector<qreal> slidingRate(quint64 window, quint64 step, quint64 from, quint64 to) const;
+
+	// Text representation, e.g. "0 1 1 "
+	QByteArray serialize() const;
+
+	// Checks the queries, the text and stream serialization against a bit by bit computation;
+	// prints OK or exits on the first failure
+	static void test();
+
+protected:
+	QVector<quint64> bits;
+	quint64 bitCount;
+
+	friend QDataStream &operator>>(QDataStream &s, BitArray &b);
+};
+
+// Bit-packed: the number of bits, then the words
+QDataStream &operator<<(QDataStream &s, const BitArray &b);
+QDataStream &operator>>(QDataStream &s, BitArray &b);
+
+#endif // BITARRAY_H
@@ -0,0 +1,144 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <QtCore>
+
+// Compact log of per-packet events (timestamp and a 2-bit type).
+//
+// Events are written in fixed-size blocks, so block k is at offset k * EVENTLOG_BLOCK_SIZE.
+// Each block starts with the timestamp of its first event; a block can be decoded on its own,
+// and a time can be found with a binary search over the block base timestamps.
+// Each event is stored as a varint (7 bits per byte, least significant group first) of
+// (delta << 2) | type, where delta is the time since the previous event of the block.
+
+#define EVENTLOG_BLOCK_SIZE   1024
+#define EVENTLOG_BLOCK_WORDS  (EVENTLOG_BLOCK_SIZE / 8)
+#define EVENTLOG_HEADER_SIZE  16
+#define EVENTLOG_PAYLOAD_SIZE (EVENTLOG_BLOCK_SIZE - EVENTLOG_HEADER_SIZE)
+// Event types
+#define PACKET_EVENT_QUEUED  1
+#define PACKET_EVENT_QDROP   2
+#define PACKET_EVENT_RDROP   3
+
+// a 62-bit delta and the type take at most 10 bytes
+#define EVENTLOG_MAX_EVENT_SIZE 10
+
+struct EventLogBlock {
+	quint64 baseTimestamp;
+	quint32 eventCount;
+	quint16 payloadSize;
+	quint16 reserved;
+	quint8 payload[EVENTLOG_PAYLOAD_SIZE];
+};
+
+// Fills a block with events
+class EventLogEncoder {
+public:
+	EventLogEncoder() {
+		reset();
+	}
+
+	void reset() {
+		memset(&block, 0, EVENTLOG_HEADER_SIZE);
+		lastTimestamp = 0;
+	}
+
+	bool isEmpty() const {
+		return block.eventCount == 0;
+	}
+
+	// Returns false if the block is full; the event is not added in that case.
+	// The timestamps must not decrease (earlier ones are recorded with a zero delta).
+	inline bool append(quint64 timestamp, int type) {
+		if (block.payloadSize + EVENTLOG_MAX_EVENT_SIZE > EVENTLOG_PAYLOAD_SIZE)
+			return false;
+		if (block.eventCount == 0) {
+			block.baseTimestamp = timestamp;
+			lastTimestamp = timestamp;
+		}
+		quint64 delta = timestamp > lastTimestamp ? timestamp - lastTimestamp : 0;
+		quint64 value = (delta << 2) | (type & 3);
+		while (value >= 0x80) {
+			block.payload[block.payloadSize++] = (value & 0x7F) | 0x80;
+			value >>= 7;
+		}
+		block.payload[block.payloadSize++] = value;
+		block.eventCount++;
+		lastTimestamp = qMax(lastTimestamp, timestamp);
+		return true;
+	}
+
+	EventLogBlock block;
+
+private:
+	quint64 lastTimestamp;
+};
+
+// Reads the events of a block in order.
+// The block may come from a file: a malformed event stops the decoding and sets the corrupt flag.
+class EventLogDecoder {
+public:
+	EventLogDecoder(const EventLogBlock *block) : block(block) {
+		position = 0;
+		event = 0;
+		timestamp = block->baseTimestamp;
+		payloadSize = qMin((int)block->payloadSize, EVENTLOG_PAYLOAD_SIZE);
+		corrupt = false;
+	}
+
+	inline bool next(quint64 &eventTimestamp, int &type) {
+		if (corrupt || event >= block->eventCount)
+			return false;
+		quint64 value = 0;
+		int shift = 0;
+		while (1) {
+			// a varint of more than 64 bits, or cut by the end of the payload
+			if (shift > 63 || position >= payloadSize) {
+				corrupt = true;
+				return false;
+			}
+			quint8 byte = block->payload[position++];
+			value |= (quint64)(byte & 0x7F) << shift;
+			shift += 7;
+			if (!(byte & 0x80))
+				break;
+		}
+		timestamp += value >> 2;
+		type = value & 3;
+		eventTimestamp = timestamp;
+		event++;
+		return true;
+	}
+
+	bool isCorrupt() const {
+		return corrupt;
+	}
+
+private:
+	const EventLogBlock *block;
+	int position;
+	int payloadSize;
+	quint32 event;
+	quint64 timestamp;
+	bool corrupt;
+};
+
+#endif // EVENTLOG_H
@@ -0,0 +1,184 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "livestats.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+static inline size_t alignToCacheLine(size_t offset)
+{
+	return (offset + 63) & ~(size_t)63;
+}
+
+LiveStats::LiveStats()
+{
+	data = NULL;
+	size = 0;
+	owner = false;
+}
+
+LiveStats::~LiveStats()
+{
+	close();
+}
+
+bool LiveStats::create(QString name, int edgeCount, int pathCount, int shardCount, int channelCount)
+{
+	close();
+
+	size_t consumerOffset = alignToCacheLine(sizeof(LiveStatsHeader));
+	size_t shardOffset = consumerOffset + channelCount * sizeof(LiveStatsConsumer);
+	size_t edgeOffset = shardOffset + shardCount * sizeof(LiveStatsShard);
+	size_t pathOffset = edgeOffset + edgeCount * sizeof(LiveStatsEdge);
+	size_t segmentSize = pathOffset + (size_t)shardCount * pathCount * sizeof(LiveStatsPath);
+
+	// a new segment, so that readers of a previous run do not see this one being initialized
+	shm_unlink(name.toLatin1().constData());
+	int fd = shm_open(name.toLatin1().constData(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		perror("Could not create the statistics segment");
+		return false;
+	}
+	if (ftruncate(fd, segmentSize) < 0) {
+		perror("Could not resize the statistics segment");
+		::close(fd);
+		shm_unlink(name.toLatin1().constData());
+		return false;
+	}
+	void *memory = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (memory == MAP_FAILED) {
+		perror("Could not map the statistics segment");
+		shm_unlink(name.toLatin1().constData());
+		return false;
+	}
+
+	data = (quint8*)memory;
+	size = segmentSize;
+	this->name = name;
+	owner = true;
+
+	// the segment is zero-filled by ftruncate
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	LiveStatsHeader *h = header();
+	h->version = LIVESTATS_VERSION;
+	h->pid = getpid();
+	h->segmentSize = segmentSize;
+	h->edgeCount = edgeCount;
+	h->pathCount = pathCount;
+	h->shardCount = shardCount;
+	h->running = 1;
+	h->channelCount = channelCount;
+	h->tsStart = ((quint64)ts.tv_sec) * 1000ULL * 1000ULL * 1000ULL + ((quint64)ts.tv_nsec);
+	h->consumerOffset = consumerOffset;
+	h->shardOffset = shardOffset;
+	h->edgeOffset = edgeOffset;
+	h->pathOffset = pathOffset;
+	__atomic_store_n(&h->magic, LIVESTATS_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool LiveStats::open(QString name)
+{
+	close();
+
+	int fd = shm_open(name.toLatin1().constData(), O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(LiveStatsHeader)) {
+		::close(fd);
+		return false;
+	}
+	void *memory = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (memory == MAP_FAILED)
+		return false;
+
+	data = (quint8*)memory;
+	size = st.st_size;
+	this->name = name;
+	owner = false;
+
+	// the segment may still be initialized by the emulator, or come from another version
+	const LiveStatsHeader *h = header();
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != LIVESTATS_MAGIC ||
+		h->version != LIVESTATS_VERSION ||
+		h->segmentSize > size ||
+		h->consumerOffset + h->channelCount * sizeof(LiveStatsConsumer) > h->segmentSize ||
+		h->shardOffset + h->shardCount * sizeof(LiveStatsShard) > h->segmentSize ||
+		h->edgeOffset + h->edgeCount * sizeof(LiveStatsEdge) > h->segmentSize ||
+		h->pathOffset + (quint64)h->shardCount * h->pathCount * sizeof(LiveStatsPath) > h->segmentSize) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void LiveStats::close()
+{
+	if (!data)
+		return;
+	if (owner) {
+		__atomic_store_n(&header()->running, 0, __ATOMIC_RELEASE);
+		shm_unlink(name.toLatin1().constData());
+	}
+	munmap(data, size);
+	data = NULL;
+	size = 0;
+	owner = false;
+}
+
+bool LiveStats::readConsumers(LiveStatsConsumer &total) const
+{
+	memset(&total, 0, sizeof(total));
+	for (int c = 0; c < (int)header()->channelCount; c++) {
+		LiveStatsConsumer value;
+		if (!liveStatsRead(consumer(c), value))
+			return false;
+		total.timestamp = qMax(total.timestamp, value.timestamp);
+		total.packetsReceived += value.packetsReceived;
+		total.bytesReceived += value.bytesReceived;
+		total.bursts += value.bursts;
+		total.poolExhausted += value.poolExhausted;
+	}
+	return true;
+}
+
+bool LiveStats::readPath(int index, LiveStatsPath &total) const
+{
+	memset(&total, 0, sizeof(total));
+	for (int s = 0; s < (int)header()->shardCount; s++) {
+		LiveStatsPath value;
+		if (!liveStatsRead(path(s, index), value))
+			return false;
+		total.timestamp = qMax(total.timestamp, value.timestamp);
+		total.packets_in += value.packets_in;
+		total.packets_out += value.packets_out;
+		total.bytes_in += value.bytes_in;
+		total.bytes_out += value.bytes_out;
+		total.total_theor_delay += value.total_theor_delay;
+		total.total_actual_delay += value.total_actual_delay;
+	}
+	return true;
+}
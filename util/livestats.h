@@ -0,0 +1,218 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef LIVESTATS_H
+#define LIVESTATS_H
+
+#include <QtCore>
+
+// Statistics of a running emulator, published in a POSIX shared memory segment so that
+// other processes can watch them during the run.
+//
+// Layout (native byte order, every record is aligned to a cache line):
+//     LiveStatsHeader
+//     LiveStatsConsumer[channelCount] (one per receive channel; add them up)
+//     LiveStatsShard[shardCount]
+//     LiveStatsEdge[edgeCount]
+//     LiveStatsPath[shardCount][pathCount] (each shard counts the packets it routes; add them up)
+//
+// Each record is owned by one emulator thread, which copies its counters into it every
+// LIVESTATS_PUBLISH_PERIOD or so, outside the per-packet code. The records are protected by
+// sequence locks: the writer never waits, and readers retry if they see a record being updated
+// (see liveStatsPublish() and liveStatsRead()). All the members of a record are quint64 and the
+// first one is the sequence number.
+
+#define LIVESTATS_MAGIC        0x54415453454E494CULL // "LINESTAT" in memory
+#define LIVESTATS_VERSION      2
+#define LIVESTATS_DEFAULT_NAME "/line-router-stats"
+
+// How often the emulator threads publish their counters (ns)
+#define LIVESTATS_PUBLISH_PERIOD (10 * 1000 * 1000)
+
+// Number of times a reader tries to get a consistent copy of a record before giving up
+#define LIVESTATS_READ_RETRIES 1000
+
+struct LiveStatsConsumer {
+	quint64 sequence;
+	quint64 timestamp;        // CLOCK_MONOTONIC time of the update (ns)
+	quint64 packetsReceived;
+	quint64 bytesReceived;
+	quint64 bursts;
+	quint64 poolExhausted;    // allocations failed because the packet pool was empty
+} __attribute__((aligned(64)));
+
+struct LiveStatsSender {
+	quint64 sequence;
+	quint64 timestamp;
+	quint64 packetsSent;
+	quint64 packetsSendDropped;
+	quint64 packetsSentErr10p;  // packets with a delay error of more than 10%
+	quint64 packetsSentErr25p;
+	quint64 packetsSentErr50p;
+	quint64 packetsSentErrpMax; // maximum relative delay error (%)
+	quint64 packetsSentErrSum;  // sum of the relative delay errors (%), divide by packetsSent for the average
+} __attribute__((aligned(64)));
+
+struct LiveStatsShard {
+	quint64 sequence;
+	quint64 timestamp;
+	quint64 loops;            // non-idle scheduler loops
+	quint64 totalLoopDelay;
+	quint64 maxLoopDelay;
+	quint64 packetsQdropped;
+	quint64 handoffs;
+	quint64 handoffOverflows;
+} __attribute__((aligned(64)));
+
+struct LiveStatsEdge {
+	quint64 sequence;
+	quint64 timestamp;
+	quint64 packets_in;
+	quint64 bytes_in;
+	quint64 qdrops;
+	quint64 rdrops;
+	quint64 qload;            // queue load at timestamp (bytes)
+	quint64 qcapacity;
+} __attribute__((aligned(64)));
+
+struct LiveStatsPath {
+	quint64 sequence;
+	quint64 timestamp;
+	quint64 packets_in;
+	quint64 packets_out;
+	quint64 bytes_in;
+	quint64 bytes_out;
+	quint64 total_theor_delay;
+	quint64 total_actual_delay;
+} __attribute__((aligned(64)));
+
+struct LiveStatsHeader {
+	quint64 magic;            // written last, after the rest of the segment is initialized
+	quint32 version;
+	quint32 pid;              // of the emulator
+	quint64 segmentSize;
+	quint32 edgeCount;
+	quint32 pathCount;
+	quint32 shardCount;
+	quint32 running;          // cleared when the emulator stops
+	quint32 channelCount;     // receive channels
+	quint32 reserved;
+	quint64 tsStart;          // CLOCK_MONOTONIC time when the segment was created (ns)
+	// byte offsets from the start of the segment
+	quint64 consumerOffset;
+	quint64 shardOffset;
+	quint64 edgeOffset;
+	quint64 pathOffset;
+	LiveStatsSender sender;
+} __attribute__((aligned(64)));
+
+// Writer side: copies value into the shared record. Only the owner thread may call this.
+template<typename T>
+inline void liveStatsPublish(T *shared, const T &value)
+{
+	quint64 *dst = (quint64*)shared;
+	const quint64 *src = (const quint64*)&value;
+	quint64 sequence = dst[0];
+	// an odd sequence number marks the record as being written
+	__atomic_store_n(&dst[0], sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (unsigned i = 1; i < sizeof(T) / sizeof(quint64); i++) {
+		__atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&dst[0], sequence + 2, __ATOMIC_RELEASE);
+}
+
+// Reader side: copies the shared record into value. Returns false if no consistent copy
+// could be made (the writer kept updating the record, or died in the middle of an update).
+template<typename T>
+inline bool liveStatsRead(const T *shared, T &value)
+{
+	const quint64 *src = (const quint64*)shared;
+	quint64 *dst = (quint64*)&value;
+	for (int attempt = 0; attempt < LIVESTATS_READ_RETRIES; attempt++) {
+		quint64 before = __atomic_load_n(&src[0], __ATOMIC_ACQUIRE);
+		if (before & 1)
+			continue;
+		for (unsigned i = 1; i < sizeof(T) / sizeof(quint64); i++) {
+			dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&src[0], __ATOMIC_RELAXED) == before) {
+			dst[0] = before;
+			return true;
+		}
+	}
+	return false;
+}
+
+// A mapping of the statistics segment
+class LiveStats {
+public:
+	LiveStats();
+	~LiveStats();
+
+	// Emulator side: creates (or replaces) the segment and maps it read-write
+	bool create(QString name, int edgeCount, int pathCount, int shardCount, int channelCount);
+	// Reader side: maps an existing segment read-only
+	bool open(QString name);
+	// Unmaps the segment; the creator also marks it as stopped and removes it
+	void close();
+
+	bool isOpen() const {
+		return data != NULL;
+	}
+
+	// True while the emulator that created the segment is running
+	bool isRunning() const {
+		return isOpen() && __atomic_load_n(&header()->running, __ATOMIC_ACQUIRE);
+	}
+
+	LiveStatsHeader *header() const {
+		return (LiveStatsHeader*)data;
+	}
+
+	LiveStatsConsumer *consumer(int channel) const {
+		return (LiveStatsConsumer*)(data + header()->consumerOffset) + channel;
+	}
+
+	LiveStatsShard *shard(int index) const {
+		return (LiveStatsShard*)(data + header()->shardOffset) + index;
+	}
+
+	LiveStatsEdge *edge(int index) const {
+		return (LiveStatsEdge*)(data + header()->edgeOffset) + index;
+	}
+
+	LiveStatsPath *path(int shardIndex, int index) const {
+		return (LiveStatsPath*)(data + header()->pathOffset) + shardIndex * header()->pathCount + index;
+	}
+
+	// Reader side: the totals of the consumers over all the receive channels; returns false if a record could not be read
+	bool readConsumers(LiveStatsConsumer &total) const;
+
+	// Reader side: the totals of a path over all the shards; returns false if a record could not be read
+	bool readPath(int index, LiveStatsPath &total) const;
+
+private:
+	quint8 *data;
+	size_t size;
+	QString name;
+	bool owner;
+};
+
+#endif // LIVESTATS_H
@@ -0,0 +1,221 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "resultsfile.h"
+
+ResultsFile::ResultsFile()
+{
+	data = NULL;
+	size = 0;
+}
+
+ResultsFile::~ResultsFile()
+{
+	close();
+}
+
+bool ResultsFile::open(QString fileName)
+{
+	close();
+	if (QSysInfo::ByteOrder != QSysInfo::LittleEndian) {
+		qDebug() << __FILE__ << __LINE__ << "Results files can only be mapped on little-endian hosts:" << fileName;
+		return false;
+	}
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::ReadOnly)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << fileName;
+		return false;
+	}
+	size = file.size();
+	data = size >= (qint64)sizeof(ResultsFileHeader) ? file.map(0, size) : NULL;
+	if (!data || !validate()) {
+		qDebug() << __FILE__ << __LINE__ << "Invalid results file:" << fileName;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void ResultsFile::close()
+{
+	if (data) {
+		file.unmap((uchar*)data);
+		data = NULL;
+	}
+	size = 0;
+	file.close();
+}
+
+// Checks that all the sections and columns are inside the file
+bool ResultsFile::validate() const
+{
+	if (memcmp(header().magic, RESULTS_FILE_MAGIC, sizeof(header().magic)) != 0 ||
+		header().version != RESULTS_FILE_VERSION)
+		return false;
+	quint64 sectionsEnd = sizeof(ResultsFileHeader) +
+						  (quint64)header().edgeCount * sizeof(ResultsEdgeSection) +
+						  (quint64)header().pathCount * sizeof(ResultsPathSection);
+	if (sectionsEnd > (quint64)size)
+		return false;
+	for (int i = 0; i < edgeCount(); i++) {
+		const ResultsEdgeSection &e = edge(i);
+		if (e.sampleCount > (quint64)size / sizeof(quint64))
+			return false;
+		for (int c = 0; c < RESULTS_EDGE_COLUMNS; c++) {
+			if (e.columnOffset[c] % sizeof(quint64) != 0 ||
+				e.columnOffset[c] + e.sampleCount * sizeof(quint64) > (quint64)size)
+				return false;
+		}
+		if (e.eventsOffset % sizeof(quint64) != 0 ||
+			e.eventsOffset + ((e.eventCount + 63) / 64) * sizeof(quint64) > (quint64)size)
+			return false;
+		if (e.fullTimelineBlocks > (quint64)size / EVENTLOG_BLOCK_SIZE ||
+			e.fullTimelineOffset % sizeof(quint64) != 0 ||
+			e.fullTimelineOffset + e.fullTimelineBlocks * EVENTLOG_BLOCK_SIZE > (quint64)size)
+			return false;
+	}
+	for (int i = 0; i < pathCount(); i++) {
+		const ResultsPathSection &p = path(i);
+		if (p.sampleCount > (quint64)size / sizeof(quint64))
+			return false;
+		for (int c = 0; c < RESULTS_PATH_COLUMNS; c++) {
+			if (p.columnOffset[c] % sizeof(quint64) != 0 ||
+				p.columnOffset[c] + p.sampleCount * sizeof(quint64) > (quint64)size)
+				return false;
+		}
+	}
+	return true;
+}
+
+quint64 ResultsFile::findFullTimelineBlock(int edgeIndex, quint64 timestamp) const
+{
+	// last block with baseTimestamp <= timestamp
+	quint64 lo = 0;
+	quint64 hi = edge(edgeIndex).fullTimelineBlocks;
+	while (hi - lo > 1) {
+		quint64 mid = lo + (hi - lo) / 2;
+		if (fullTimelineBlock(edgeIndex, mid)->baseTimestamp <= timestamp) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+void ResultsFile::unrollEdgeColumn(int edgeIndex, int column, QVector<quint64> &x, QVector<quint64> &y) const
+{
+	const ResultsEdgeSection &e = edge(edgeIndex);
+	const quint64 *timestamps = edgeColumn(edgeIndex, RESULTS_EDGE_TIMESTAMP);
+	const quint64 *values = edgeColumn(edgeIndex, column);
+	bool isQueue = column == RESULTS_EDGE_QUEUE_SAMPLED ||
+				   column == RESULTS_EDGE_QUEUE_AVG ||
+				   column == RESULTS_EDGE_QUEUE_MAX;
+	// how many bytes leave the queue during an idle period
+	quint64 delta = (e.rate_Bps * e.samplingPeriod) / 1000000000ULL;
+
+	x.clear();
+	y.clear();
+	if (e.sampleCount > 0 && e.samplingPeriod > 0) {
+		x.reserve(timestamps[e.sampleCount - 1] / e.samplingPeriod + 1);
+		y.reserve(x.capacity());
+	}
+
+	quint64 lastTs = 0;
+	quint64 lastValue = 0;
+	for (quint64 i = 0; i < e.sampleCount; i++) {
+		while (e.samplingPeriod > 0 && timestamps[i] > lastTs + e.samplingPeriod) {
+			lastTs += e.samplingPeriod;
+			lastValue = isQueue && delta < lastValue ? lastValue - delta : 0;
+			x << lastTs;
+			y << lastValue;
+		}
+		lastTs = timestamps[i];
+		lastValue = values[i];
+		x << lastTs;
+		y << lastValue;
+	}
+}
+
+ResultsFileWriter::ResultsFileWriter()
+{
+	memset(&headerData, 0, sizeof(headerData));
+	columnsEnd = 0;
+}
+
+bool ResultsFileWriter::open(QString fileName, int edgeCount, int pathCount, quint64 tsMin, quint64 tsMax)
+{
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << fileName;
+		return false;
+	}
+	out.setDevice(&file);
+	out.setByteOrder(QDataStream::LittleEndian);
+
+	memcpy(headerData.magic, RESULTS_FILE_MAGIC, sizeof(headerData.magic));
+	headerData.version = RESULTS_FILE_VERSION;
+	headerData.edgeCount = edgeCount;
+	headerData.pathCount = pathCount;
+	headerData.tsMin = tsMin;
+	headerData.tsMax = tsMax;
+
+	ResultsEdgeSection emptyEdge;
+	memset(&emptyEdge, 0, sizeof(emptyEdge));
+	edges.fill(emptyEdge, edgeCount);
+	ResultsPathSection emptyPath;
+	memset(&emptyPath, 0, sizeof(emptyPath));
+	paths.fill(emptyPath, pathCount);
+
+	// the columns start after the sections, which are written at the end
+	file.seek(sizeof(ResultsFileHeader) + edgeCount * sizeof(ResultsEdgeSection) + pathCount * sizeof(ResultsPathSection));
+	return true;
+}
+
+// Writes a section made only of 64-bit values
+template<typename T>
+static void writeSection(QDataStream &out, const T &section)
+{
+	const quint64 *words = (const quint64*)&section;
+	for (uint i = 0; i < sizeof(T) / sizeof(quint64); i++) {
+		out << words[i];
+	}
+}
+
+bool ResultsFileWriter::close()
+{
+	if (!file.isOpen())
+		return false;
+	file.seek(0);
+	out.writeRawData(headerData.magic, sizeof(headerData.magic));
+	out << headerData.version;
+	out << headerData.edgeCount;
+	out << headerData.pathCount;
+	out << headerData.reserved;
+	out << headerData.tsMin;
+	out << headerData.tsMax;
+	foreach (ResultsEdgeSection e, edges) {
+		writeSection(out, e);
+	}
+	foreach (ResultsPathSection p, paths) {
+		writeSection(out, p);
+	}
+	bool ok = out.status() == QDataStream::Ok;
+	file.close();
+	return ok;
+}
@@ -0,0 +1,248 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef RESULTSFILE_H
+#define RESULTSFILE_H
+
+#include <QtCore>
+#include "eventlog.h"
+#include "bitarray.h"
+
+// The results of an emulation run, in a single file that can be mapped in memory and used
+// without parsing.
+//
+// Layout (all integers are little-endian and all sections are 8-byte aligned):
+//     ResultsFileHeader
+//     ResultsEdgeSection[edgeCount]
+//     ResultsPathSection[pathCount]
+//     column data
+//
+// A timeline is stored as a set of columns of quint64, one value per sampling period.
+// Sampling periods without traffic are not stored: a gap between two consecutive timestamps
+// stands for a run of idle periods (see ResultsFile::unrollEdgeColumn()).
+// Packet events are stored as bits, 64 per word, the first event in the least significant bit.
+// Full timelines are stored as event log blocks (see eventlog.h).
+
+#define RESULTS_FILE_MAGIC   "LINERES1"
+#define RESULTS_FILE_VERSION 3
+
+// Edge timeline columns
+#define RESULTS_EDGE_TIMESTAMP     0 // relative to tsMin
+#define RESULTS_EDGE_ARRIVALS_P    1
+#define RESULTS_EDGE_ARRIVALS_B    2
+#define RESULTS_EDGE_QDROPS_P      3
+#define RESULTS_EDGE_QDROPS_B      4
+#define RESULTS_EDGE_RDROPS_P      5
+#define RESULTS_EDGE_RDROPS_B      6
+#define RESULTS_EDGE_QUEUE_SAMPLED 7
+#define RESULTS_EDGE_QUEUE_AVG     8
+#define RESULTS_EDGE_QUEUE_MAX     9
+#define RESULTS_EDGE_COLUMNS       10
+
+// Path timeline columns
+#define RESULTS_PATH_TIMESTAMP     0 // relative to tsMin
+#define RESULTS_PATH_ARRIVALS_P    1
+#define RESULTS_PATH_ARRIVALS_B    2
+#define RESULTS_PATH_EXITS_P       3
+#define RESULTS_PATH_EXITS_B       4
+#define RESULTS_PATH_DROPS_P       5
+#define RESULTS_PATH_DROPS_B       6
+#define RESULTS_PATH_DELAY_TOTAL   7
+#define RESULTS_PATH_DELAY_MAX     8
+#define RESULTS_PATH_DELAY_MIN     9
+#define RESULTS_PATH_COLUMNS       10
+
+struct ResultsFileHeader {
+	char magic[8];
+	quint32 version;
+	quint32 edgeCount;
+	quint32 pathCount;
+	quint32 reserved;
+	// time range of the emulation (ns)
+	quint64 tsMin;
+	quint64 tsMax;
+};
+
+// All the members are 64-bit, so the sections have no padding
+struct ResultsEdgeSection {
+	// edge properties
+	quint64 samplingPeriod;
+	quint64 rate_Bps;
+	quint64 qcapacity;
+	qint64 delay_ms;
+	// totals
+	quint64 packets_in;
+	quint64 qdrops;
+	quint64 rdrops;
+	// timeline: sampleCount values per column; the offsets are from the start of the file
+	quint64 sampleCount;
+	quint64 columnOffset[RESULTS_EDGE_COLUMNS];
+	// packet events: eventCount bits; if eventsLost words were lost, eventCount stops at the first one
+	quint64 eventCount;
+	quint64 eventsOffset;
+	quint64 eventsLost;
+	// full timeline: fullTimelineBlocks event log blocks, with one in fullTimelineSampling events
+	quint64 fullTimelineSampling;
+	quint64 fullTimelineBlocks;
+	quint64 fullTimelineOffset;
+};
+
+struct ResultsPathSection {
+	// path properties
+	quint64 samplingPeriod;
+	// totals
+	quint64 packets_in;
+	quint64 packets_out;
+	// timeline: sampleCount values per column; the offsets are from the start of the file
+	quint64 sampleCount;
+	quint64 columnOffset[RESULTS_PATH_COLUMNS];
+};
+
+// Read-only access to a results file through a memory map
+class ResultsFile {
+public:
+	ResultsFile();
+	~ResultsFile();
+
+	bool open(QString fileName);
+	void close();
+
+	bool isOpen() const {
+		return data != NULL;
+	}
+
+	const ResultsFileHeader &header() const {
+		return *(const ResultsFileHeader*)data;
+	}
+
+	int edgeCount() const {
+		return header().edgeCount;
+	}
+
+	int pathCount() const {
+		return header().pathCount;
+	}
+
+	const ResultsEdgeSection &edge(int index) const {
+		return ((const ResultsEdgeSection*)(data + sizeof(ResultsFileHeader)))[index];
+	}
+
+	const ResultsPathSection &path(int index) const {
+		return ((const ResultsPathSection*)(data + sizeof(ResultsFileHeader) +
+											edgeCount() * sizeof(ResultsEdgeSection)))[index];
+	}
+
+	// Columns with edge(index).sampleCount or path(index).sampleCount values
+	const quint64 *edgeColumn(int index, int column) const {
+		return (const quint64*)(data + edge(index).columnOffset[column]);
+	}
+
+	const quint64 *pathColumn(int index, int column) const {
+		return (const quint64*)(data + path(index).columnOffset[column]);
+	}
+
+	// 0 = successful forwarding; 1 = drop
+	int packetEvent(int edgeIndex, quint64 event) const {
+		const quint64 *words = (const quint64*)(data + edge(edgeIndex).eventsOffset);
+		return (words[event / 64] >> (event % 64)) & 1;
+	}
+
+	// All the packet events of an edge, for the BitArray queries
+	BitArray packetEvents(int edgeIndex) const {
+		return BitArray((const quint64*)(data + edge(edgeIndex).eventsOffset), edge(edgeIndex).eventCount);
+	}
+
+	const EventLogBlock *fullTimelineBlock(int edgeIndex, quint64 block) const {
+		return (const EventLogBlock*)(data + edge(edgeIndex).fullTimelineOffset) + block;
+	}
+
+	// Index of the block of the full timeline that contains the events at time timestamp
+	// (absolute, in ns), or 0 if the timeline starts later
+	quint64 findFullTimelineBlock(int edgeIndex, quint64 timestamp) const;
+
+	// Expands a column of an edge timeline to one value per sampling period, filling in the idle
+	// periods: the counters are zero, and the queue drains at the rate of the edge.
+	// x receives the timestamps, y the values.
+	void unrollEdgeColumn(int edgeIndex, int column, QVector<quint64> &x, QVector<quint64> &y) const;
+
+private:
+	bool validate() const;
+
+	QFile file;
+	const uchar *data;
+	qint64 size;
+};
+
+// Sequential writer for results files
+class ResultsFileWriter {
+public:
+	ResultsFileWriter();
+
+	// Reserves room for the header and the sections; the columns follow
+	bool open(QString fileName, int edgeCount, int pathCount, quint64 tsMin, quint64 tsMax);
+	// Writes the header and the sections, then closes the file
+	bool close();
+
+	// The sections are written by close(); the offsets come from beginColumn()
+	ResultsEdgeSection &edge(int index) {
+		return edges[index];
+	}
+
+	ResultsPathSection &path(int index) {
+		return paths[index];
+	}
+
+	// Starts a column or a packet event array at the current position, returns its offset
+	quint64 beginColumn() {
+		return file.pos();
+	}
+
+	void append(quint64 value) {
+		out << value;
+	}
+
+	// Reserves room for columns of up to rows values each, one after the other, at the current position.
+	// Returns the offset of the first one; they are filled with writeColumn() and closed with endColumns().
+	quint64 beginColumns(int columns, quint64 rows) {
+		quint64 offset = file.pos();
+		columnsEnd = offset + columns * rows * sizeof(quint64);
+		return offset;
+	}
+
+	// Writes count values of the column at columnOffset, starting with the given row
+	void writeColumn(quint64 columnOffset, quint64 row, const quint64 *values, int count) {
+		file.seek(columnOffset + row * sizeof(quint64));
+		for (int i = 0; i < count; i++) {
+			out << values[i];
+		}
+	}
+
+	void endColumns() {
+		file.seek(columnsEnd);
+	}
+
+private:
+	QFile file;
+	QDataStream out;
+	ResultsFileHeader headerData;
+	quint64 columnsEnd;
+	QVector<ResultsEdgeSection> edges;
+	QVector<ResultsPathSection> paths;
+};
+
+#endif // RESULTSFILE_H